@@ -0,0 +1,628 @@
+// Non-interactive benchmarks for the ElGamal primitives.  Prints one JSON
+// document to stdout; see usage() for options.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CiphertextBatch.h"
+#include "DiscreteLog.h"
+#include "Ed25519.h"
+#include "ElGamal.h"
+#include "ExamplePrimes.h"
+#include "GroupElGamal.h"
+#include "ObliviousTransfer.h"
+#include "Random.h"
+#include "SetIntersection.h"
+#include "Sha256.h"
+#include "Wire.h"
+
+using namespace std;
+using namespace ElGamal;
+
+// Allocation counting.  GMP allocates through its own hooks, the rest of
+// the library through operator new; both are counted.
+
+static atomic<unsigned long> allocations(0);
+
+void* operator new(size_t size)
+{
+	allocations++;
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+static void* gmpAlloc(size_t size)
+{
+	allocations++;
+	return malloc(size);
+}
+
+static void* gmpRealloc(void* p, size_t, size_t size)
+{
+	allocations++;
+	return realloc(p, size);
+}
+
+static void gmpFree(void* p, size_t)
+{
+	free(p);
+}
+
+struct Options
+{
+	double seconds = 0.5; // per operation, after warmup
+	unsigned long maxIters = 100000;
+	string group; // empty for all
+};
+
+struct Group
+{
+	const char* name;
+	mpz_class p;
+	mpz_class g;
+	unsigned subgroupExponentBits; // 0 for the full group
+
+	Params params() const
+	{
+		if (subgroupExponentBits == 0)
+			return Params(p, g);
+		return Params::primeOrderSubgroup(p, g, subgroupExponentBits);
+	}
+};
+
+class Reporter
+{
+	const Options& options;
+	bool firstResult = true;
+
+public:
+	explicit Reporter(const Options& _options) : options(_options) { }
+
+	// Time op until the time budget or iteration cap is used up.  Each
+	// call is timed on its own so percentiles are available.
+	void run(const string& group, const string& name, const function<void()>& op)
+	{
+		using clock = chrono::steady_clock;
+		op(); // warm caches and lazily built state
+
+		vector<double> nanos;
+		nanos.reserve(options.maxIters); // keep our own pushes out of the counts
+		const unsigned long allocsBefore = allocations;
+		const clock::time_point start = clock::now();
+		double elapsed = 0;
+		while (nanos.size() < options.maxIters
+				&& (nanos.size() < 3 || elapsed < options.seconds))
+		{
+			const clock::time_point before = clock::now();
+			op();
+			const clock::time_point after = clock::now();
+			nanos.push_back(chrono::duration<double, nano>(after - before).count());
+			elapsed = chrono::duration<double>(after - start).count();
+		}
+		const unsigned long allocs = allocations - allocsBefore;
+
+		vector<double> sorted = nanos;
+		sort(sorted.begin(), sorted.end());
+		auto percentile = [&](double q)
+		{
+			return sorted[min(sorted.size() - 1,
+					static_cast<size_t>(q * sorted.size()))];
+		};
+		double total = 0;
+		for (double n : nanos)
+			total += n;
+
+		cout << (firstResult ? "\n" : ",\n");
+		firstResult = false;
+		cout << "    {\"group\": \"" << group << "\", \"op\": \"" << name
+				<< "\", \"iterations\": " << nanos.size()
+				<< ", \"ops_per_sec\": " << nanos.size() / (total / 1e9)
+				<< ", \"mean_ns\": " << total / nanos.size()
+				<< ", \"p50_ns\": " << percentile(0.50)
+				<< ", \"p90_ns\": " << percentile(0.90)
+				<< ", \"p99_ns\": " << percentile(0.99)
+				<< ", \"max_ns\": " << sorted.back()
+				<< ", \"allocs_per_op\": "
+				<< static_cast<double>(allocs) / nanos.size() << "}" << flush;
+	}
+};
+
+static void benchGroup(Reporter& report, const Group& group,
+		RandomSource& rand)
+{
+	const string name = group.name;
+	const Params params = group.params();
+	const KeyPair keyPair = params.makeKeys(rand);
+	const PrivateKey& priv = keyPair.first;
+	const PublicKey& pub = keyPair.second;
+
+	const mpz_class base = rand.uniform(params.p - 2) + 1;
+	const mpz_class secret = rand.uniform(params.p - 1);
+
+	report.run(name, "modExp", [&] { params.modExp(base, secret); });
+	report.run(name, "modExp_public", [&]
+	{
+		params.modExp(base, secret, publicExponent);
+	});
+	// One kernel batch; GMP one at a time without AVX-512 IFMA.
+	const size_t lanes = MultiBufferExp::lanes;
+	vector<mpz_class> batchBases(lanes), batchPows(lanes), batchOuts(lanes);
+	vector<const mpz_class*> basePtrs, powPtrs;
+	vector<mpz_class*> outPtrs;
+	for (size_t i = 0; i < lanes; i++)
+	{
+		batchBases[i] = rand.uniform(params.p - 2) + 1;
+		batchPows[i] = rand.uniform(params.order);
+		basePtrs.push_back(&batchBases[i]);
+		powPtrs.push_back(&batchPows[i]);
+		outPtrs.push_back(&batchOuts[i]);
+	}
+	report.run(name, "modExpBatch_8", [&]
+	{
+		params.modExpBatch(outPtrs.data(), basePtrs.data(), powPtrs.data(), lanes);
+	});
+	report.run(name, "modExpG", [&] { params.modExpG(secret); });
+	report.run(name, "modExpG_public", [&]
+	{
+		params.gTable->modExp(secret, publicExponent);
+	});
+	report.run(name, "makeKeys", [&] { params.makeKeys(rand); });
+
+	const mpz_class msg = powerOf2(std::min(100u, params.keyBits - 2));
+	report.run(name, "encrypt", [&] { pub.encrypt(params, msg, rand); });
+
+	const Ciphertext cipher = pub.encrypt(params, msg, rand);
+	report.run(name, "decrypt", [&] { priv.decrypt(params, cipher); });
+
+	mpz_class inverse;
+	report.run(name, "secretModInv", [&] { params.secretModInv(inverse, base); });
+	const size_t invertCount = 64;
+	vector<mpz_class> inverses(invertCount);
+	vector<mpz_class*> inversePtrs;
+	for (auto& n : inverses)
+	{
+		n = base;
+		inversePtrs.push_back(&n);
+	}
+	report.run(name, "secretModInvBatch_64", [&]
+	{
+		params.secretModInvBatch(inversePtrs.data(), inversePtrs.data(),
+				invertCount);
+	});
+
+	Ciphertext reused;
+	report.run(name, "encrypt_into", [&] { pub.encrypt(reused, params, msg, rand); });
+	mpz_class decrypted;
+	report.run(name, "decrypt_into", [&] { priv.decrypt(decrypted, params, cipher); });
+
+	Ciphertext product = cipher;
+	report.run(name, "mult", [&] { product.mult(params, cipher); });
+	MontgomeryCiphertext montProduct(params, cipher);
+	const MontgomeryCiphertext montCipher(params, cipher);
+	report.run(name, "mult_montgomery", [&]
+	{
+		montProduct.mult(params, montCipher);
+	});
+	report.run(name, "rerandomize_montgomery", [&]
+	{
+		montProduct.rerandomize(params, pub, rand);
+	});
+
+	const unsigned threshold = 3, numShares = 5;
+	report.run(name, "generateShares", [&]
+	{
+		priv.generateShares(params, threshold, numShares, rand);
+	});
+
+	const vector<Keyshare> keyshares = priv.generateShares(params,
+			numShares, numShares, rand);
+	report.run(name, "decryptShare", [&]
+	{
+		keyshares[0].decryptShare(params, cipher);
+	});
+
+	vector<DecryptShare> shares;
+	for (const auto& keyshare : keyshares)
+		shares.push_back(keyshare.decryptShare(params, cipher));
+	report.run(name, "decryptWith", [&] { cipher.decryptWith(params, shares); });
+	report.run(name, "decryptWith_into", [&]
+	{
+		cipher.decryptWith(decrypted, params, shares);
+	});
+
+	// Proofs need a prime-order group.  The batch is each keyshare's
+	// shares of the same 16 ciphertexts, as a combiner would check them.
+	if (group.subgroupExponentBits != 0)
+	{
+		DecryptShare provedShare;
+		ShareProof proof;
+		report.run(name, "proveShare", [&]
+		{
+			keyshares[0].decryptShare(provedShare, proof, params, cipher, rand);
+		});
+		const mpz_class key = keyshares[0].verificationKey(params);
+		report.run(name, "verifyShare", [&]
+		{
+			proof.verify(params, key, cipher, provedShare);
+		});
+
+		const size_t proofParties = 4, proofCiphers = 16;
+		vector<Ciphertext> proofCipherSet;
+		vector<mpz_class> keys;
+		for (size_t i = 0; i < proofCiphers; i++)
+			proofCipherSet.push_back(pub.encrypt(params, msg, rand));
+		for (size_t k = 0; k < proofParties; k++)
+			keys.push_back(keyshares[k].verificationKey(params));
+		// Grown one at a time, so the claims' pointers stay valid.
+		vector<DecryptShare> provedShares;
+		vector<ShareProof> proofs;
+		provedShares.reserve(proofParties * proofCiphers);
+		proofs.reserve(proofParties * proofCiphers);
+		vector<ShareClaim> claims;
+		for (size_t k = 0; k < proofParties; k++)
+			for (size_t i = 0; i < proofCiphers; i++)
+			{
+				provedShares.emplace_back();
+				proofs.emplace_back();
+				keyshares[k].decryptShare(provedShares.back(), proofs.back(),
+						params, proofCipherSet[i], rand);
+				claims.push_back({ &keys[k], &proofCipherSet[i],
+						&provedShares.back(), &proofs.back() });
+			}
+		report.run(name, "verifyShareProofs_64", [&]
+		{
+			verifyShareProofs(params, claims, rand);
+		});
+	}
+
+	const mpz_class expMsg = priv.decrypt(params, cipher);
+	report.run(name, "tryLogBase2", [&] { tryLogBase2(params, expMsg); });
+
+	const DiscreteLog dlog(params, 2, 1ul << 20, 1ul << 10);
+	const mpz_class expCount = params.modExp(2, mpz_class(777777), publicExponent);
+	report.run(name, "discreteLogDecode", [&] { dlog.decode(expCount); });
+
+	// A set of ciphertexts as a vector and as a batch.
+	const size_t setSize = 256;
+	vector<Ciphertext> set(setSize, cipher);
+	CiphertextBatch batch(params, set);
+	const CiphertextBatch batchFactor(params, set);
+	report.run(name, "mult_vector_256", [&]
+	{
+		for (size_t i = 0; i < setSize; i++)
+			set[i].mult(params, cipher);
+	});
+	report.run(name, "mult_batch_256", [&] { batch.mult(params, batchFactor); });
+	vector<uint8_t> frame(Wire::frameBytes(params, setSize));
+	report.run(name, "writeFrame_vector_256", [&]
+	{
+		Wire::writeFrame(params, set, frame.data());
+	});
+	report.run(name, "writeFrame_batch_256", [&]
+	{
+		Wire::writeFrame(params, batch, frame.data());
+	});
+	report.run(name, "readFrame_batch_256", [&]
+	{
+		Wire::readFrame(params, batch, frame.data(), frame.data() + frame.size());
+	});
+
+	vector<uint8_t> wire(Wire::ciphertextBytes(params));
+	report.run(name, "serialize", [&] { Wire::write(params, cipher, wire.data()); });
+	Ciphertext parsed;
+	report.run(name, "deserialize", [&]
+	{
+		Wire::read(params, parsed, wire.data(), wire.data() + wire.size());
+	});
+}
+
+// The same operations on the curve group, through the generic templates.
+static void benchEd25519(Reporter& report, RandomSource& rand)
+{
+	typedef Ed25519Group G;
+	const string name = "ed25519";
+	const G group;
+	const auto keys = makeGroupKeys(group, rand);
+	const GroupPrivateKey<G>& priv = keys.first;
+	const GroupPublicKey<G>& pub = keys.second;
+
+	mpz_class secret;
+	group.randomExponent(secret, rand);
+	G::Element base, out;
+	group.expG(base, secret);
+	group.randomExponent(secret, rand);
+
+	report.run(name, "modExp", [&] { group.exp(out, base, secret); });
+	report.run(name, "modExp_public", [&]
+	{
+		group.exp(out, base, secret, publicExponent);
+	});
+	report.run(name, "modExpG", [&] { group.expG(out, secret); });
+	report.run(name, "makeKeys", [&] { makeGroupKeys(group, rand); });
+
+	G::Element msg;
+	group.expG(msg, 12345);
+	GroupCiphertext<G> cipher;
+	report.run(name, "encrypt_into", [&] { pub.encrypt(cipher, group, msg, rand); });
+	report.run(name, "decrypt_into", [&] { priv.decrypt(out, group, cipher); });
+
+	GroupCiphertext<G> product = cipher;
+	report.run(name, "mult", [&] { product.mult(group, cipher); });
+
+	const unsigned numShares = 5;
+	const vector<GroupKeyshare<G>> keyshares = priv.generateShares(group,
+			numShares, numShares, rand);
+	vector<GroupDecryptShare<G>> shares(numShares);
+	report.run(name, "decryptShare", [&]
+	{
+		keyshares[0].decryptShare(shares[0], group, cipher);
+	});
+	for (unsigned i = 0; i < numShares; i++)
+		keyshares[i].decryptShare(shares[i], group, cipher);
+	report.run(name, "decryptWith_into", [&]
+	{
+		cipher.decryptWith(out, group, shares);
+	});
+
+	vector<uint8_t> wire(cipher.bytes(group));
+	report.run(name, "serialize", [&] { cipher.write(group, wire.data()); });
+	GroupCiphertext<G> parsed;
+	report.run(name, "deserialize", [&]
+	{
+		parsed.read(group, wire.data(), wire.data() + wire.size());
+	});
+}
+
+// SHA-256, the hashing front end, and whole PSI runs in each mode with
+// both ends on two threads over an in-process link.
+static void benchPsi(Reporter& report, RandomSource& rand)
+{
+	const string name = "psi";
+	uint8_t block[Sha256::blockBytes] = { };
+	uint32_t state[8];
+	Sha256::initialize(state);
+	report.run(name, "sha256_block", [&] { Sha256::compress(state, block, 1); });
+
+	// The hashing front end alone.
+	vector<string> elements;
+	for (size_t i = 0; i < 65536; i++)
+		elements.push_back(to_string(1000000 + i));
+	const SetIntersection::HashLayout layout(elements.size(),
+			SetIntersection::cuckooOptions, rand);
+	vector<SetIntersection::ElementHash> hashes;
+	SetIntersection::BinLists lists;
+	report.run(name, "siphash_65536", [&] { layout.hash(elements, hashes); });
+	report.run(name, "cuckoo_bins_65536", [&]
+	{
+		SetIntersection::cuckooBins(layout, hashes, lists);
+	});
+	report.run(name, "simple_bins_65536", [&]
+	{
+		SetIntersection::simpleBins(layout, hashes, lists);
+	});
+
+	const size_t size = 4096;
+	vector<string> receiverSet, senderSet;
+	for (size_t i = 0; i < size; i++)
+	{
+		receiverSet.push_back(to_string(1000000 + i));
+		senderSet.push_back(to_string(1000000 + i + size / 2));
+	}
+	ChaCha20Random senderRand = ChaCha20Random::derive(rand);
+	vector<string> intersection;
+	report.run(name, "psi_ot_4096", [&]
+	{
+		auto link = ObliviousTransfer::memoryPair();
+		thread sender([&]
+		{
+			SetIntersection::otSend(*link.second, senderSet, senderRand);
+		});
+		SetIntersection::otReceive(*link.first, receiverSet, intersection, rand);
+		sender.join();
+	});
+
+	// The polynomial mode costs exponentiations per element, so fewer.
+	const Params params(examplePrime512, 5);
+	receiverSet.resize(256);
+	senderSet.resize(256);
+	report.run(name, "psi_poly_256_prime512", [&]
+	{
+		auto link = ObliviousTransfer::memoryPair();
+		thread sender([&]
+		{
+			SetIntersection::polynomialSend(*link.second, params, senderSet,
+					senderRand);
+		});
+		SetIntersection::polynomialReceive(*link.first, params, receiverSet,
+				intersection, rand);
+		sender.join();
+	});
+}
+
+// Many OTs in flight at once over one multiplexed link, against the same
+// number run one at a time.
+static void benchOt(Reporter& report, RandomSource& rand)
+{
+	const string name = "ot";
+	const Params params(examplePrime512, 5);
+	const KeyPair keys = params.makeKeys(rand);
+	const vector<Keyshare> keyshares = keys.first.generateShares(params, 2, 2,
+			rand);
+	const unsigned count = 256;
+	ChaCha20Random senderRand = ChaCha20Random::derive(rand);
+
+	report.run(name, "blocking_256_prime512", [&]
+	{
+		auto link = ObliviousTransfer::memoryPair();
+		ObliviousTransfer::Client sender(params, keys.second, keyshares[0],
+				link.first);
+		ObliviousTransfer::Client receiver(params, keys.second, keyshares[1],
+				link.second);
+		thread senderThread([&]
+		{
+			for (unsigned i = 0; i < count; i++)
+				sender.oblivSend1of2(0, 1, senderRand);
+		});
+		for (unsigned i = 0; i < count; i++)
+			receiver.oblivRecv1of2(i % 2, rand);
+		senderThread.join();
+	});
+
+	WorkStealingPool senderPool(2), receiverPool(2);
+	const ObliviousTransfer::Client sender(params, keys.second, keyshares[0]);
+	const ObliviousTransfer::Client receiver(params, keys.second, keyshares[1]);
+	report.run(name, "sessions_256_prime512", [&]
+	{
+		auto link = ObliviousTransfer::memoryPair();
+		ObliviousTransfer::SessionMux senderMux(link.first, senderPool);
+		ObliviousTransfer::SessionMux receiverMux(link.second, receiverPool);
+		for (unsigned i = 0; i < count; i++)
+		{
+			sender.oblivSend1of2(senderMux, i, 0, 1, senderRand, [](bool) { });
+			receiver.oblivRecv1of2(receiverMux, i, i % 2, rand,
+					[](bool, unsigned) { });
+		}
+		senderMux.wait();
+		receiverMux.wait();
+		senderMux.close();
+		receiverMux.close();
+	});
+
+	// Both ends sending and receiving at once on separate threads, as a
+	// mux's reader and writer do, with more in flight than a socket holds.
+	const size_t duplexCount = 16;
+	const string duplexMsg(1 << 20, 'x');
+	report.run(name, "socket_duplex_16x1MiB", [&]
+	{
+		auto link = ObliviousTransfer::socketPair();
+		vector<thread> threads;
+		for (const auto& end : { link.first, link.second })
+		{
+			threads.emplace_back([&, end]
+			{
+				for (size_t i = 0; i < duplexCount; i++)
+					end->send(string(duplexMsg));
+				end->flush();
+			});
+			threads.emplace_back([&, end]
+			{
+				string msg;
+				for (size_t i = 0; i < duplexCount; i++)
+					end->recv(msg);
+			});
+		}
+		for (auto& t : threads)
+			t.join();
+	});
+}
+
+// The ChaCha20 generator alone, in bulk and one value at a time, against
+// GMP's Mersenne Twister.
+static void benchRandom(Reporter& report, RandomSource& rand)
+{
+	const string name = "random";
+	ChaCha20Random stream = ChaCha20Random::derive(rand);
+	vector<uint8_t> bytes(65536);
+	report.run(name, "chacha20_64KiB", [&] { stream.fill(bytes.data(), bytes.size()); });
+
+	const size_t count = 1024;
+	const mpz_class bound = prime2048rfc3526;
+	vector<mpz_class> values(count);
+	report.run(name, "uniform_1024_p2048", [&]
+	{
+		stream.uniform(values.data(), count, bound);
+	});
+	report.run(name, "uniform_each_1024_p2048", [&]
+	{
+		for (auto& value : values)
+			stream.uniform(value, bound);
+	});
+	gmp_randclass mt(gmp_randinit_default);
+	report.run(name, "get_z_range_1024_p2048_mt", [&]
+	{
+		for (auto& value : values)
+			value = mt.get_z_range(bound);
+	});
+	report.run(name, "derive_chacha20", [&] { ChaCha20Random::derive(stream); });
+	report.run(name, "seed_mt", [&] { mt.seed(12345); });
+}
+
+static void usage(const char* argv0)
+{
+	cerr << "usage: " << argv0 << " [--seconds S] [--max-iters N] [--group NAME]\n"
+			<< "groups: prime16 prime512 prime2048 rfc3526 rfc3526q256 rfc3526q320\n"
+			<< "        ed25519 ot psi random\n";
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		const string arg = argv[i];
+		if (arg == "--seconds" && i + 1 < argc)
+			options.seconds = atof(argv[++i]);
+		else if (arg == "--max-iters" && i + 1 < argc)
+			options.maxIters = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--group" && i + 1 < argc)
+			options.group = argv[++i];
+		else
+		{
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	mp_set_memory_functions(gmpAlloc, gmpRealloc, gmpFree);
+
+	// Fixed key so runs are comparable.
+	const uint8_t benchKey[ChaCha20Random::keyBytes] = { 20, 16, 10, 17 };
+	ChaCha20Random rand(benchKey);
+
+	const vector<Group> groups = {
+		{ "prime16", examplePrime16, rand.uniform(examplePrime16 - 3) + 2, 0 },
+		{ "prime512", examplePrime512,
+				rand.uniform(examplePrime512 - 3) + 2, 0 },
+		{ "prime2048", examplePrime2048,
+				rand.uniform(examplePrime2048 - 3) + 2, 0 },
+		{ "rfc3526", prime2048rfc3526, 2, 0 },
+		{ "rfc3526q256", prime2048rfc3526, 2, 256 },
+		{ "rfc3526q320", prime2048rfc3526, 2, 320 }
+	};
+
+	cout << "{\n  \"results\": [";
+	Reporter report(options);
+	for (const auto& group : groups)
+		if (options.group.empty() || options.group == group.name)
+			benchGroup(report, group, rand);
+	if (options.group.empty() || options.group == "ed25519")
+		benchEd25519(report, rand);
+	if (options.group.empty() || options.group == "ot")
+		benchOt(report, rand);
+	if (options.group.empty() || options.group == "psi")
+		benchPsi(report, rand);
+	if (options.group.empty() || options.group == "random")
+		benchRandom(report, rand);
+	cout << "\n  ]\n}" << endl;
+
+	return 0;
+}
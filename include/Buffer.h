@@ -1,40 +1,434 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "Instrument.h"
 
-using std::queue;
+using std::atomic;
 using std::mutex;
 using std::lock_guard;
 using std::unique_lock;
 using std::condition_variable;
 
-template<typename Element>
-class Buffer
+// Bounded lock-free ring buffers for passing messages between threads.
+//
+// SpscBuffer allows one producer and one consumer thread; MpmcBuffer
+// allows any number of each.  Both block when full or empty, first
+// spinning, then yielding, then parking on a condition variable that the
+// other side only touches when someone is actually parked.  close() wakes
+// everyone: offers then fail, and takes fail once the buffer drains.
+
+const size_t cacheLineBytes = 64;
+const size_t defaultBufferCapacity = 1024;
+
+// Spin-then-park waiting for one side (producers or consumers) of a buffer.
+class Parker
 {
-	queue<Element> elems;
 	mutex mut;
 	condition_variable cv;
-	
+	atomic<unsigned> parked{0};
+
 public:
-	void offer(Element e)
+	// Wait until ready() holds.  ready must be safe to call concurrently
+	// with the other side and must observe close().
+	template<typename Ready>
+	void wait(Ready ready)
+	{
+		for (unsigned spin = 0; spin < 128; spin++)
+			if (ready())
+				return;
+		for (unsigned yield = 0; yield < 16; yield++)
+		{
+			if (ready())
+				return;
+			std::this_thread::yield();
+		}
+
+		unique_lock<mutex> lock(mut);
+		parked.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (!ready())
+			cv.wait(lock);
+		parked.fetch_sub(1);
+	}
+
+	// Call after publishing a change that may satisfy a waiter.
+	void wake()
 	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (parked.load(std::memory_order_relaxed) == 0)
+			return;
 		lock_guard<mutex> lock(mut);
-		elems.push(e);
-		cv.notify_one();
+		cv.notify_all();
+	}
+};
+
+// Keeps an index on its own cache line so that producers and consumers do
+// not invalidate each other's lines.  Padding rather than alignas, since
+// C++14 operator new ignores over-alignment.
+template<typename T>
+struct Padded
+{
+	char before[cacheLineBytes];
+	T value{};
+	char after[cacheLineBytes - sizeof(T) % cacheLineBytes];
+};
+
+// Uninitialized storage for ring slots, so Element need not be default-
+// constructible and moved-out slots hold nothing.
+template<typename Element>
+using RingSlot = typename std::aligned_storage<sizeof(Element),
+		alignof(Element)>::type;
+
+inline size_t ringCapacity(size_t requested)
+{
+	size_t capacity = 2;
+	while (capacity < requested)
+		capacity <<= 1;
+	return capacity;
+}
+
+template<typename Element>
+class SpscBuffer
+{
+	const size_t mask;
+	std::unique_ptr<RingSlot<Element>[]> slots;
+
+	// Each index is written by one side only.  The other side's index is
+	// cached locally and refreshed only when the ring looks full or empty.
+	struct ProducerSide
+	{
+		atomic<size_t> tail{0}; // next slot to fill
+		size_t cachedHead = 0;
+	};
+	struct ConsumerSide
+	{
+		atomic<size_t> head{0}; // next slot to drain
+		size_t cachedTail = 0;
+	};
+	Padded<ProducerSide> producer;
+	Padded<ConsumerSide> consumer;
+	atomic<size_t>& tail = producer.value.tail;
+	size_t& cachedHead = producer.value.cachedHead;
+	atomic<size_t>& head = consumer.value.head;
+	size_t& cachedTail = consumer.value.cachedTail;
+	atomic<bool> closed{false};
+	Parker producers, consumers;
+
+	Element* slot(size_t index)
+	{
+		return reinterpret_cast<Element*>(&slots[index & mask]);
+	}
+
+	// Free slots as seen by the producer, refreshing the cache if needed.
+	size_t space(size_t want)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (mask + 1 - (t - cachedHead) < want)
+			cachedHead = head.load(std::memory_order_acquire);
+		return mask + 1 - (t - cachedHead);
+	}
+
+	// Filled slots as seen by the consumer, refreshing the cache if needed.
+	size_t filled(size_t want)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (cachedTail - h < want)
+			cachedTail = tail.load(std::memory_order_acquire);
+		return cachedTail - h;
+	}
+
+public:
+	explicit SpscBuffer(size_t capacity = defaultBufferCapacity) :
+			mask(ringCapacity(capacity) - 1),
+			slots(new RingSlot<Element>[mask + 1]) { }
+	SpscBuffer(const SpscBuffer&) = delete;
+	SpscBuffer& operator=(const SpscBuffer&) = delete;
+
+	~SpscBuffer()
+	{
+		for (size_t h = head; h != tail; h++)
+			slot(h)->~Element();
+	}
+
+	size_t capacity() const { return mask + 1; }
+	// Head first, so a consumer moving between the loads cannot take it
+	// past the tail read; only a snapshot while others run.
+	size_t size() const
+	{
+		const size_t h = head.load();
+		const size_t t = tail.load();
+		return t >= h ? t - h : 0;
+	}
+
+	void close()
+	{
+		closed = true;
+		producers.wake();
+		consumers.wake();
+	}
+
+	// Offer up to n elements, moving from elems; blocks while full.
+	// Returns how many were offered, which is less than n only if closed.
+	size_t offerN(Element* elems, size_t n)
+	{
+		size_t done = 0;
+		while (done < n)
+		{
+			producers.wait([&] { return closed || space(1) > 0; });
+			if (closed)
+				break;
+
+			const size_t t = tail.load(std::memory_order_relaxed);
+			const size_t batch = std::min(space(n - done), n - done);
+			for (size_t i = 0; i < batch; i++)
+				new (slot(t + i)) Element(std::move(elems[done + i]));
+			tail.store(t + batch, std::memory_order_release);
+			done += batch;
+			consumers.wake();
+		}
+		if (Instrument::enabled && done > 0)
+			Instrument::record(Instrument::BufferDepth, size());
+		return done;
+	}
+
+	bool offer(Element&& e)
+	{
+		return offerN(&e, 1) == 1;
+	}
+
+	// Take at least one and at most max elements into out; blocks while
+	// empty.  Returns 0 only once closed and drained.
+	size_t takeN(Element* out, size_t max)
+	{
+		consumers.wait([&] { return filled(1) > 0 || closed; });
+
+		const size_t h = head.load(std::memory_order_relaxed);
+		const size_t batch = std::min(filled(max), max);
+		for (size_t i = 0; i < batch; i++)
+		{
+			Element* e = slot(h + i);
+			out[i] = std::move(*e);
+			e->~Element();
+		}
+		head.store(h + batch, std::memory_order_release);
+		if (batch > 0)
+			producers.wake();
+		return batch;
+	}
+
+	bool take(Element& out)
+	{
+		return takeN(&out, 1) == 1;
 	}
-	
+
+	// Drop-in for the old unbounded Buffer; a closed, drained buffer yields
+	// a default-constructed Element.
 	Element take()
 	{
-		unique_lock<mutex> lock(mut);
-		while (elems.empty())
+		Element e{};
+		take(e);
+		return e;
+	}
+};
+
+// Vyukov's bounded MPMC queue: each slot carries a sequence number that
+// says whether it is ready to be filled or drained for a given lap, so
+// producers and consumers claim slots with one CAS on their own index.
+template<typename Element>
+class MpmcBuffer
+{
+	struct Cell
+	{
+		atomic<size_t> sequence;
+		RingSlot<Element> storage;
+	};
+
+	const size_t mask;
+	std::unique_ptr<Cell[]> cells;
+	Padded<atomic<size_t>> paddedTail, paddedHead;
+	atomic<size_t>& tail = paddedTail.value;
+	atomic<size_t>& head = paddedHead.value;
+	atomic<bool> closed{false};
+	Parker producers, consumers;
+
+	static Element* element(Cell& cell)
+	{
+		return reinterpret_cast<Element*>(&cell.storage);
+	}
+
+	bool tryOffer(Element& e)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		while (true)
 		{
-			cv.wait(lock);
+			Cell& cell = cells[t & mask];
+			const size_t seq = cell.sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = seq - t;
+			if (diff == 0)
+			{
+				if (tail.compare_exchange_weak(t, t + 1,
+						std::memory_order_relaxed))
+				{
+					new (element(cell)) Element(std::move(e));
+					cell.sequence.store(t + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false; // full
+			else
+				t = tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	bool tryTake(Element& out)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Cell& cell = cells[h & mask];
+			const size_t seq = cell.sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = seq - (h + 1);
+			if (diff == 0)
+			{
+				if (head.compare_exchange_weak(h, h + 1,
+						std::memory_order_relaxed))
+				{
+					Element* e = element(cell);
+					out = std::move(*e);
+					e->~Element();
+					cell.sequence.store(h + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false; // empty
+			else
+				h = head.load(std::memory_order_relaxed);
 		}
-		return elems.pop();
+	}
+
+	bool looksFull()
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		return cells[t & mask].sequence.load(std::memory_order_acquire) != t;
+	}
+
+	bool looksEmpty()
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		return cells[h & mask].sequence.load(std::memory_order_acquire)
+				!= h + 1;
+	}
+
+public:
+	explicit MpmcBuffer(size_t capacity = defaultBufferCapacity) :
+			mask(ringCapacity(capacity) - 1), cells(new Cell[mask + 1])
+	{
+		for (size_t i = 0; i <= mask; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	MpmcBuffer(const MpmcBuffer&) = delete;
+	MpmcBuffer& operator=(const MpmcBuffer&) = delete;
+
+	~MpmcBuffer()
+	{
+		for (size_t h = head; h != tail; h++)
+			element(cells[h & mask])->~Element();
+	}
+
+	size_t capacity() const { return mask + 1; }
+	// Head first, so a consumer moving between the loads cannot take it
+	// past the tail read; only a snapshot while others run.
+	size_t size() const
+	{
+		const size_t h = head.load();
+		const size_t t = tail.load();
+		return t >= h ? t - h : 0;
+	}
+
+	void close()
+	{
+		closed = true;
+		producers.wake();
+		consumers.wake();
+	}
+
+	size_t offerN(Element* elems, size_t n)
+	{
+		size_t done = 0;
+		while (done < n && !closed)
+		{
+			if (tryOffer(elems[done]))
+			{
+				done++;
+				continue;
+			}
+			consumers.wake();
+			producers.wait([&] { return closed || !looksFull(); });
+		}
+		if (done > 0)
+		{
+			consumers.wake();
+			if (Instrument::enabled)
+				Instrument::record(Instrument::BufferDepth, size());
+		}
+		return done;
+	}
+
+	bool offer(Element&& e)
+	{
+		return offerN(&e, 1) == 1;
+	}
+
+	size_t takeN(Element* out, size_t max)
+	{
+		size_t done = 0;
+		while (done == 0)
+		{
+			while (done < max && tryTake(out[done]))
+				done++;
+			if (done > 0 || max == 0)
+				break;
+			if (closed)
+			{
+				// Producers may have finished an offer before closing.
+				if (tryTake(out[0]))
+					done = 1;
+				break;
+			}
+			consumers.wait([&] { return closed || !looksEmpty(); });
+		}
+		if (done > 0)
+			producers.wake();
+		return done;
+	}
+
+	bool take(Element& out)
+	{
+		return takeN(&out, 1) == 1;
+	}
+
+	Element take()
+	{
+		Element e{};
+		take(e);
+		return e;
 	}
 };
 
-#endif
\ No newline at end of file
+// The default buffer for channels with several threads on either end.
+template<typename Element>
+using Buffer = MpmcBuffer<Element>;
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef BYTES_H
+#define BYTES_H
+
+#include <cstdint>
+#include <string>
+
+// Little-endian integers for the fixed-width fields of protocol messages
+// and headers.  Group elements go through Wire, which is big-endian.
+namespace Bytes {
+
+	// A message's bytes, for encoding into and decoding from.
+	inline uint8_t* bytes(std::string& msg)
+	{
+		return reinterpret_cast<uint8_t*>(&msg[0]);
+	}
+
+	inline const uint8_t* bytes(const std::string& msg)
+	{
+		return reinterpret_cast<const uint8_t*>(msg.data());
+	}
+
+	// The low width bytes of word.
+	inline void putWord(uint8_t* out, const uint64_t word,
+			const unsigned width = 8)
+	{
+		for (unsigned i = 0; i < width; i++)
+			out[i] = word >> (8 * i);
+	}
+
+	inline uint64_t getWord(const uint8_t* in, const unsigned width = 8)
+	{
+		uint64_t word = 0;
+		for (unsigned i = 0; i < width; i++)
+			word |= uint64_t(in[i]) << (8 * i);
+		return word;
+	}
+
+	inline void putWord32(uint8_t* out, const uint32_t word)
+	{
+		putWord(out, word, 4);
+	}
+
+	inline uint32_t getWord32(const uint8_t* in)
+	{
+		return getWord(in, 4);
+	}
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CIPHERTEXTBATCH_H
+#define CIPHERTEXTBATCH_H
+
+#include <vector>
+#include "ElGamal.h"
+
+using std::vector;
+
+namespace ElGamal {
+	
+	// A set of ciphertexts stored as two contiguous arrays of fixed-width
+	// limbs, one for every B and one for every c, in Montgomery form.  An
+	// element costs exactly 2 * limbs words with no per-element header or
+	// heap block, and the kernels below walk the arrays front to back.
+	//
+	// Like Ciphertext, every operation takes the Params the batch was
+	// built for.
+	class CiphertextBatch
+	{
+		mp_size_t limbs;
+		size_t count;
+		vector<mp_limb_t> Bs, cs;
+		
+	public:
+		// One element's components, in Montgomery form.
+		template<typename Limb>
+		struct View
+		{
+			Limb* B;
+			Limb* c;
+		};
+		typedef View<mp_limb_t> ElementView;
+		typedef View<const mp_limb_t> ConstElementView;
+		
+		// count copies of the trivial encryption (1, 1).
+		explicit CiphertextBatch(const Params&, size_t count = 0);
+		CiphertextBatch(const Params&, const vector<Ciphertext>&);
+		
+		size_t size() const { return count; }
+		mp_size_t elementLimbs() const { return limbs; }
+		size_t storageBytes() const
+		{
+			return (Bs.size() + cs.size()) * sizeof(mp_limb_t);
+		}
+		void resize(const Params&, size_t count);
+		void reserve(size_t count);
+		void push_back(const Params&, const Ciphertext&);
+		
+		ElementView operator[](size_t i)
+		{
+			return { &Bs[i * limbs], &cs[i * limbs] };
+		}
+		ConstElementView operator[](size_t i) const
+		{
+			return { &Bs[i * limbs], &cs[i * limbs] };
+		}
+		// Components must be in [0, p).
+		void set(const Params&, size_t i, const Ciphertext&);
+		void get(const Params&, size_t i, Ciphertext& out) const;
+		Ciphertext get(const Params&, size_t i) const;
+		vector<Ciphertext> toCiphertexts(const Params&) const;
+		
+		// Element-wise homomorphic product with other, of the same size.
+		void mult(const Params&, const CiphertextBatch& other);
+		// Multiply every element by factor.
+		void mult(const Params&, const Ciphertext& factor);
+		// Raise every element to power, which must be non-negative.
+		void pow(const Params&, const mpz_class& power);
+		// Multiply each element by its own fresh encryption of 1.
+		void rerandomize(const Params&, const PublicKey&, RandomSource&);
+	};
+	
+}
+
+#endif
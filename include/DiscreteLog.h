@@ -0,0 +1,67 @@
+#ifndef DISCRETELOG_H
+#define DISCRETELOG_H
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ElGamal.h"
+
+using std::istream;
+using std::ostream;
+using std::shared_ptr;
+using std::vector;
+
+namespace ElGamal {
+	
+	// Recovers x from base^x mod p for x in [0, bound), for decoding
+	// exponential ElGamal plaintexts such as homomorphic sums.
+	//
+	// Baby steps base^j for j in [0, babySteps) are indexed by their low
+	// limb in an open-addressed hash table, so a value below babySteps is
+	// found with one probe.  Larger values take one giant step (a multiply
+	// by base^-babySteps) per further babySteps of range.  The table can
+	// be saved and reloaded to skip the babySteps multiplies at startup.
+	class DiscreteLog
+	{
+		mpz_class p, base;
+		unsigned long bound, babySteps;
+		mpz_class giantStep; // base^-babySteps mod p
+		size_t capacity = 0; // slots, a power of 2
+		const uint64_t* keys = nullptr; // low limb of base^j, 0 where empty
+		const uint32_t* values = nullptr; // j + 1, 0 where empty
+		shared_ptr<const void> storage; // keeps keys and values alive
+		
+		friend class PrecomputeCache;
+		
+		void prepareGiantStep();
+		
+	public:
+		// babySteps == 0 picks ceil(sqrt(bound)), the cheapest build for a
+		// given bound; larger tables make decoding faster.
+		DiscreteLog(const Params&, const mpz_class& base, unsigned long bound,
+				unsigned long babySteps = 0);
+		// An empty decoder to be filled by load().
+		DiscreteLog() : bound(0), babySteps(0) { }
+		
+		// The babySteps a constructor given 0 would choose.
+		static unsigned long defaultBabySteps(unsigned long bound);
+		
+		unsigned long maxValue() const { return bound; }
+		size_t tableBytes() const
+		{
+			return capacity * (sizeof(uint64_t) + sizeof(uint32_t));
+		}
+		
+		// x with base^x = n mod p and x < bound, or -1 if there is none.
+		long decode(const mpz_class& n) const;
+		
+		// Binary table image; load() returns false on a malformed stream.
+		void save(ostream&) const;
+		bool load(istream&);
+	};
+	
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef ED25519_H
+#define ED25519_H
+
+#include <cstdint>
+#include <vector>
+#include "gmpxx.h"
+#include "Exponent.h"
+#include "Random.h"
+
+using std::vector;
+
+namespace ElGamal {
+
+	// Field elements mod p = 2^255 - 19 are five 51-bit limbs in 64-bit
+	// words, with some headroom per limb and not necessarily fully
+	// reduced.
+	const mp_size_t ed25519FieldLimbs = 5;
+
+	struct Ed25519FieldElement
+	{
+		mp_limb_t limbs[ed25519FieldLimbs];
+	};
+
+	// A point in extended twisted Edwards coordinates (X : Y : Z : T), with
+	// x = X/Z, y = Y/Z and xy = T/Z.  The four coordinates are contiguous,
+	// so a table of points is a plain limb array.
+	struct Ed25519Point
+	{
+		Ed25519FieldElement X, Y, Z, T;
+	};
+
+	// The prime-order subgroup of edwards25519 (RFC 8032), written
+	// multiplicatively to fit Group.h: mul adds points and exp is scalar
+	// multiplication.  Elements travel as 32-byte compressed points, and
+	// exponents are reduced mod the subgroup order l ~ 2^252.
+	//
+	// Arithmetic is on fixed-width limbs with the complete addition law,
+	// so secret exponentiations run the same operations whatever the
+	// scalar and read their tables by full scans.
+	class Ed25519Group
+	{
+		mpz_class p; // field modulus
+		mpz_class l; // subgroup order
+		mpz_class pMinus2; // exponents for inversion and square roots
+		mpz_class sqrtExp; // (p - 5) / 8
+		Ed25519FieldElement d, d2, sqrtMinus1;
+		Ed25519Point base;
+		vector<Ed25519Point> baseTable; // d * 16^i * base, 16 per window
+
+		typedef Ed25519FieldElement Fe;
+		static Fe one() { return Fe{ { 1, 0, 0, 0, 0 } }; }
+		void add(Fe& out, const Fe& a, const Fe& b) const;
+		void sub(Fe& out, const Fe& a, const Fe& b) const;
+		void mul(Fe& out, const Fe& a, const Fe& b) const;
+		void sqr(Fe& out, const Fe& a) const;
+		void pow(Fe& out, const Fe& a, const mpz_class& pow) const;
+		bool isZero(const Fe&) const;
+		bool equal(const Fe&, const Fe&) const;
+
+		void dbl(Ed25519Point& out, const Ed25519Point& a) const;
+		// The point with affine y whose x has the given parity, if any.
+		bool decompress(Ed25519Point& out, const Fe& y, unsigned sign) const;
+		void scalarMul(Ed25519Point& out, const Ed25519Point& a,
+				const mpz_class& pow, bool secret) const;
+
+	public:
+		typedef Ed25519Point Element;
+		static const size_t encodedBytes = 32;
+
+		Ed25519Group();
+
+		const mpz_class& order() const { return l; }
+		const Element& generator() const { return base; }
+		void identity(Element&) const;
+		bool isIdentity(const Element&) const;
+		void mul(Element& out, const Element& a, const Element& b) const;
+		void inverse(Element& out, const Element& a) const;
+		void exp(Element& out, const Element& base, const mpz_class& pow,
+				SecretExponent = secretExponent) const;
+		void exp(Element& out, const Element& base, const mpz_class& pow,
+				PublicExponent) const;
+		void expG(Element& out, const mpz_class& pow) const;
+		bool equal(const Element&, const Element&) const;
+		void randomExponent(mpz_class&, RandomSource&) const;
+
+		// y little-endian, with the parity of x in the top bit.  read
+		// rejects non-canonical encodings and points outside the subgroup.
+		size_t elementBytes() const { return encodedBytes; }
+		uint8_t* write(const Element&, uint8_t* out) const;
+		const uint8_t* read(Element&, const uint8_t* in,
+				const uint8_t* end) const;
+	};
+
+}
+
+#endif
@@ -2,11 +2,21 @@
 #define ELGAMAL_H
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include "gmpxx.h"
+#include "Exponent.h"
+#include "FixedBaseTable.h"
+#include "MultiBufferExp.h"
+#include "Random.h"
+#include "ScratchArena.h"
+#include "ThreadPool.h"
 
 using std::move;
 using std::vector;
+using std::shared_ptr;
 using std::istream;
 using std::ostream;
 
@@ -26,32 +36,167 @@ namespace ElGamal {
 			"E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9"
 			"DE2BCBF6955817183995497CEA956AE515D2261898FA0510"
 			"15728E5A8AACAA68FFFFFFFFFFFFFFFF"
-	)
+	);
 	
 	class Params;
 	class PublicKey;
 	class PrivateKey;
 	typedef std::pair<PrivateKey, PublicKey> KeyPair;
 	class DecryptShare;
+	class ShareProof;
+	class PrecomputeCache;
+	class PrecomputePool;
 
+	// Threshold decryption exponents for each participant subset seen so
+	// far, keyed by the x coordinates in the order the shares were given.
+	// Entry i is -lambda_i mod the group order, so that the shares combine
+	// directly into (g^ab)^-1 without an inversion.
+	class LagrangeCache
+	{
+		std::map<vector<unsigned>, shared_ptr<const vector<mpz_class>>> cache;
+		std::mutex mut;
+		
+	public:
+		shared_ptr<const vector<mpz_class>> negatedCoeffs(const Params&,
+				const vector<DecryptShare>&);
+	};
+
+	// Functions taking an out parameter write into it instead of returning
+	// a new integer, and take their temporaries from the thread's
+	// ScratchArena; with outs reused, they allocate nothing in steady state.
+	
 	mpz_class powerOf2(unsigned);
+	void powerOf2(mpz_class& out, unsigned);
 	int tryLogBase2(const mpz_class&, unsigned low, unsigned high);
 	int tryLogBase2(const Params&, const mpz_class&);
 
+	// Shamir's scheme over exponents mod order, independent of the group:
+	// the y of points x = 1..numShares on a random polynomial of degree
+	// threshold - 1 through (0, secret).
+	vector<mpz_class> shamirShares(const mpz_class& secret,
+			const mpz_class& order, unsigned threshold, unsigned numShares,
+			RandomSource&);
+	// -lambda_i mod order for each x_i, interpolating at 0.
+	vector<mpz_class> negatedLagrangeCoeffs(const mpz_class& order,
+			const vector<unsigned>& xs);
+
+	// Secret exponent length for prime-order subgroups.  256 bits matches
+	// the ~128-bit strength of a 3072-bit group and exceeds that of the
+	// 2048-bit ones; 320 leaves a margin.
+	const unsigned defaultSubgroupExponentBits = 256;
+
 	class Params
 	{
 	public:
 		mpz_class p; // safe prime modulus
 		mpz_class g; // group generator
+		mpz_class order; // exponent modulus for g: p - 1, or q = (p-1)/2
 		unsigned keyBits;
+		unsigned exponentBits; // length of secret exponents
+		unsigned tableWindowBits; // fixed-base window width, 0 for no tables
+		// Tables mapped from disk, used before building any; may be null.
+		shared_ptr<const PrecomputeCache> cache;
+		shared_ptr<const MontgomeryContext> mont; // arithmetic mod p
+		shared_ptr<const FixedBaseTable> gTable; // powers of g
+		shared_ptr<LagrangeCache> lagrange;
+		// Batch kernel mod p, null if the CPU has none.
+		shared_ptr<const MultiBufferExp> multiBuffer;
 
-		Params(mpz_class _p, mpz_class _g) : p(move(_p)), g(move(_g)),
-				keyBits(mpz_sizeinbase(p.get_mpz_t(), 2)) { }
-		unsigned keyBytes() { return (keyBits + 7) / 8; }
-		KeyPair makeKeys(gmp_randclass&) const;
-		mpz_class modExp(const mpz_class& base, const mpz_class& pow) const;
-		mpz_class modExp(const mpz_class& base, unsigned pow) const;
+		// The full group mod p: exponents mod p - 1, secrets full length.
+		Params(mpz_class _p, mpz_class _g,
+				unsigned _tableWindowBits = defaultTableWindowBits,
+				shared_ptr<const PrecomputeCache> _cache = nullptr) :
+				Params(_p, move(_g), _p - 1, 0, _tableWindowBits,
+						move(_cache)) { }
+		// A group of the given order generated by g, with secrets of
+		// exponentBits bits (0 for the order's full length).
+		Params(mpz_class _p, mpz_class _g, mpz_class _order,
+				unsigned _exponentBits,
+				unsigned _tableWindowBits = defaultTableWindowBits,
+				shared_ptr<const PrecomputeCache> _cache = nullptr) :
+				p(move(_p)), g(move(_g)), order(move(_order)),
+				keyBits(mpz_sizeinbase(p.get_mpz_t(), 2)),
+				exponentBits(_exponentBits ? _exponentBits
+						: mpz_sizeinbase(order.get_mpz_t(), 2)),
+				tableWindowBits(_tableWindowBits),
+				cache(move(_cache)),
+				mont(makeMontgomery()),
+				gTable(makeTable(g)),
+				lagrange(std::make_shared<LagrangeCache>()),
+				multiBuffer(MultiBufferExp::available()
+						? std::make_shared<const MultiBufferExp>(p) : nullptr) { }
+		// The order-q subgroup of a safe prime p = 2q + 1, which g must
+		// generate (for prime2048rfc3526, g = 2 does).  Exponent arithmetic
+		// is mod q and secrets are short, so each secret exponentiation
+		// costs exponentBits squarings rather than keyBits.
+		static Params primeOrderSubgroup(const mpz_class& p, const mpz_class& g,
+				unsigned exponentBits = defaultSubgroupExponentBits,
+				unsigned tableWindowBits = defaultTableWindowBits,
+				shared_ptr<const PrecomputeCache> cache = nullptr);
+		bool shortExponents() const
+		{
+			return exponentBits < mpz_sizeinbase(order.get_mpz_t(), 2);
+		}
+		unsigned keyBytes() const { return (keyBits + 7) / 8; }
+		KeyPair makeKeys(RandomSource&) const;
+		// base^pow mod p, constant-time unless the exponent is tagged
+		// public (see Exponent.h).
+		mpz_class modExp(const mpz_class& base, const mpz_class& pow,
+				SecretExponent = secretExponent) const;
+		mpz_class modExp(const mpz_class& base, const mpz_class& pow,
+				PublicExponent) const;
+		void modExp(mpz_class& out, const mpz_class& base,
+				const mpz_class& pow, SecretExponent = secretExponent) const;
+		void modExp(mpz_class& out, const mpz_class& base,
+				const mpz_class& pow, PublicExponent) const;
+		mpz_class modExp(const mpz_class& base, unsigned pow,
+				SecretExponent = secretExponent) const;
+		mpz_class modExp(const mpz_class& base, unsigned pow,
+				PublicExponent) const;
+		void modExp(mpz_class& out, const mpz_class& base, unsigned pow,
+				SecretExponent = secretExponent) const;
+		void modExp(mpz_class& out, const mpz_class& base, unsigned pow,
+				PublicExponent) const;
+		// *out[i] = bases[i]^pows[i] mod p for i < count, eight at a time on
+		// the multi-buffer kernel when there is one.  Secret exponents must
+		// be in [0, order); the kernel's timing depends on whether they all
+		// fit in exponentBits, not on their values.
+		void modExpBatch(mpz_class* const* out, const mpz_class* const* bases,
+				const mpz_class* const* pows, size_t count,
+				SecretExponent = secretExponent) const;
+		void modExpBatch(mpz_class* const* out, const mpz_class* const* bases,
+				const mpz_class* const* pows, size_t count,
+				PublicExponent) const;
+		mpz_class modExpG(const mpz_class& pow) const;
+		void modExpG(mpz_class& out, const mpz_class& pow) const;
+		// g^pow in Montgomery form, limbs wide.
+		void modExpGMont(mp_limb_t* out, const mpz_class& pow) const;
+		// Product of bases[i]^pows[i] mod p, sharing one chain of
+		// squarings (Straus).  Exponents must be non-negative and public.
+		mpz_class multiExp(const vector<const mpz_class*>& bases,
+				const vector<mpz_class>& pows) const;
+		void multiExp(mpz_class& out, const vector<const mpz_class*>& bases,
+				const vector<mpz_class>& pows) const;
 		mpz_class modInv(const mpz_class&) const;
+		void modInv(mpz_class& out, const mpz_class&) const;
+		// Constant-time inverse, for secret n in (0, p).
+		void secretModInv(mpz_class& out, const mpz_class& n) const;
+		// *out[i] = *ns[i]^-1 for i < count, each secret in (0, p), with
+		// one secretModInv and 3 (count - 1) Montgomery multiplies
+		// (Montgomery's trick).  out[i] may be ns[i].
+		void secretModInvBatch(mpz_class* const* out,
+				const mpz_class* const* ns, size_t count) const;
+		// A secret exponent: uniform in [0, order), or in
+		// [0, 2^exponentBits) when exponents are short.
+		void randomExponent(mpz_class& out, RandomSource&) const;
+		// count of them, drawn in one pass.
+		void randomExponents(mpz_class* out, size_t count,
+				RandomSource&) const;
+		// Fixed-base table for exponentBits-bit exponents of base, from the
+		// cache if it has one, or null if tables are disabled.
+		shared_ptr<const FixedBaseTable> makeTable(const mpz_class& base) const;
+		// The context mod p, from the cache if it has one.
+		shared_ptr<const MontgomeryContext> makeMontgomery() const;
 	};
 
 	class Ciphertext
@@ -71,19 +216,69 @@ namespace ElGamal {
 		
 		mpz_class decryptWith(const Params&,
 				const vector<DecryptShare>&) const;
-				
-				
+		void decryptWith(mpz_class& out, const Params&,
+				const vector<DecryptShare>&) const;
+	};
+
+	// A ciphertext held in Montgomery form, for long chains of homomorphic
+	// operations.  Each mult is one limb product and REDC per component with
+	// no division, and nothing is allocated after construction.  Convert
+	// back with toCiphertext() to serialize or decrypt.
+	class MontgomeryCiphertext
+	{
+		mp_size_t limbs;
+		vector<mp_limb_t> data; // B, then c, then scratch
+		
+		mp_limb_t* B() { return data.data(); }
+		mp_limb_t* c() { return data.data() + limbs; }
+		mp_limb_t* scratch() { return data.data() + 2 * limbs; }
+		
+	public:
+		MontgomeryCiphertext(const Params&, const Ciphertext&);
+		void mult(const Params&, const mpz_class& plaintextFactor);
+		void mult(const Params&, const MontgomeryCiphertext& ciphertextFactor);
+		// Raise both components to power, in [0, order) when secret and
+		// non-negative when public.
+		void pow(const Params&, const mpz_class& power,
+				SecretExponent = secretExponent);
+		void pow(const Params&, const mpz_class& power, PublicExponent);
+		// Multiply in a fresh encryption of 1 under key.
+		void rerandomize(const Params&, const PublicKey& key,
+				RandomSource&);
+		Ciphertext toCiphertext(const Params&) const;
 	};
 
 	class PublicKey
 	{
 	public:
 		mpz_class A; // g^(secret a)
+		shared_ptr<const FixedBaseTable> aTable; // powers of A, may be null
 
 		PublicKey(mpz_class _A) : A(move(_A)) { }
-		Ciphertext compute(const Params&, gmp_randclass&) const;
+		PublicKey(const Params& params, mpz_class _A) : A(move(_A)),
+				aTable(params.makeTable(A)) { }
+		mpz_class modExpA(const Params&, const mpz_class& pow) const;
+		void modExpA(mpz_class& out, const Params&, const mpz_class& pow) const;
+		// A^pow in Montgomery form, limbs wide.
+		void modExpAMont(mp_limb_t* out, const Params&,
+				const mpz_class& pow) const;
+		Ciphertext compute(const Params&, RandomSource&) const;
+		void compute(Ciphertext& out, const Params&, RandomSource&) const;
+		// count pairs, their exponents drawn together.
+		void compute(Ciphertext* out, size_t count, const Params&,
+				RandomSource&) const;
 		Ciphertext encrypt(const Params&,
-				const mpz_class& msg, gmp_randclass&) const;
+				const mpz_class& msg, RandomSource&) const;
+		void encrypt(Ciphertext& out, const Params&,
+				const mpz_class& msg, RandomSource&) const;
+		// Encrypt with a pair from pool, which must be built for this key.
+		Ciphertext encrypt(const Params&, const mpz_class& msg,
+				PrecomputePool& pool, RandomSource&) const;
+		// Encrypt every message on pool, returning ciphertexts in input
+		// order.  rand only keys an independent stream per task.
+		vector<Ciphertext> encryptBatch(const Params&,
+				const vector<mpz_class>& msgs, RandomSource&,
+				ThreadPool&) const;
 	};
 	
 	class DecryptShare
@@ -100,6 +295,53 @@ namespace ElGamal {
 		friend ostream& operator<<(ostream&, const DecryptShare&);
 	};
 	
+	// A non-interactive Chaum-Pedersen proof that a decryption share is
+	// B^y for the y behind a keyshare's verification key g^y, i.e. that
+	// log_g of the key equals log_B of the share.  The challenge is a
+	// 128-bit SHA-256 hash of the statement and commitments (Fiat-Shamir).
+	//
+	// Only sound in a group of prime order, so proofs need Params from
+	// primeOrderSubgroup; in the full group mod p a share could be off by
+	// a factor of -1 undetected, and verification rejects everything.
+	class ShareProof
+	{
+	public:
+		mpz_class t1; // g^r
+		mpz_class t2; // B^r
+		mpz_class s; // r + challenge * y mod order
+		
+		ShareProof() = default;
+		ShareProof(mpz_class _t1, mpz_class _t2, mpz_class _s) :
+				t1(move(_t1)), t2(move(_t2)), s(move(_s)) { }
+		// Sets s, given t1 and t2 made with the nonce r, r uniform mod the
+		// order: the prover's last step, for callers that batch the rest.
+		void respond(const Params&, const mpz_class& key, const Ciphertext&,
+				const mpz_class& share, const mpz_class& y, const mpz_class& r);
+		// True if this proves share is cipher's B^y for key = g^y.
+		bool verify(const Params&, const mpz_class& key, const Ciphertext&,
+				const DecryptShare&) const;
+		friend istream& operator>>(istream&, ShareProof&);
+		friend ostream& operator<<(ostream&, const ShareProof&);
+	};
+	
+	// A share to check, with the key of the keyshare that made it.
+	struct ShareClaim
+	{
+		const mpz_class* key; // g^y
+		const Ciphertext* cipher;
+		const DecryptShare* share;
+		const ShareProof* proof;
+	};
+	
+	// True if every claim's proof holds; false if any does not, without
+	// saying which (ShareProof::verify finds it).  The proofs are combined
+	// with random 128-bit weights into one multiExp, in which the powers
+	// of each key and each ciphertext's B are merged, so checking many
+	// shares costs far less than checking each.  rand draws the weights
+	// and must be unpredictable to the provers.
+	bool verifyShareProofs(const Params&, const vector<ShareClaim>&,
+			RandomSource&);
+	
 	class Keyshare
 	{
 	public:
@@ -107,7 +349,21 @@ namespace ElGamal {
 		mpz_class y; // y of Shamir coordinate
 		
 		Keyshare(unsigned _x, mpz_class _y) : x(_x), y(move(_y)) { }
+		// g^y, published so that this keyshare's shares can be checked.
+		mpz_class verificationKey(const Params&) const;
 		DecryptShare decryptShare(const Params&, const Ciphertext&) const;
+		void decryptShare(DecryptShare& out, const Params&,
+				const Ciphertext&) const;
+		// A share with a proof that it is correct.
+		void decryptShare(DecryptShare& out, ShareProof& proof, const Params&,
+				const Ciphertext&, RandomSource&) const;
+		vector<DecryptShare> decryptShareBatch(const Params&,
+				const vector<Ciphertext>&, ThreadPool&) const;
+		// Shares with proofs into proofs, in input order.  rand only keys
+		// an independent stream per task.
+		vector<DecryptShare> decryptShareBatch(const Params&,
+				const vector<Ciphertext>&, vector<ShareProof>& proofs,
+				RandomSource&, ThreadPool&) const;
 	};
 	
 	class PrivateKey
@@ -117,8 +373,11 @@ namespace ElGamal {
 
 		PrivateKey(mpz_class _a) : a(move(_a)) { }
 		mpz_class decrypt(const Params&, const Ciphertext&) const;
+		void decrypt(mpz_class& out, const Params&, const Ciphertext&) const;
+		vector<mpz_class> decryptBatch(const Params&,
+				const vector<Ciphertext>&, ThreadPool&) const;
 		vector<Keyshare> generateShares(const Params&, unsigned threshold,
-				unsigned numShares, gmp_randclass&) const;
+				unsigned numShares, RandomSource&) const;
 	};
 
 }
@@ -0,0 +1,32 @@
+#ifndef EXAMPLEPRIMES_H
+#define EXAMPLEPRIMES_H
+
+#include "gmpxx.h"
+
+// Random primes of assorted sizes for testing and benchmarking.  Unlike
+// ElGamal::prime2048rfc3526 these are not safe primes.
+
+// WolframAlpha: NextPrime[RandomInteger[{2^2047, 2^2048 - 1}]]
+const mpz_class examplePrime2048("232694713771420053057630659213799416664731018"
+		"9359913423003833628344403322850843540167605845929639947507378497669310"
+		"2762094021960948437186598373448972361943112395383369839334032056711919"
+		"9920031245087329849131698258142680893603082257798623479652433420482940"
+		"3617547495329660017332424979362164574574781241001013805001492416897769"
+		"6064860217934423820631768414917668025181498424391491613419411424646499"
+		"8299225473626180129133915073742515526257311774033375074610794958570909"
+		"7600402059690183762551033097266501366844931910700964368934454192256450"
+		"1337067551530076879504006300195645658951599597753082457935644344685069"
+		"504949373939");
+
+// WolframAlpha: NextPrime[RandomInteger[{2^511, 2^512 - 1}]]
+const mpz_class examplePrime512("1188079157195371837740287837372032314777428766"
+		"8030217970706261563262339372869147702623362771035225481725961888214611"
+		"801269114442842045500352749369483590123");
+
+// WolframAlpha: NextPrime[RandomInteger[{2^15, 2^16 - 1}]]
+const mpz_class examplePrime16(64151);
+
+// WolframAlpha: NextPrime[RandomInteger[{2^7, 2^8 - 1}]]
+const mpz_class examplePrime8(149);
+
+#endif
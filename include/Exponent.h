@@ -0,0 +1,21 @@
+#ifndef EXPONENT_H
+#define EXPONENT_H
+
+namespace ElGamal {
+	
+	// Tags choosing how an exponentiation may treat its exponent.
+	//
+	// Secret exponents (keys, key shares, encryption randomness) take
+	// constant-time paths, whose timing and memory accesses depend only on
+	// operand sizes.  Public ones (Lagrange coefficients, homomorphic
+	// scalars, search candidates) take GMP's faster variable-time code.
+	// Calls without a tag are treated as secret.
+	struct SecretExponent { };
+	struct PublicExponent { };
+	
+	const SecretExponent secretExponent = { };
+	const PublicExponent publicExponent = { };
+	
+}
+
+#endif
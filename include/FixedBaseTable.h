@@ -0,0 +1,78 @@
+#ifndef FIXEDBASETABLE_H
+#define FIXEDBASETABLE_H
+
+#include <memory>
+#include <vector>
+#include "gmpxx.h"
+#include "Exponent.h"
+#include "Montgomery.h"
+#include "ScratchArena.h"
+
+using std::shared_ptr;
+using std::vector;
+
+namespace ElGamal {
+
+	// Default window width for fixed-base tables.  A table for a k-bit
+	// exponent holds ceil(k / w) * 2^w residues, so at 2048 bits a width of 4
+	// costs 2 MiB per base and replaces ~2048 squarings with 512 multiplies.
+	const unsigned defaultTableWindowBits = 4;
+
+	// Precomputed powers base^(d * 2^(w*i)) mod p for every window i and
+	// digit d in [0, 2^w).  An exponentiation is then one table lookup and
+	// one Montgomery multiply per window, with no squarings.  Entries are
+	// fixed-width limb arrays so that lookups can scan the whole window.
+	class FixedBaseTable
+	{
+		shared_ptr<const MontgomeryContext> mont;
+		unsigned windowBits;
+		unsigned windows;
+		const mp_limb_t* table; // windows * 2^windowBits entries
+		shared_ptr<const void> storage; // keeps table alive
+		
+		void windowProduct(mp_limb_t* out, const mpz_class& pow,
+				bool secret) const;
+		void modExp(mpz_class& out, const mpz_class& pow, bool secret) const;
+
+	public:
+		FixedBaseTable(shared_ptr<const MontgomeryContext> mont,
+				const mpz_class& base, unsigned expBits,
+				unsigned windowBits = defaultTableWindowBits);
+		// Over a table built elsewhere, such as one mapped from disk:
+		// tableLimbs(...) limbs laid out as data() is, kept alive by
+		// storage.
+		FixedBaseTable(shared_ptr<const MontgomeryContext> mont,
+				unsigned expBits, unsigned windowBits, const mp_limb_t* table,
+				shared_ptr<const void> storage);
+
+		static size_t tableLimbs(const MontgomeryContext&, unsigned expBits,
+				unsigned windowBits);
+		unsigned expBits() const { return windows * windowBits; }
+		unsigned windowWidth() const { return windowBits; }
+		const mp_limb_t* data() const { return table; }
+		size_t tableBytes() const
+		{
+			return tableLimbs(*mont, expBits(), windowBits) * sizeof(mp_limb_t);
+		}
+
+		// True if pow lies in [0, 2^expBits()).
+		bool covers(const mpz_class& pow) const;
+		// base^pow, in Montgomery form, into out (limbs() wide).  pow must
+		// be covered by the table.
+		void modExpMont(mp_limb_t* out, const mpz_class& pow,
+				SecretExponent = secretExponent) const;
+		void modExpMont(mp_limb_t* out, const mpz_class& pow,
+				PublicExponent) const;
+		
+		// base^pow mod p.  pow must be covered by the table.
+		mpz_class modExp(const mpz_class& pow,
+				SecretExponent = secretExponent) const;
+		mpz_class modExp(const mpz_class& pow, PublicExponent) const;
+		void modExp(mpz_class& out, const mpz_class& pow,
+				SecretExponent = secretExponent) const;
+		void modExp(mpz_class& out, const mpz_class& pow, PublicExponent) const;
+	};
+
+}
+
+#endif
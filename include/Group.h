@@ -0,0 +1,101 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <cstdint>
+#include "gmpxx.h"
+#include "ElGamal.h"
+#include "Exponent.h"
+#include "Wire.h"
+
+namespace ElGamal {
+
+	// The group interface used by the templates in GroupElGamal.h.  A group
+	// is written multiplicatively, whatever its native notation, and
+	// provides:
+	//
+	//   typedef ... Element;
+	//   const mpz_class& order() const;      exponents are reduced mod this
+	//   void identity(Element&) const;
+	//   void mul(Element& out, const Element&, const Element&) const;
+	//   void inverse(Element& out, const Element&) const;   constant-time
+	//   void exp(Element& out, const Element& base, const mpz_class& pow,
+	//           SecretExponent = secretExponent) const;
+	//   void exp(Element& out, const Element& base, const mpz_class& pow,
+	//           PublicExponent) const;
+	//   void expG(Element& out, const mpz_class& pow) const;  secret pow
+	//   bool equal(const Element&, const Element&) const;
+	//   void randomExponent(mpz_class&, RandomSource&) const;
+	//   size_t elementBytes() const;
+	//   uint8_t* write(const Element&, uint8_t* out) const;
+	//   const uint8_t* read(Element&, const uint8_t* in,
+	//           const uint8_t* end) const;
+	//
+	// Outputs may alias inputs.  Readers return nullptr on short input or
+	// on anything that is not an element of the group.
+	//
+	// ModPGroup and Ed25519Group (Ed25519.h) are the two instantiations.
+
+	// The group mod p described by params, through its optimized methods:
+	// fixed-base tables, Montgomery exponentiation and the wire format.
+	// The concrete classes in ElGamal.h remain the full-featured API for
+	// this group; this adapter lets generic code run on it too.
+	class ModPGroup
+	{
+		const Params& params;
+
+	public:
+		typedef mpz_class Element;
+
+		// params must outlive the group.
+		explicit ModPGroup(const Params& _params) : params(_params) { }
+
+		const Params& modP() const { return params; }
+		const mpz_class& order() const { return params.order; }
+		void identity(Element& out) const { out = 1; }
+		void mul(Element& out, const Element& a, const Element& b) const
+		{
+			mpz_mul(out.get_mpz_t(), a.get_mpz_t(), b.get_mpz_t());
+			mpz_mod(out.get_mpz_t(), out.get_mpz_t(), params.p.get_mpz_t());
+		}
+		void inverse(Element& out, const Element& a) const
+		{
+			params.secretModInv(out, a);
+		}
+		void exp(Element& out, const Element& base, const mpz_class& pow,
+				SecretExponent = secretExponent) const
+		{
+			params.modExp(out, base, pow, secretExponent);
+		}
+		void exp(Element& out, const Element& base, const mpz_class& pow,
+				PublicExponent) const
+		{
+			params.modExp(out, base, pow, publicExponent);
+		}
+		void expG(Element& out, const mpz_class& pow) const
+		{
+			params.modExpG(out, pow);
+		}
+		bool equal(const Element& a, const Element& b) const { return a == b; }
+		void randomExponent(mpz_class& out, RandomSource& rand) const
+		{
+			params.randomExponent(out, rand);
+		}
+
+		size_t elementBytes() const { return Wire::elementBytes(params); }
+		uint8_t* write(const Element& element, uint8_t* out) const
+		{
+			return Wire::writeElement(params, element, out);
+		}
+		const uint8_t* read(Element& element, const uint8_t* in,
+				const uint8_t* end) const
+		{
+			// Zero is in range for the wire format but not in the group.
+			const uint8_t* const next = Wire::readElement(params, element, in,
+					end);
+			return next != nullptr && sgn(element) != 0 ? next : nullptr;
+		}
+	};
+
+}
+
+#endif
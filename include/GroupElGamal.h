@@ -0,0 +1,174 @@
+#ifndef GROUPELGAMAL_H
+#define GROUPELGAMAL_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "gmpxx.h"
+#include "ElGamal.h"
+#include "Group.h"
+
+using std::move;
+using std::vector;
+
+namespace ElGamal {
+
+	// ElGamal, with threshold decryption, over any group with the interface
+	// described in Group.h.  Messages are group elements; for counters,
+	// encode m as g^m with expG.  Every function takes the group first,
+	// as the mod-p classes take Params.
+
+	template<typename Group> class GroupDecryptShare;
+
+	template<typename Group>
+	class GroupCiphertext
+	{
+	public:
+		typedef typename Group::Element Element;
+
+		Element B; // g^(msg secret b)
+		Element c; // msg * A^b
+
+		void mult(const Group& group, const Element& plaintextFactor)
+		{
+			group.mul(c, c, plaintextFactor);
+		}
+		void mult(const Group& group, const GroupCiphertext& cipherFactor)
+		{
+			group.mul(B, B, cipherFactor.B);
+			group.mul(c, c, cipherFactor.c);
+		}
+		// The power is a homomorphic scalar, not a secret.
+		void pow(const Group& group, const mpz_class& power)
+		{
+			group.exp(B, B, power, publicExponent);
+			group.exp(c, c, power, publicExponent);
+		}
+
+		// c * prod share_i^(-lambda_i): the shares must come from distinct
+		// keyshares of one sharing, at least threshold of them.
+		void decryptWith(Element& out, const Group& group,
+				const vector<GroupDecryptShare<Group>>& shares) const
+		{
+			vector<unsigned> xs;
+			xs.reserve(shares.size());
+			for (const auto& share : shares)
+				xs.push_back(share.x);
+			const vector<mpz_class> coeffs = negatedLagrangeCoeffs(
+					group.order(), xs);
+
+			Element term;
+			out = c;
+			for (size_t i = 0; i < shares.size(); i++)
+			{
+				group.exp(term, shares[i].share, coeffs[i], publicExponent);
+				group.mul(out, out, term);
+			}
+		}
+
+		size_t bytes(const Group& group) const
+		{
+			return 2 * group.elementBytes();
+		}
+		uint8_t* write(const Group& group, uint8_t* out) const
+		{
+			return group.write(c, group.write(B, out));
+		}
+		const uint8_t* read(const Group& group, const uint8_t* in,
+				const uint8_t* end)
+		{
+			in = group.read(B, in, end);
+			return in == nullptr ? nullptr : group.read(c, in, end);
+		}
+	};
+
+	template<typename Group>
+	class GroupPublicKey
+	{
+	public:
+		typedef typename Group::Element Element;
+
+		Element A; // g^(secret a)
+
+		// out = (g^b, msg * A^b) for fresh b.
+		void encrypt(GroupCiphertext<Group>& out, const Group& group,
+				const Element& msg, RandomSource& rand) const
+		{
+			mpz_class b;
+			group.randomExponent(b, rand);
+			group.expG(out.B, b);
+			group.exp(out.c, A, b);
+			group.mul(out.c, out.c, msg);
+		}
+	};
+
+	template<typename Group>
+	class GroupDecryptShare
+	{
+	public:
+		typedef typename Group::Element Element;
+
+		unsigned x; // x of Shamir coordinate
+		Element share; // B^(keyshare's y)
+	};
+
+	template<typename Group>
+	class GroupKeyshare
+	{
+	public:
+		unsigned x; // x of Shamir coordinate
+		mpz_class y; // y of Shamir coordinate
+
+		void decryptShare(GroupDecryptShare<Group>& out, const Group& group,
+				const GroupCiphertext<Group>& cipher) const
+		{
+			out.x = x;
+			group.exp(out.share, cipher.B, y);
+		}
+	};
+
+	template<typename Group>
+	class GroupPrivateKey
+	{
+	public:
+		typedef typename Group::Element Element;
+
+		mpz_class a; // secret
+
+		// c / B^a.
+		void decrypt(Element& out, const Group& group,
+				const GroupCiphertext<Group>& cipher) const
+		{
+			group.exp(out, cipher.B, a);
+			group.inverse(out, out);
+			group.mul(out, out, cipher.c);
+		}
+		vector<GroupKeyshare<Group>> generateShares(const Group& group,
+				unsigned threshold, unsigned numShares,
+				RandomSource& rand) const
+		{
+			vector<mpz_class> ys = shamirShares(a, group.order(), threshold,
+					numShares, rand);
+			vector<GroupKeyshare<Group>> shares(numShares);
+			for (unsigned x = 1; x <= numShares; x++)
+			{
+				shares[x - 1].x = x;
+				shares[x - 1].y = move(ys[x - 1]);
+			}
+			return shares;
+		}
+	};
+
+	template<typename Group>
+	std::pair<GroupPrivateKey<Group>, GroupPublicKey<Group>> makeGroupKeys(
+			const Group& group, RandomSource& rand)
+	{
+		std::pair<GroupPrivateKey<Group>, GroupPublicKey<Group>> keys;
+		group.randomExponent(keys.first.a, rand);
+		group.expG(keys.second.A, keys.first.a);
+		return keys;
+	}
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef HASHING_H
+#define HASHING_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gmpxx.h"
+#include "Random.h"
+#include "ThreadPool.h"
+
+using std::array;
+using std::string;
+using std::vector;
+
+namespace SetIntersection
+{
+
+	// The hashing front end of the set intersection protocols: it maps
+	// elements into bins, so that each element only meets the other
+	// party's elements of the same bin instead of all of them.  One side
+	// cuckoo-hashes its set, at most one element per bin; the other puts
+	// each element into every bin it could occupy.
+	//
+	// Bins are split into partitions of a few thousand, and all of an
+	// element's bins lie in one partition.  Builders sort elements by
+	// partition, then fill each partition's bins on its own, so each
+	// task's working set stays in cache and the tables come out the same
+	// whatever the thread count.
+
+	typedef array<uint64_t, 2> HashKey;
+
+	// SipHash-2-4 with a 128-bit output (Aumasson-Bernstein).
+	void sipHash128(const HashKey&, const void* data, size_t bytes,
+			uint64_t* out);
+
+	// An element's keyed hash, from which every one of its bins follows.
+	struct ElementHash
+	{
+		uint64_t partitionWord;
+		uint64_t binWord;
+	};
+
+	const unsigned maxHashCount = 4;
+	const size_t maxStashSize = 64;
+
+	struct HashOptions
+	{
+		unsigned hashCount; // bins per element, 1 to maxHashCount
+		double binsPerElement;
+		// Cuckoo elements no bin could take, compared with the whole of
+		// the other set.  Each stash slot costs a comparison per element
+		// of that set, so large sets do better to retry with a new key.
+		size_t stashSize;
+		size_t partitionBins;
+	};
+
+	// Three hash functions fill 1/1.27 of the bins with rare failures.
+	const HashOptions cuckooOptions = { 3, 1.27, 0, 1 << 13 };
+	// One hash function, about one element per bin.
+	const HashOptions bucketOptions = { 1, 1.0, 0, 1 << 13 };
+
+	// The choice of bins, which both parties must share: the receiver
+	// picks it and sends it over.
+	class HashLayout
+	{
+	public:
+		HashKey key;
+		size_t bins;
+		size_t partitions;
+		unsigned hashCount;
+		size_t stashSize;
+
+		static const size_t encodedBytes = 16 + 8 + 8 + 1 + 1;
+
+		HashLayout() = default;
+		// A layout for a set of the given size, under a random key.
+		HashLayout(size_t elements, const HashOptions&, RandomSource&);
+		void rekey(RandomSource&);
+
+		void write(uint8_t* out) const;
+		// False if the encoding is out of range.
+		bool read(const uint8_t* in);
+
+		size_t partitionOf(const ElementHash& hash) const
+		{
+			return mulHigh(hash.partitionWord, partitions);
+		}
+		// The first bin of a partition; partitions + 1 gives bins.
+		size_t partitionBegin(size_t partition) const
+		{
+			return ThreadPool::taskBegin(partition, partitions, bins);
+		}
+		// Bin h of an element.  Bins of one element may coincide.
+		size_t bin(const ElementHash& hash, unsigned h) const
+		{
+			const size_t partition = partitionOf(hash);
+			const size_t begin = partitionBegin(partition);
+			return begin + mulHigh(mix(hash.binWord
+					+ h * 0x9e3779b97f4a7c15ull),
+					partitionBegin(partition + 1) - begin);
+		}
+		void hash(const vector<string>& set, vector<ElementHash>&,
+				ThreadPool* pool = nullptr) const;
+
+	private:
+		static size_t mulHigh(uint64_t a, uint64_t b)
+		{
+			__extension__ typedef unsigned __int128 uint128;
+			return (uint128(a) * b) >> 64;
+		}
+		// The splitmix64 finalizer.
+		static uint64_t mix(uint64_t x)
+		{
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+			return x ^ (x >> 31);
+		}
+	};
+
+	struct BinEntry
+	{
+		uint64_t element; // index in the set
+		uint32_t h; // which of the element's hashes chose the bin
+	};
+
+	// Elements by bin: bin b holds entries[first[b], first[b + 1]), in
+	// element order.
+	class BinLists
+	{
+	public:
+		vector<size_t> first;
+		vector<BinEntry> entries;
+		vector<uint64_t> stash; // elements in no bin, in order
+
+		size_t bins() const { return first.size() - 1; }
+		size_t size(size_t bin) const { return first[bin + 1] - first[bin]; }
+		const BinEntry* begin(size_t bin) const { return &entries[first[bin]]; }
+		const BinEntry* end(size_t bin) const
+		{
+			return &entries[0] + first[bin + 1];
+		}
+		size_t maxLoad() const;
+	};
+
+	// Every element in each of its hashCount bins, one entry per hash.
+	void simpleBins(const HashLayout&, const vector<ElementHash>&,
+			BinLists&, ThreadPool* pool = nullptr);
+	// Every element in one of its bins, at most one per bin, or else in the
+	// stash.  False if the stash would exceed the layout's.
+	bool cuckooBins(const HashLayout&, const vector<ElementHash>&,
+			BinLists&, ThreadPool* pool = nullptr);
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <cstdint>
+#include <ostream>
+
+using std::ostream;
+
+// Counters, histograms and trace spans, for seeing where time goes in a
+// run.  Build with INSTRUMENT defined (make release INSTRUMENT=1) to
+// enable them; otherwise every hook below is empty and inline, so it
+// compiles to nothing, and the reports come out empty.
+//
+// Each thread records into its own slots, so recording never contends;
+// snapshot() sums every thread's on demand.
+namespace Instrument
+{
+
+#ifdef INSTRUMENT
+	const bool enabled = true;
+#else
+	const bool enabled = false;
+#endif
+
+	enum Counter
+	{
+		ChannelMessagesSent,
+		ChannelBytesSent, // payload bytes
+		ChannelMessagesReceived,
+		ChannelBytesReceived,
+		counterCount
+	};
+
+	// Values are kept in power-of-2 buckets: bucket 0 holds 0 and bucket
+	// i > 0 holds [2^(i - 1), 2^i).
+	enum Histogram
+	{
+		ModExpSecretBits, // exponent length of each modExp, by path
+		ModExpPublicBits,
+		ComputeNanos,
+		DecryptNanos,
+		DecryptShareNanos,
+		DecryptWithNanos,
+		ChannelWaitNanos, // blocked in a transport receive
+		BufferDepth, // elements queued after each offer
+		histogramCount
+	};
+	const unsigned histogramBuckets = 65;
+
+	const char* name(Counter);
+	const char* name(Histogram);
+
+	struct Snapshot
+	{
+		struct Distribution
+		{
+			uint64_t count, sum;
+			uint64_t buckets[histogramBuckets];
+		};
+
+		uint64_t counters[counterCount];
+		Distribution histograms[histogramCount];
+	};
+
+	// Totals over every thread, past and present, since the last reset.
+	Snapshot snapshot();
+	void reset();
+	// The snapshot as one JSON object; histograms give count, mean and
+	// percentiles as the upper bound of their bucket.
+	void writeReport(ostream&);
+
+	// Between startTrace and stopTrace, every Timer and Span is kept as a
+	// trace event; writeTrace writes them as Chrome trace JSON, for
+	// chrome://tracing or Perfetto.  Each thread keeps at most a million.
+	void startTrace();
+	void stopTrace();
+	void writeTrace(ostream&);
+
+#ifdef INSTRUMENT
+
+	void count(Counter, uint64_t n = 1);
+	void record(Histogram, uint64_t value);
+	uint64_t nanos();
+
+	// Records its lifetime in a histogram of nanoseconds, and as a span
+	// while tracing.
+	class Timer
+	{
+		const Histogram histogram;
+		const uint64_t start;
+
+	public:
+		explicit Timer(const Histogram _histogram) : histogram(_histogram),
+				start(nanos()) { }
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+		~Timer();
+	};
+
+	// A trace span only; name must outlive the trace, as a literal does.
+	class Span
+	{
+		const char* const name;
+		const uint64_t start;
+
+	public:
+		explicit Span(const char* _name) : name(_name), start(nanos()) { }
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+		~Span();
+	};
+
+#else
+
+	inline void count(Counter, uint64_t = 1) { }
+	inline void record(Histogram, uint64_t) { }
+
+	class Timer
+	{
+	public:
+		explicit Timer(Histogram) { }
+	};
+
+	class Span
+	{
+	public:
+		explicit Span(const char*) { }
+	};
+
+#endif
+
+}
+
+#endif
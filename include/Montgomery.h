@@ -0,0 +1,76 @@
+#ifndef MONTGOMERY_H
+#define MONTGOMERY_H
+
+#include <vector>
+#include "gmpxx.h"
+
+using std::vector;
+
+namespace ElGamal {
+	
+	// Montgomery arithmetic mod an odd p on fixed-width limb arrays.  A
+	// residue x is held as x * R mod p with R = 2^(limbs * GMP_NUMB_BITS),
+	// so a modular multiply is one limb product and one REDC, with no
+	// division.  Values stay in this form across chains of operations and
+	// are converted only at the ends.
+	//
+	// Functions taking scratch need scratchLimbs() limbs of it; operands
+	// and outputs are limbs() wide and may alias each other.
+	class MontgomeryContext
+	{
+		mpz_class p;
+		mp_size_t width;
+		vector<mp_limb_t> mod; // p
+		mp_limb_t modInv; // -p^-1 mod 2^GMP_NUMB_BITS
+		vector<mp_limb_t> rModP; // R mod p, the form of 1
+		vector<mp_limb_t> r2ModP; // R^2 mod p, for converting in
+		
+	public:
+		explicit MontgomeryContext(const mpz_class& p);
+		// With R mod p and R^2 mod p (limbs wide) already known, such as
+		// from a PrecomputeCache, skipping the divisions that find them.
+		MontgomeryContext(const mpz_class& p, const mp_limb_t* rModP,
+				const mp_limb_t* r2ModP);
+		
+		const mpz_class& modulus() const { return p; }
+		const mp_limb_t* modulusLimbs() const { return mod.data(); }
+		mp_size_t limbs() const { return width; }
+		mp_size_t scratchLimbs() const { return 2 * width; }
+		mp_size_t powScratchLimbs() const { return (16 + 2) * width; }
+		const mp_limb_t* one() const { return rModP.data(); }
+		const mp_limb_t* rSquared() const { return r2ModP.data(); }
+		
+		// out = product / R mod p, destroying product (2 * limbs wide); out
+		// must not overlap its high half.
+		// The sequence of operations depends only on limbs(), so this is
+		// safe to use on secrets.
+		void redc(mp_limb_t* out, mp_limb_t* product) const;
+		void mul(mp_limb_t* out, const mp_limb_t* a, const mp_limb_t* b,
+				mp_limb_t* scratch) const;
+		void sqr(mp_limb_t* out, const mp_limb_t* a, mp_limb_t* scratch) const;
+		
+		// Into and out of Montgomery form.  n must be in [0, p).
+		void toMont(mp_limb_t* out, const mpz_class& n,
+				mp_limb_t* scratch) const;
+		void toMont(mp_limb_t* out, const mp_limb_t* n,
+				mp_limb_t* scratch) const;
+		void fromMont(mpz_class& out, const mp_limb_t* a,
+				mp_limb_t* scratch) const;
+		void fromMont(mp_limb_t* out, const mp_limb_t* a,
+				mp_limb_t* scratch) const;
+		
+		// out = base^pow, all in Montgomery form, using powScratchLimbs() of
+		// scratch.  Variable-time in pow, which must be non-negative.
+		void pow(mp_limb_t* out, const mp_limb_t* base, const mpz_class& pow,
+				mp_limb_t* scratch) const;
+		// The same for a secret pow in [0, 2^bits): a fixed count of
+		// windows, each entry read with mpn_sec_tabselect and multiplied in
+		// even when it is 1, so timing and memory accesses depend only on
+		// bits and limbs().
+		void secretPow(mp_limb_t* out, const mp_limb_t* base,
+				const mpz_class& pow, size_t bits, mp_limb_t* scratch) const;
+	};
+	
+}
+
+#endif
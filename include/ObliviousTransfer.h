@@ -1,9 +1,11 @@
 #ifndef OBLIVIOUSTRANSFER_H
 #define OBLIVIOUSTRANSFER_H
 
+#include <functional>
 #include <memory>
-#include "Buffer.h"
 #include "ElGamal.h"
+#include "Session.h"
+#include "Transport.h"
 
 using std::string;
 using std::shared_ptr;
@@ -12,7 +14,9 @@ using namespace ElGamal;
 namespace ObliviousTransfer
 {
 	
-	typedef Buffer<string> Channel;
+	typedef Transport Channel;
+	class SendSession;
+	class RecvSession;
 	
 	class Client
 	{
@@ -20,10 +24,39 @@ namespace ObliviousTransfer
 		const PublicKey* publicKey;
 		Keyshare keyshare;
 		
-		shared_ptr<Channel> in, out;
+		shared_ptr<Channel> channel; // to the other party
 		
-		void oblivSend1of2(unsigned i0, unsigned i1, gmp_randclass&);
-		unsigned oblivRecv1of2(bool selectionBit, gmp_randclass&);
+		friend class SendSession;
+		friend class RecvSession;
+		
+		// The steps of a transfer, shared by both ways of running one.
+		// The readers return false on a malformed message.
+		string selectionBitMessage(bool selectionBit, RandomSource&) const;
+		bool selectionMessage(const string& selectionBitMsg, unsigned i0,
+				unsigned i1, RandomSource&, string& out) const;
+		bool readSelection(const string& selectionMsg, unsigned& out) const;
+		
+	public:
+		Client(const Params& _params, const PublicKey& _publicKey,
+				Keyshare _keyshare, shared_ptr<Channel> _channel = nullptr) :
+				params(&_params), publicKey(&_publicKey),
+				keyshare(move(_keyshare)), channel(move(_channel)) { }
+		
+		// One transfer at a time over channel, blocking on each reply.
+		void oblivSend1of2(unsigned i0, unsigned i1, RandomSource&);
+		unsigned oblivRecv1of2(bool selectionBit, RandomSource&);
+		
+		// The same transfer as session id of mux, so that any number can
+		// be in flight on one link; both parties use the same id.  rand only
+		// keys the session's own stream, which its steps draw from on the
+		// mux's pool.  done runs on the pool too, with ok false if the link
+		// failed first, and before the mux's wait() returns.  The client
+		// must outlive the session.
+		void oblivSend1of2(SessionMux&, SessionId, unsigned i0, unsigned i1,
+				RandomSource&, std::function<void(bool ok)> done) const;
+		void oblivRecv1of2(SessionMux&, SessionId, bool selectionBit,
+				RandomSource&,
+				std::function<void(bool ok, unsigned value)> done) const;
 	};
 	
 }
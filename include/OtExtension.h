@@ -0,0 +1,64 @@
+#ifndef OTEXTENSION_H
+#define OTEXTENSION_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "gmpxx.h"
+#include "Ed25519.h"
+#include "Sha256.h"
+#include "Transport.h"
+
+using std::array;
+using std::vector;
+
+namespace ObliviousTransfer
+{
+
+	typedef array<uint8_t, 16> Seed;
+	typedef array<uint8_t, Sha256::digestBytes> Digest;
+
+	// Chou-Orlandi "simplest" OT over a prime-order group: count 1-of-2
+	// transfers of random seeds for two exponentiations per transfer on
+	// each side, in one round trip.  The sender learns both seeds of every
+	// pair, the receiver the seed of its choice and nothing of the other.
+	// Both return false if the link fails or the peer sends a bad point.
+	bool baseOtSend(Transport&, const ElGamal::Ed25519Group&, size_t count,
+			vector<array<Seed, 2>>& seeds, RandomSource&);
+	bool baseOtReceive(Transport&, const ElGamal::Ed25519Group&,
+			const vector<bool>& choices, vector<Seed>& seeds, RandomSource&);
+
+	// Batched oblivious PRF (Kolesnikov-Kumaresan-Rosulek-Trieu), the
+	// IKNP extension with a pseudo-random code in place of the repetition
+	// code.  After codeBits base OTs, each row j costs the receiver one
+	// code word and codeBits bits on the wire, and gives it
+	// F(j, inputs[j]); the sender can then evaluate F(j, x) for any row
+	// and any x, but learns nothing about the inputs.
+	//
+	// Columns stream over the transport in chunks of chunkRows, so memory
+	// on the receiver is bounded by the outputs.
+	const size_t codeBits = 512;
+	const size_t codeWords = codeBits / 64;
+	const size_t chunkRows = 2048;
+
+	bool oprfReceive(Transport&, const ElGamal::Ed25519Group&,
+			const vector<Digest>& inputs, vector<Digest>& outputs,
+			RandomSource&);
+
+	class OprfSender
+	{
+		array<uint64_t, codeWords> choices; // the base OT choices, s
+		vector<uint64_t> q; // rows * codeWords
+
+	public:
+		// Take part in the receiver's oprfReceive for rows rows.
+		bool run(Transport&, const ElGamal::Ed25519Group&, size_t rows,
+				RandomSource&);
+		size_t rows() const { return q.size() / codeWords; }
+		// F(row, input).  Safe to call from several threads.
+		void evaluate(size_t row, const Digest& input, Digest& out) const;
+	};
+
+}
+
+#endif
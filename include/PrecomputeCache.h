@@ -0,0 +1,115 @@
+#ifndef PRECOMPUTECACHE_H
+#define PRECOMPUTECACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "DiscreteLog.h"
+#include "ElGamal.h"
+
+using std::shared_ptr;
+using std::unique_ptr;
+using std::string;
+using std::vector;
+
+namespace ElGamal {
+
+	// Precomputed state for fixed groups and long-lived keys, built once
+	// offline (make cache) and mapped read-only at startup instead of
+	// rebuilt: Montgomery constants for p, fixed-base tables for g and for
+	// public keys A, and discrete log tables.  The file is mapped shared,
+	// so every process using it shares one copy in the page cache, and
+	// tables handed out keep the mapping alive.
+	//
+	// The file is a header, a directory of entries and 64-byte aligned
+	// payloads, in native byte order and GMP limbs.  The header holds a
+	// format version and a SHA-256 of the directory, checked on open; each
+	// entry holds a SHA-256 of its payload, checked the first time the
+	// entry is used, so opening reads no payload pages.  Entries are found
+	// by kind, a hash of (p, base) and the table shape, so one file may
+	// serve several groups and keys.
+	class PrecomputeCache
+	{
+	public:
+		static const uint32_t version = 2;
+
+		enum Kind : uint32_t { Montgomery = 1, Table = 2, Log = 3 };
+
+		struct Entry
+		{
+			uint32_t kind;
+			uint32_t reserved;
+			uint64_t shape[2]; // expBits and windowBits, or bound and babySteps
+			uint8_t key[32]; // SHA-256 of p and the base
+			uint64_t offset, bytes; // payload, from the start of the file
+			uint8_t checksum[32]; // SHA-256 of the payload
+		};
+
+		// Collects entries, then writes them as a cache file.
+		class Builder
+		{
+			struct Pending
+			{
+				Entry entry;
+				string payload;
+			};
+			vector<Pending> pending;
+
+			void add(Kind, const mpz_class& p, const mpz_class& base,
+					uint64_t shape0, uint64_t shape1, string payload);
+
+		public:
+			// Montgomery constants and, if params has one, the table for g.
+			void add(const Params&);
+			// A table for a long-lived public key under params.
+			void add(const Params&, const PublicKey&);
+			void add(const DiscreteLog&);
+			// Written to a temporary file and renamed into place, so a
+			// process opening path never sees a partial file.
+			bool write(const string& path) const;
+		};
+
+		// Null if path is missing, from another format version or limb
+		// size, or its directory fails its checksum.
+		static shared_ptr<const PrecomputeCache> open(const string& path);
+		// True if every entry's payload matches its checksum.  Reads the
+		// whole file; lookups check only the entries they use.
+		bool verify() const;
+
+		// Each is null if the cache has no such entry, or if the entry
+		// fails its checksum.
+		shared_ptr<const MontgomeryContext> montgomery(const mpz_class& p) const;
+		// A table for base under mont's p, with the given shape.
+		shared_ptr<const FixedBaseTable> table(
+				shared_ptr<const MontgomeryContext> mont, const mpz_class& base,
+				unsigned expBits, unsigned windowBits) const;
+		// babySteps == 0 means DiscreteLog::defaultBabySteps(bound).
+		shared_ptr<const DiscreteLog> discreteLog(const mpz_class& p,
+				const mpz_class& base, unsigned long bound,
+				unsigned long babySteps = 0) const;
+
+		size_t entryCount() const { return count; }
+
+	private:
+		enum Check : uint8_t { Unchecked, Intact, Corrupt };
+
+		shared_ptr<const void> mapping;
+		const uint8_t* data;
+		const Entry* entries;
+		size_t count;
+		// Per entry; racing first uses both check, to the same result.
+		unique_ptr<std::atomic<uint8_t>[]> checks;
+
+		PrecomputeCache(shared_ptr<const void> mapping, const uint8_t* data,
+				const Entry* entries, size_t count);
+		bool intact(size_t entry) const;
+		// Null if absent or corrupt.
+		const Entry* find(Kind, const mpz_class& p, const mpz_class& base,
+				uint64_t shape0, uint64_t shape1) const;
+	};
+
+}
+
+#endif
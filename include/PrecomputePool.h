@@ -0,0 +1,59 @@
+#ifndef PRECOMPUTEPOOL_H
+#define PRECOMPUTEPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "ElGamal.h"
+
+using std::atomic;
+using std::condition_variable;
+using std::deque;
+using std::mutex;
+using std::thread;
+
+namespace ElGamal {
+	
+	// A bounded queue of PublicKey::compute results for one key, kept full
+	// by background worker threads.  Encrypting from the pool costs a single
+	// modular multiply; when the queue runs dry the pair is computed inline.
+	// The pool must not outlive the Params and PublicKey it was built for.
+	class PrecomputePool
+	{
+		const Params& params;
+		const PublicKey& publicKey;
+		const size_t capacity;
+		
+		deque<Ciphertext> ready;
+		size_t pending = 0; // pairs being computed by workers
+		bool stopping = false;
+		mutex mut;
+		condition_variable notFull;
+		vector<thread> workers;
+		
+		atomic<unsigned long> hitCount, missCount;
+		
+		void work(ChaCha20Random rand);
+		
+	public:
+		// Worker streams are keyed from rand, which is not used afterwards.
+		PrecomputePool(const Params&, const PublicKey&, size_t capacity,
+				unsigned threads, RandomSource& rand);
+		PrecomputePool(const PrecomputePool&) = delete;
+		PrecomputePool& operator=(const PrecomputePool&) = delete;
+		~PrecomputePool();
+		
+		const PublicKey& key() const { return publicKey; }
+		
+		// A fresh (g^b, A^b) pair, computed with rand on a miss.
+		Ciphertext take(RandomSource& rand);
+		size_t available();
+		unsigned long hits() const { return hitCount; }
+		unsigned long misses() const { return missCount; }
+	};
+	
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <gmpxx.h>
+
+// A source of uniformly random bytes, with helpers for the values the
+// protocols draw: words, bit strings and integers below a bound.  The
+// library takes its randomness as a RandomSource&.
+class RandomSource
+{
+public:
+	virtual ~RandomSource() = default;
+	virtual void fill(void* out, size_t bytes) = 0;
+
+	uint64_t word();
+	// Uniform in [0, bound), bound > 0.
+	uint64_t below(uint64_t bound);
+	// Uniform in [0, 2^bits).
+	void bits(mpz_class& out, mp_bitcnt_t bits);
+	mpz_class bits(mp_bitcnt_t bits);
+	// Uniform in [0, bound), bound > 0.
+	void uniform(mpz_class& out, const mpz_class& bound);
+	mpz_class uniform(const mpz_class& bound);
+	// count values uniform in [0, bound), each drawn straight into
+	// out[i]'s limbs, which are reused.
+	void uniform(mpz_class* out, size_t count, const mpz_class& bound);
+};
+
+// ChaCha20 (Bernstein's original: 64-bit block counter, 64-bit nonce) as
+// a CSPRNG.  One instance is one stream and is not thread-safe; forThread
+// gives each thread its own, seeded from the kernel.
+class ChaCha20Random : public RandomSource
+{
+public:
+	static const size_t keyBytes = 32;
+	static const size_t blockBytes = 64;
+
+private:
+	// Blocks generated at a time for small draws.
+	static const size_t bufferBlocks = 4;
+
+	uint32_t key[8];
+	uint64_t nonce = 0;
+	uint64_t counter = 0;
+	uint8_t buffer[bufferBlocks * blockBytes];
+	size_t bufferPos = sizeof buffer; // next unused byte
+
+	void blocks(uint8_t* out, size_t count);
+
+public:
+	// Keyed from getrandom.
+	ChaCha20Random();
+	explicit ChaCha20Random(const uint8_t* key, uint64_t nonce = 0);
+	// A stream keyed from parent's output, without a system call, for
+	// giving each task of a batch its own.
+	static ChaCha20Random derive(RandomSource& parent);
+
+	// Restart as the stream of key and nonce.
+	void rekey(const uint8_t* key, uint64_t nonce = 0);
+	void fill(void* out, size_t bytes) override;
+
+	// The calling thread's stream, keyed from getrandom on first use and
+	// again in the child after a fork.  Other instances are copied by a
+	// fork like any object, and their owners must rekey them.
+	static ChaCha20Random& forThread();
+};
+
+// Draws from ChaCha20Random::forThread() of whichever thread calls, so
+// one may be shared by any number of threads without a lock.
+class ThreadRandom : public RandomSource
+{
+public:
+	void fill(void* out, size_t bytes) override;
+};
+
+#endif
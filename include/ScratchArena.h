@@ -0,0 +1,62 @@
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "gmpxx.h"
+
+using std::unique_ptr;
+using std::vector;
+
+namespace ElGamal {
+	
+	// Per-thread temporaries for the hot path.  Integers and limb buffers
+	// are handed out in stack order by a Frame and returned when it ends,
+	// but their storage is kept, so once a thread has run an operation at
+	// a given key size, running it again allocates nothing.
+	class ScratchArena
+	{
+		struct Block
+		{
+			unique_ptr<mp_limb_t[]> limbs;
+			size_t size;
+		};
+		
+		vector<unique_ptr<mpz_class>> slots; // stable addresses
+		size_t slotsUsed = 0;
+		vector<Block> blocks;
+		size_t block = 0, offset = 0; // next free limb
+		
+		ScratchArena() = default;
+		
+	public:
+		ScratchArena(const ScratchArena&) = delete;
+		ScratchArena& operator=(const ScratchArena&) = delete;
+		
+		// The calling thread's arena.
+		static ScratchArena& local();
+		
+		class Frame
+		{
+			ScratchArena& arena;
+			mp_bitcnt_t slotBits;
+			size_t slotMark, blockMark, offsetMark;
+			
+		public:
+			// Integers from this frame hold products of two keyBits-bit
+			// residues without reallocating.
+			explicit Frame(unsigned keyBits);
+			Frame(const Frame&) = delete;
+			Frame& operator=(const Frame&) = delete;
+			~Frame();
+			
+			mpz_class& mpz();
+			// n uninitialized limbs, valid until the frame ends.
+			mp_limb_t* limbs(size_t n);
+		};
+	};
+	
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "Buffer.h"
+#include "Transport.h"
+#include "WorkStealingPool.h"
+
+using std::deque;
+using std::shared_ptr;
+using std::string;
+
+namespace ObliviousTransfer
+{
+
+	typedef uint32_t SessionId;
+	class Session;
+	class SessionMux;
+
+	// The steps of one protocol instance, as callbacks.  They run on the
+	// mux's pool, one at a time for each session, so a handler keeps its
+	// state in plain members.
+	class SessionHandler
+	{
+	public:
+		virtual ~SessionHandler() = default;
+		// First, when the session is opened.
+		virtual void start(Session&) { }
+		// Each of the peer's messages for the session, in order.
+		virtual void receive(Session&, string& payload) = 0;
+		// The link closed, or the peer broke the sequence, before the
+		// session finished.  The session is finished after this.
+		virtual void fail(Session&) { }
+	};
+
+	// One protocol instance multiplexed over a SessionMux.
+	class Session
+	{
+		friend class SessionMux;
+
+		struct Event
+		{
+			enum Kind { Start, Message, Fail } kind;
+			string payload;
+		};
+
+		SessionMux& mux;
+		const SessionId sessionId;
+		shared_ptr<SessionHandler> handler; // null until opened here
+		uint32_t sendSequence = 0; // touched only by the handler
+		std::mutex mut; // the rest
+		uint32_t recvSequence = 0;
+		deque<Event> events;
+		bool scheduled = false;
+		bool finished = false;
+		bool failed = false;
+
+		Session(SessionMux& _mux, SessionId _id) : mux(_mux), sessionId(_id) { }
+
+	public:
+		SessionId id() const { return sessionId; }
+		// Queue a message to the peer's session of the same id.  Call only
+		// from this session's handler.
+		void send(string&& payload);
+		// Stop: later messages for the session are dropped.
+		void finish();
+	};
+
+	// Any number of sessions over one transport.  Each message carries its
+	// session id and a per-session sequence number:
+	//
+	//   message   session id (4 bytes), sequence (4 bytes), payload
+	//
+	// A reader thread routes incoming messages to their sessions and a
+	// writer thread batches outgoing ones; handlers run on the pool, so a
+	// session waiting on the network costs no thread, and one session's
+	// exponentiations overlap the others' round trips.
+	//
+	// Both parties open the same ids, and an id is used once.  Messages for
+	// an id not yet opened wait for it.
+	class SessionMux
+	{
+		friend class Session;
+
+		shared_ptr<Transport> transport;
+		WorkStealingPool& pool;
+		MpmcBuffer<string> outbox;
+		std::mutex mut;
+		std::condition_variable idle;
+		std::unordered_map<SessionId, shared_ptr<Session>> sessions;
+		size_t openCount = 0;
+		size_t failures = 0;
+		bool linkDown = false;
+		bool closed = false;
+		std::thread reader, writer;
+
+		void read();
+		void write();
+		shared_ptr<Session> find(SessionId);
+		// Queue an event; schedule the session if it is opened and idle.
+		void push(const shared_ptr<Session>&, Session::Event&&,
+				bool first = false);
+		void run(const shared_ptr<Session>&);
+		// Mark the session finished; run counts it once the handler
+		// returns.
+		void finish(Session&, bool failed);
+		// After each handler call: if the session finished, drop the
+		// handler and count it.  True if it did.
+		bool retire(Session&);
+
+	public:
+		static const size_t headerBytes = 8;
+
+		SessionMux(shared_ptr<Transport>, WorkStealingPool&);
+		SessionMux(const SessionMux&) = delete;
+		SessionMux& operator=(const SessionMux&) = delete;
+		// Closes, then waits for the peer to close its side.
+		~SessionMux();
+
+		// Start a session; handler->start runs on the pool.
+		void open(SessionId, shared_ptr<SessionHandler> handler);
+		// Wait until every opened session has finished and its handler has
+		// returned, so this orders after every callback a handler makes.
+		// False if any failed.
+		bool wait();
+		// Send what is queued and close the sending side.
+		void close();
+	};
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef SETINTERSECTION_H
+#define SETINTERSECTION_H
+
+#include <string>
+#include <vector>
+#include "gmpxx.h"
+#include "ElGamal.h"
+#include "Hashing.h"
+#include "ThreadPool.h"
+#include "Transport.h"
+
+using std::string;
+using std::vector;
+
+namespace SetIntersection
+{
+
+	using ObliviousTransfer::Transport;
+
+	// Private set intersection over the batched OPRF in OtExtension.h
+	// (Kolesnikov-Kumaresan-Rosulek-Trieu).  The receiver cuckoo-hashes
+	// its set into bins (Hashing.h), one element per bin, and obtains the
+	// OPRF of each bin's element and of each stash slot's; the sender
+	// hashes each of its elements into every bin it could occupy and sends
+	// the OPRF values there, and at every stash slot, truncated and sorted.
+	// Matching values are the intersection.  Public-key work is a fixed 512
+	// base OTs; everything per element is SHA-256.
+	//
+	// Elements are distinct bitstrings of one fixed length, as bytes.  The
+	// receiver learns the intersection and the sender's set size; the
+	// sender learns only the receiver's set size.  Run one function on
+	// each end of a transport, on two threads of one process or over a
+	// socket.  Both return false if the link fails or the peer misbehaves.
+	//
+	// pool, if given, spreads the hashing and OPRF evaluation over its
+	// threads.  The receiver's options set the layout for both sides.
+	bool otReceive(Transport&, const vector<string>& set,
+			vector<string>& intersection, RandomSource&,
+			ThreadPool* pool = nullptr,
+			const HashOptions& options = cuckooOptions);
+	bool otSend(Transport&, const vector<string>& set, RandomSource&,
+			ThreadPool* pool = nullptr);
+
+	// Private set intersection by oblivious polynomial evaluation
+	// (Freedman-Nissim-Pinkas), on the homomorphic operations of
+	// MontgomeryCiphertext.  Both sides hash their sets into buckets with
+	// simpleBins, by hashCount hashes, one by default.  The receiver sends,
+	// under a fresh key, the encrypted coefficients of each bucket's
+	// polynomial, whose roots are the bucket's elements (padded with
+	// random roots to one degree).  The sender evaluates the polynomial of
+	// each of its elements' buckets at the element by Horner's rule,
+	// masking the result as g^(r P(y) + y), and returns every value in
+	// random order; the receiver decrypts them and finds g^x of its own
+	// elements among them.  The stash is unused.
+	//
+	// Costs are exponentiations, about degree + 1 per element on each
+	// side, in two messages' worth of rounds, against the OT mode's SHA-256
+	// per element and several round trips; prefer this one on slow links
+	// with small sets.  Exponents are elements' SHA-256 reduced mod the
+	// group order, so the order must be far larger than the sets.
+	//
+	// Elements may have any length.  Leakage is as for the OT mode.  pool,
+	// if given, spreads the encryption, evaluation and decryption over its
+	// threads, by ranges of buckets on the sender.
+	bool polynomialReceive(Transport&, const ElGamal::Params&,
+			const vector<string>& set, vector<string>& intersection,
+			RandomSource&, ThreadPool* pool = nullptr,
+			const HashOptions& options = bucketOptions);
+	bool polynomialSend(Transport&, const ElGamal::Params&,
+			const vector<string>& set, RandomSource&,
+			ThreadPool* pool = nullptr);
+
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <cstddef>
+#include <cstdint>
+
+// SHA-256 (FIPS 180-4), for key derivation, random oracles and PRG
+// expansion in the protocols.  The compression function uses the x86 SHA
+// extensions when the CPU has them, chosen once at startup.
+class Sha256
+{
+	uint32_t state[8];
+	uint8_t buffer[64];
+	size_t buffered = 0;
+	uint64_t length = 0; // bytes hashed so far
+
+public:
+	static const size_t digestBytes = 32;
+	static const size_t blockBytes = 64;
+
+	Sha256();
+	void update(const void* data, size_t bytes);
+	// Write the digest and reset for another message.
+	void final(uint8_t* digest);
+
+	static void hash(const void* data, size_t bytes, uint8_t* digest);
+	// The initial state, for callers that pad their own blocks and
+	// call compress directly.
+	static void initialize(uint32_t* state);
+	// Compress blocks 64-byte blocks of data into state.
+	static void compress(uint32_t* state, const uint8_t* data, size_t blocks);
+	// True if compress runs on the SHA extensions.
+	static bool accelerated();
+};
+
+#endif
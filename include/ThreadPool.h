@@ -0,0 +1,60 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using std::condition_variable;
+using std::function;
+using std::mutex;
+using std::queue;
+using std::thread;
+using std::vector;
+
+// A fixed set of worker threads for data-parallel batch operations.
+class ThreadPool
+{
+	vector<thread> workers;
+	queue<function<void()>> jobs;
+	bool stopping = false;
+	mutex mut;
+	condition_variable cv;
+	
+	void work();
+	
+public:
+	// threads == 0 means one per hardware thread.
+	explicit ThreadPool(unsigned threads = 0);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+	
+	unsigned size() const { return workers.size(); }
+	
+	// A task count that balances load for count items without making
+	// tasks too small to amortize their setup.
+	size_t tasksFor(size_t count) const;
+	
+	// Run task(i) for every i in [0, tasks) and wait for all of them.  The
+	// calling thread takes part, so run may be nested inside a task.
+	void run(size_t tasks, const function<void(size_t)>& task);
+	
+	// body(begin, end) for each task's share of count items, as run.
+	void parallelFor(size_t count,
+			const function<void(size_t, size_t)>& body);
+	// The same on pool, or in one call on this thread if pool is null.
+	static void parallelFor(ThreadPool* pool, size_t count,
+			const function<void(size_t, size_t)>& body);
+	
+	// The [begin, end) share of count items handled by task i of tasks.
+	static size_t taskBegin(size_t i, size_t tasks, size_t count)
+	{
+		return i * count / tasks;
+	}
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Buffer.h"
+
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace ObliviousTransfer
+{
+
+	// Messages queued before a send forces a flush, unless configured.
+	const size_t defaultSendWindow = 64;
+	// Largest frame a SocketTransport accepts, unless configured: a few MiB
+	// over the largest protocol message, a 1 MiB list of PSI tags.
+	const size_t defaultMaxFrame = 4 << 20;
+
+	// A bidirectional, message-framed link to the other party.
+	//
+	// Sends are queued and written together, so a protocol can issue many
+	// rounds without paying a write (or a wakeup) per message.  The queue is
+	// flushed when it reaches the send window, on flush(), and before any
+	// receive that would block on a thread that queued messages, so a
+	// party never waits for a reply to a message it has not yet sent.
+	//
+	// One thread may send and flush while another receives.  The receiving
+	// thread then never flushes for it, so the sending thread must flush
+	// whatever it leaves queued.
+	class Transport
+	{
+	public:
+		virtual ~Transport() = default;
+
+		// Queue msgs[0..n), moving from them.  False if the link is down.
+		virtual bool sendN(string* msgs, size_t n) = 0;
+		virtual bool flush() = 0;
+		// Receive at least one and at most max messages; 0 once the peer
+		// has closed and everything sent before that has been received.
+		virtual size_t recvN(string* out, size_t max) = 0;
+		// Flush and stop sending; the peer's receives drain, then end.
+		virtual void close() = 0;
+
+		bool send(string&& msg) { return sendN(&msg, 1); }
+		bool recv(string& msg) { return recvN(&msg, 1) == 1; }
+
+		// Channel-style names, as used by ObliviousTransfer::Client.
+		bool offer(string&& msg) { return send(std::move(msg)); }
+		string take()
+		{
+			string msg;
+			recv(msg);
+			return msg;
+		}
+	};
+
+	// Both ends of an in-process link, built on a pair of ring buffers.
+	pair<shared_ptr<Transport>, shared_ptr<Transport>> memoryPair(
+			size_t sendWindow = defaultSendWindow,
+			size_t capacity = defaultBufferCapacity);
+
+	// A Transport over a connected stream socket (TCP or Unix domain).
+	// Frames are a 4-byte big-endian length and the payload.  Queued frames
+	// are written with one writev per flush, straight from the message
+	// strings; large incoming payloads are read straight into the message.
+	// A frame longer than maxFrame fails the receive and shuts the link
+	// down, before anything is allocated for it.
+	class SocketTransport : public Transport
+	{
+		int fd;
+		size_t sendWindow;
+		size_t maxFrame;
+		std::mutex sendMut; // pending, against a receive's flush
+		vector<string> pending;
+		vector<uint32_t> pendingHeaders;
+		std::thread::id sender; // of the last sendN
+		vector<char> readBuf;
+		size_t readBegin = 0, readEnd = 0;
+		bool sendClosed = false;
+		bool recvFailed = false; // on an oversized frame
+
+		bool flushPending();
+		// False at end of stream or on error.
+		bool fill();
+		bool frameBuffered() const;
+		bool recvOne(string& out);
+
+	public:
+		// Takes ownership of fd.
+		SocketTransport(int fd, size_t sendWindow = defaultSendWindow,
+				size_t maxFrame = defaultMaxFrame);
+		SocketTransport(const SocketTransport&) = delete;
+		SocketTransport& operator=(const SocketTransport&) = delete;
+		~SocketTransport() override;
+
+		bool sendN(string* msgs, size_t n) override;
+		bool flush() override;
+		size_t recvN(string* out, size_t max) override;
+		void close() override;
+	};
+
+	// A listening socket.  Factories return null on failure.
+	class Listener
+	{
+		int fd;
+		string unixPath; // unlinked on destruction
+
+		Listener(int _fd, string _unixPath) : fd(_fd),
+				unixPath(std::move(_unixPath)) { }
+
+	public:
+		// port 0 picks a free port; see port().
+		static shared_ptr<Listener> tcp(uint16_t port,
+				const string& host = "127.0.0.1");
+		static shared_ptr<Listener> unixDomain(const string& path);
+		Listener(const Listener&) = delete;
+		Listener& operator=(const Listener&) = delete;
+		~Listener();
+
+		uint16_t port() const;
+		shared_ptr<Transport> accept(size_t sendWindow = defaultSendWindow,
+				size_t maxFrame = defaultMaxFrame);
+	};
+
+	shared_ptr<Transport> connectTcp(const string& host, uint16_t port,
+			size_t sendWindow = defaultSendWindow,
+			size_t maxFrame = defaultMaxFrame);
+	shared_ptr<Transport> connectUnix(const string& path,
+			size_t sendWindow = defaultSendWindow,
+			size_t maxFrame = defaultMaxFrame);
+	// Both ends of a connected Unix-domain socket pair.
+	pair<shared_ptr<Transport>, shared_ptr<Transport>> socketPair(
+			size_t sendWindow = defaultSendWindow,
+			size_t maxFrame = defaultMaxFrame);
+
+}
+
+#endif
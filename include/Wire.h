@@ -0,0 +1,55 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <cstdint>
+#include "CiphertextBatch.h"
+#include "ElGamal.h"
+
+namespace ElGamal {
+	
+	// Binary wire format.  Group elements are written big-endian at a fixed
+	// width of Params::keyBytes(), so sizes are known before encoding and
+	// values go straight between mpz_t and the caller's buffer.
+	//
+	//   element       keyBytes() bytes, value in [0, p)
+	//   Ciphertext    B, c
+	//   DecryptShare  x (4 bytes), share
+	//   frame         count (4 bytes), width (2 bytes), count Ciphertexts
+	//
+	// Writers return the end of what they wrote.  Readers return the end of
+	// what they consumed, or nullptr if the input is short or out of range.
+	namespace Wire {
+		
+		size_t elementBytes(const Params&);
+		size_t ciphertextBytes(const Params&);
+		size_t shareBytes(const Params&);
+		size_t frameBytes(const Params&, size_t count);
+		
+		uint8_t* writeElement(const Params&, const mpz_class&, uint8_t* out);
+		const uint8_t* readElement(const Params&, mpz_class&,
+				const uint8_t* in, const uint8_t* end);
+		
+		uint8_t* write(const Params&, const Ciphertext&, uint8_t* out);
+		const uint8_t* read(const Params&, Ciphertext&,
+				const uint8_t* in, const uint8_t* end);
+		
+		uint8_t* write(const Params&, const DecryptShare&, uint8_t* out);
+		const uint8_t* read(const Params&, DecryptShare&,
+				const uint8_t* in, const uint8_t* end);
+		
+		uint8_t* writeFrame(const Params&, const vector<Ciphertext>&,
+				uint8_t* out);
+		const uint8_t* readFrame(const Params&, vector<Ciphertext>&,
+				const uint8_t* in, const uint8_t* end);
+		
+		// The same frame, straight from and into a batch's limb arrays.
+		uint8_t* writeFrame(const Params&, const CiphertextBatch&,
+				uint8_t* out);
+		const uint8_t* readFrame(const Params&, CiphertextBatch&,
+				const uint8_t* in, const uint8_t* end);
+		
+	}
+	
+}
+
+#endif
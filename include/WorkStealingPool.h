@@ -0,0 +1,62 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::atomic;
+using std::condition_variable;
+using std::deque;
+using std::function;
+using std::mutex;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+// Worker threads for many small, independent tasks that spawn more tasks,
+// such as the steps of multiplexed protocol sessions.  Each worker has its
+// own queue: it pushes and pops at the back, so a task's follow-ups run
+// while their data is warm, and idle workers steal from the front of the
+// others'.  Unlike ThreadPool there is no batch to wait for.
+class WorkStealingPool
+{
+	struct Queue
+	{
+		mutex mut;
+		deque<function<void()>> tasks;
+	};
+
+	vector<unique_ptr<Queue>> queues;
+	vector<thread> workers;
+	atomic<size_t> queued{0};
+	atomic<size_t> nextQueue{0};
+	atomic<unsigned> sleeping{0};
+	bool stopping = false;
+	mutex idleMut;
+	condition_variable idleCv;
+
+	bool runOne(size_t self);
+	void work(size_t self);
+
+public:
+	// threads == 0 means one per hardware thread.
+	explicit WorkStealingPool(unsigned threads = 0);
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+	// Runs every task already posted, then stops.
+	~WorkStealingPool();
+
+	unsigned size() const { return workers.size(); }
+
+	// Queue task: on the calling worker's own queue, or spread round robin
+	// when called from outside the pool.
+	void post(function<void()> task);
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include <cassert>
+#include "CiphertextBatch.h"
+
+namespace ElGamal {
+	
+	CiphertextBatch::CiphertextBatch(const Params& params, const size_t _count) :
+			limbs(params.mont->limbs()), count(0)
+	{
+		resize(params, _count);
+	}
+	
+	CiphertextBatch::CiphertextBatch(const Params& params,
+			const vector<Ciphertext>& ciphers) :
+			limbs(params.mont->limbs()), count(ciphers.size()),
+			Bs(count * limbs), cs(count * limbs)
+	{
+		for (size_t i = 0; i < count; i++)
+			set(params, i, ciphers[i]);
+	}
+	
+	void CiphertextBatch::resize(const Params& params, const size_t _count)
+	{
+		assert(params.mont->limbs() == limbs);
+		Bs.resize(_count * limbs);
+		cs.resize(_count * limbs);
+		for (size_t i = count; i < _count; i++)
+		{
+			mpn_copyi(&Bs[i * limbs], params.mont->one(), limbs);
+			mpn_copyi(&cs[i * limbs], params.mont->one(), limbs);
+		}
+		count = _count;
+	}
+	
+	void CiphertextBatch::reserve(const size_t _count)
+	{
+		Bs.reserve(_count * limbs);
+		cs.reserve(_count * limbs);
+	}
+	
+	void CiphertextBatch::push_back(const Params& params,
+			const Ciphertext& cipher)
+	{
+		Bs.resize((count + 1) * limbs);
+		cs.resize((count + 1) * limbs);
+		set(params, count++, cipher);
+	}
+	
+	void CiphertextBatch::set(const Params& params, const size_t i,
+			const Ciphertext& cipher)
+	{
+		assert(i < count);
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(params.mont->scratchLimbs());
+		const ElementView element = (*this)[i];
+		params.mont->toMont(element.B, cipher.B, scratch);
+		params.mont->toMont(element.c, cipher.c, scratch);
+	}
+	
+	void CiphertextBatch::get(const Params& params, const size_t i,
+			Ciphertext& out) const
+	{
+		assert(i < count);
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(params.mont->scratchLimbs());
+		const ConstElementView element = (*this)[i];
+		params.mont->fromMont(out.B, element.B, scratch);
+		params.mont->fromMont(out.c, element.c, scratch);
+	}
+	
+	Ciphertext CiphertextBatch::get(const Params& params, const size_t i) const
+	{
+		Ciphertext out;
+		get(params, i, out);
+		return out;
+	}
+	
+	vector<Ciphertext> CiphertextBatch::toCiphertexts(const Params& params) const
+	{
+		vector<Ciphertext> out(count);
+		for (size_t i = 0; i < count; i++)
+			get(params, i, out[i]);
+		return out;
+	}
+	
+	void CiphertextBatch::mult(const Params& params,
+			const CiphertextBatch& other)
+	{
+		assert(other.count == count && other.limbs == limbs);
+		const MontgomeryContext& m = *params.mont;
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(m.scratchLimbs());
+		
+		// One pass per array, so each streams through memory in order.
+		for (size_t i = 0; i < count * limbs; i += limbs)
+			m.mul(&Bs[i], &Bs[i], &other.Bs[i], scratch);
+		for (size_t i = 0; i < count * limbs; i += limbs)
+			m.mul(&cs[i], &cs[i], &other.cs[i], scratch);
+	}
+	
+	void CiphertextBatch::mult(const Params& params, const Ciphertext& factor)
+	{
+		const MontgomeryContext& m = *params.mont;
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(m.scratchLimbs());
+		mp_limb_t* factorB = frame.limbs(limbs);
+		mp_limb_t* factorC = frame.limbs(limbs);
+		m.toMont(factorB, factor.B, scratch);
+		m.toMont(factorC, factor.c, scratch);
+		
+		for (size_t i = 0; i < count * limbs; i += limbs)
+			m.mul(&Bs[i], &Bs[i], factorB, scratch);
+		for (size_t i = 0; i < count * limbs; i += limbs)
+			m.mul(&cs[i], &cs[i], factorC, scratch);
+	}
+	
+	void CiphertextBatch::pow(const Params& params, const mpz_class& power)
+	{
+		const MontgomeryContext& m = *params.mont;
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(m.powScratchLimbs());
+		
+		for (size_t i = 0; i < count * limbs; i += limbs)
+			m.pow(&Bs[i], &Bs[i], power, scratch);
+		for (size_t i = 0; i < count * limbs; i += limbs)
+			m.pow(&cs[i], &cs[i], power, scratch);
+	}
+	
+	void CiphertextBatch::rerandomize(const Params& params,
+			const PublicKey& key, RandomSource& rand)
+	{
+		const MontgomeryContext& m = *params.mont;
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(m.scratchLimbs());
+		mp_limb_t* factor = frame.limbs(limbs);
+		mpz_class& r = frame.mpz();
+		
+		for (size_t i = 0; i < count * limbs; i += limbs)
+		{
+			params.randomExponent(r, rand);
+			params.modExpGMont(factor, r);
+			m.mul(&Bs[i], &Bs[i], factor, scratch);
+			key.modExpAMont(factor, params, r);
+			m.mul(&cs[i], &cs[i], factor, scratch);
+		}
+	}
+	
+}
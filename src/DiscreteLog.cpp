@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "DiscreteLog.h"
+
+namespace ElGamal {
+	
+	static const char magic[8] = { 'E', 'G', 'D', 'L', 'O', 'G', '0', '1' };
+	
+	static uint64_t lowLimb(const mpz_class& n)
+	{
+		return mpz_getlimbn(n.get_mpz_t(), 0);
+	}
+	
+	// Spread the key bits before masking; residues are already uniform, but
+	// small bases give structured low limbs for the first few powers.
+	static size_t slotOf(uint64_t key, size_t mask)
+	{
+		return (key * 0x9E3779B97F4A7C15ull >> 20) & mask;
+	}
+	
+	// The hash table when built or loaded here rather than mapped.
+	struct OwnedTable
+	{
+		vector<uint64_t> keys;
+		vector<uint32_t> values;
+		
+		explicit OwnedTable(size_t capacity) : keys(capacity), values(capacity)
+		{ }
+		
+		void insert(const uint64_t key, const uint32_t j)
+		{
+			const size_t mask = keys.size() - 1;
+			size_t slot = slotOf(key, mask);
+			while (values[slot] != 0)
+				slot = (slot + 1) & mask;
+			keys[slot] = key;
+			values[slot] = j + 1;
+		}
+	};
+	
+	// Slots for babySteps entries: the smallest power of 2 that keeps the
+	// load factor at or below one half.
+	static uint64_t capacityFor(const uint64_t babySteps)
+	{
+		uint64_t capacity = 1;
+		while (capacity < 2 * babySteps)
+			capacity <<= 1;
+		return capacity;
+	}
+	
+	unsigned long DiscreteLog::defaultBabySteps(const unsigned long bound)
+	{
+		return std::ceil(std::sqrt(static_cast<double>(bound)));
+	}
+	
+	DiscreteLog::DiscreteLog(const Params& params, const mpz_class& _base,
+			const unsigned long _bound, const unsigned long _babySteps) :
+			p(params.p), base(_base % params.p), bound(_bound),
+			babySteps(_babySteps ? _babySteps : defaultBabySteps(_bound))
+	{
+		assert(babySteps > 0 && babySteps < UINT32_MAX);
+		
+		capacity = capacityFor(babySteps);
+		auto table = std::make_shared<OwnedTable>(capacity);
+		
+		mpz_class power(1);
+		for (uint32_t j = 0; j < babySteps; j++)
+		{
+			table->insert(lowLimb(power), j);
+			power *= base;
+			power %= p;
+		}
+		keys = table->keys.data();
+		values = table->values.data();
+		storage = std::move(table);
+		prepareGiantStep();
+	}
+	
+	void DiscreteLog::prepareGiantStep()
+	{
+		mpz_powm_ui(giantStep.get_mpz_t(), base.get_mpz_t(), babySteps,
+				p.get_mpz_t());
+		mpz_invert(giantStep.get_mpz_t(), giantStep.get_mpz_t(), p.get_mpz_t());
+	}
+	
+	long DiscreteLog::decode(const mpz_class& n) const
+	{
+		if (capacity == 0)
+			return -1;
+		
+		const size_t mask = capacity - 1;
+		const mpz_class target = n % p;
+		mpz_class current = target;
+		for (unsigned long giant = 0; giant * babySteps < bound; giant++)
+		{
+			// Several baby steps may share a low limb; the probe sequence
+			// holds all of them, and each is confirmed against n.
+			const uint64_t key = lowLimb(current);
+			for (size_t slot = slotOf(key, mask); values[slot] != 0;
+					slot = (slot + 1) & mask)
+			{
+				if (keys[slot] != key)
+					continue;
+				const unsigned long x = giant * babySteps + values[slot] - 1;
+				if (x >= bound)
+					continue;
+				mpz_class check;
+				mpz_powm_ui(check.get_mpz_t(), base.get_mpz_t(), x,
+						p.get_mpz_t());
+				if (check == target)
+					return x;
+			}
+			
+			current *= giantStep;
+			current %= p;
+		}
+		return -1;
+	}
+	
+	static void writeU64(ostream& out, uint64_t n)
+	{
+		out.write(reinterpret_cast<const char*>(&n), sizeof n);
+	}
+	
+	static bool readU64(istream& in, uint64_t& n)
+	{
+		return bool(in.read(reinterpret_cast<char*>(&n), sizeof n));
+	}
+	
+	void DiscreteLog::save(ostream& out) const
+	{
+		out.write(magic, sizeof magic);
+		out << p.get_str(16) << ' ' << base.get_str(16) << ' ';
+		writeU64(out, bound);
+		writeU64(out, babySteps);
+		writeU64(out, capacity);
+		out.write(reinterpret_cast<const char*>(keys),
+				capacity * sizeof(uint64_t));
+		out.write(reinterpret_cast<const char*>(values),
+				capacity * sizeof(uint32_t));
+	}
+	
+	bool DiscreteLog::load(istream& in)
+	{
+		char header[sizeof magic];
+		if (!in.read(header, sizeof header)
+				|| !std::equal(header, header + sizeof header, magic))
+			return false;
+		
+		std::string pHex, baseHex;
+		uint64_t newBound, newBabySteps, newCapacity;
+		if (!(in >> pHex >> baseHex) || in.get() != ' '
+				|| !readU64(in, newBound) || !readU64(in, newBabySteps)
+				|| !readU64(in, newCapacity)
+				|| newBabySteps == 0 || newBabySteps >= UINT32_MAX
+				|| newCapacity != capacityFor(newBabySteps))
+			return false;
+		
+		auto table = std::make_shared<OwnedTable>(newCapacity);
+		if (!in.read(reinterpret_cast<char*>(table->keys.data()),
+						newCapacity * sizeof(uint64_t))
+				|| !in.read(reinterpret_cast<char*>(table->values.data()),
+						newCapacity * sizeof(uint32_t)))
+			return false;
+		
+		mpz_class newP, newBase;
+		if (newP.set_str(pHex, 16) != 0 || newBase.set_str(baseHex, 16) != 0)
+			return false;
+		p = move(newP);
+		base = move(newBase);
+		bound = newBound;
+		babySteps = newBabySteps;
+		capacity = newCapacity;
+		keys = table->keys.data();
+		values = table->values.data();
+		storage = std::move(table);
+		prepareGiantStep();
+		return true;
+	}
+	
+}
@@ -0,0 +1,479 @@
+#include <cassert>
+#include "Ed25519.h"
+#include "ScratchArena.h"
+
+namespace ElGamal {
+
+	static_assert(GMP_NUMB_BITS == 64, "Ed25519Group assumes 64-bit limbs");
+
+	// Points are read from tables as flat limb arrays.
+	static const mp_size_t pointLimbs = 4 * ed25519FieldLimbs;
+	static_assert(sizeof(Ed25519Point) == pointLimbs * sizeof(mp_limb_t),
+			"Ed25519Point must be unpadded");
+
+	// Scalars below l have 253 bits; 4-bit windows cover 256.
+	static const unsigned windowBits = 4;
+	static const size_t windowEntries = size_t(1) << windowBits;
+	static const unsigned scalarWindows = 256 / windowBits;
+
+	static mp_limb_t* flat(Ed25519Point& point)
+	{
+		return reinterpret_cast<mp_limb_t*>(&point);
+	}
+
+	static const mp_limb_t* flat(const Ed25519Point* points)
+	{
+		return reinterpret_cast<const mp_limb_t*>(points);
+	}
+
+	static unsigned digit(const mpz_class& k, unsigned window)
+	{
+		const unsigned bit = window * windowBits;
+		return (mpz_getlimbn(k.get_mpz_t(), bit / GMP_NUMB_BITS)
+				>> (bit % GMP_NUMB_BITS)) & (windowEntries - 1);
+	}
+
+	// Field elements are radix 2^51.  Sums and differences are carried
+	// back below 2^52 per limb, which keeps every limb product and its
+	// multiple of 19 within 128 bits.
+	__extension__ typedef unsigned __int128 uint128;
+	static const unsigned limbBits = 51;
+	static const mp_limb_t limbMask = (mp_limb_t(1) << limbBits) - 1;
+
+	// p = 2^255 - 19 as 64-bit words, least significant first.
+	static const mp_limb_t prime[4] = {
+		0xffffffffffffffedull, 0xffffffffffffffffull,
+		0xffffffffffffffffull, 0x7fffffffffffffffull
+	};
+
+	static void carry(Ed25519FieldElement& a)
+	{
+		mp_limb_t* const h = a.limbs;
+		for (mp_size_t i = 0; i < ed25519FieldLimbs - 1; i++)
+		{
+			h[i + 1] += h[i] >> limbBits;
+			h[i] &= limbMask;
+		}
+		// 2^255 = 19 mod p.
+		h[0] += 19 * (h[4] >> limbBits);
+		h[4] &= limbMask;
+	}
+
+	// The fully reduced value of a as four 64-bit words.
+	static void pack(mp_limb_t* words, const Ed25519FieldElement& a)
+	{
+		Ed25519FieldElement t = a;
+		carry(t);
+		carry(t);
+		// t is now below 2p; q = 1 exactly when t >= p.
+		mp_limb_t* const h = t.limbs;
+		mp_limb_t q = (h[0] + 19) >> limbBits;
+		for (mp_size_t i = 1; i < ed25519FieldLimbs; i++)
+			q = (h[i] + q) >> limbBits;
+		h[0] += 19 * q;
+		for (mp_size_t i = 0; i < ed25519FieldLimbs - 1; i++)
+		{
+			h[i + 1] += h[i] >> limbBits;
+			h[i] &= limbMask;
+		}
+		h[4] &= limbMask;
+
+		words[0] = h[0] | h[1] << 51;
+		words[1] = h[1] >> 13 | h[2] << 38;
+		words[2] = h[2] >> 26 | h[3] << 25;
+		words[3] = h[3] >> 39 | h[4] << 12;
+	}
+
+	// words must be below 2^255.
+	static void unpack(Ed25519FieldElement& out, const mp_limb_t* words)
+	{
+		out.limbs[0] = words[0] & limbMask;
+		out.limbs[1] = (words[0] >> 51 | words[1] << 13) & limbMask;
+		out.limbs[2] = (words[1] >> 38 | words[2] << 26) & limbMask;
+		out.limbs[3] = (words[2] >> 25 | words[3] << 39) & limbMask;
+		out.limbs[4] = words[3] >> 12;
+	}
+
+	static void toField(Ed25519FieldElement& out, const mpz_class& n)
+	{
+		mp_limb_t words[4];
+		for (mp_size_t i = 0; i < 4; i++)
+			words[i] = mpz_getlimbn(n.get_mpz_t(), i);
+		unpack(out, words);
+	}
+
+	Ed25519Group::Ed25519Group() : p((mpz_class(1) << 255) - 19),
+			l((mpz_class(1) << 252)
+					+ mpz_class("27742317777372353535851937790883648493")),
+			pMinus2(p - 2), sqrtExp((p - 5) / 8),
+			baseTable(scalarWindows * windowEntries)
+	{
+		// d = -121665 / 121666, and sqrt(-1) = 2^((p - 1) / 4).
+		mpz_class n = 121666;
+		mpz_invert(n.get_mpz_t(), n.get_mpz_t(), p.get_mpz_t());
+		n = (p - 121665) * n % p;
+		toField(d, n);
+		add(d2, d, d);
+		const mpz_class two = 2, quarter = (p - 1) / 4;
+		mpz_powm(n.get_mpz_t(), two.get_mpz_t(), quarter.get_mpz_t(),
+				p.get_mpz_t());
+		toField(sqrtMinus1, n);
+
+		// The base point has y = 4/5 and even x.
+		n = 5;
+		mpz_invert(n.get_mpz_t(), n.get_mpz_t(), p.get_mpz_t());
+		n = 4 * n % p;
+		Fe y;
+		toField(y, n);
+		const bool onCurve = decompress(base, y, 0);
+		assert(onCurve);
+		(void) onCurve;
+
+		Ed25519Point power = base;
+		for (unsigned window = 0; window < scalarWindows; window++)
+		{
+			Ed25519Point* const row = &baseTable[window * windowEntries];
+			identity(row[0]);
+			row[1] = power;
+			for (size_t i = 2; i < windowEntries; i++)
+				mul(row[i], row[i - 1], power);
+			for (unsigned s = 0; s < windowBits; s++)
+				dbl(power, power);
+		}
+	}
+
+	void Ed25519Group::add(Fe& out, const Fe& a, const Fe& b) const
+	{
+		for (mp_size_t i = 0; i < ed25519FieldLimbs; i++)
+			out.limbs[i] = a.limbs[i] + b.limbs[i];
+		carry(out);
+	}
+
+	void Ed25519Group::sub(Fe& out, const Fe& a, const Fe& b) const
+	{
+		// Add 4p first so that no limb goes negative.
+		static const mp_limb_t fourP[ed25519FieldLimbs] = {
+			(limbMask - 18) * 4, limbMask * 4, limbMask * 4, limbMask * 4,
+			limbMask * 4
+		};
+		for (mp_size_t i = 0; i < ed25519FieldLimbs; i++)
+			out.limbs[i] = a.limbs[i] + fourP[i] - b.limbs[i];
+		carry(out);
+	}
+
+	void Ed25519Group::mul(Fe& out, const Fe& a, const Fe& b) const
+	{
+		// Schoolbook, folding limb products at or above 2^255 back in
+		// times 19.
+		const mp_limb_t* const f = a.limbs;
+		const mp_limb_t* const g = b.limbs;
+		const mp_limb_t g1 = 19 * g[1], g2 = 19 * g[2], g3 = 19 * g[3],
+				g4 = 19 * g[4];
+		uint128 r[ed25519FieldLimbs];
+		r[0] = uint128(f[0]) * g[0] + uint128(f[1]) * g4
+				+ uint128(f[2]) * g3 + uint128(f[3]) * g2 + uint128(f[4]) * g1;
+		r[1] = uint128(f[0]) * g[1] + uint128(f[1]) * g[0]
+				+ uint128(f[2]) * g4 + uint128(f[3]) * g3 + uint128(f[4]) * g2;
+		r[2] = uint128(f[0]) * g[2] + uint128(f[1]) * g[1]
+				+ uint128(f[2]) * g[0] + uint128(f[3]) * g4
+				+ uint128(f[4]) * g3;
+		r[3] = uint128(f[0]) * g[3] + uint128(f[1]) * g[2]
+				+ uint128(f[2]) * g[1] + uint128(f[3]) * g[0]
+				+ uint128(f[4]) * g4;
+		r[4] = uint128(f[0]) * g[4] + uint128(f[1]) * g[3]
+				+ uint128(f[2]) * g[2] + uint128(f[3]) * g[1]
+				+ uint128(f[4]) * g[0];
+
+		for (mp_size_t i = 0; i < ed25519FieldLimbs - 1; i++)
+		{
+			r[i + 1] += r[i] >> limbBits;
+			out.limbs[i] = mp_limb_t(r[i]) & limbMask;
+		}
+		out.limbs[4] = mp_limb_t(r[4]) & limbMask;
+		out.limbs[0] += 19 * mp_limb_t(r[4] >> limbBits);
+		out.limbs[1] += out.limbs[0] >> limbBits;
+		out.limbs[0] &= limbMask;
+	}
+
+	void Ed25519Group::sqr(Fe& out, const Fe& a) const
+	{
+		mul(out, a, a);
+	}
+
+	void Ed25519Group::pow(Fe& out, const Fe& a, const mpz_class& pow) const
+	{
+		// Fixed 4-bit windows.  Only ever called with the constant
+		// exponents above, so variable time in pow is harmless.
+		Fe table[windowEntries], acc = one();
+		table[0] = acc;
+		table[1] = a;
+		for (size_t i = 2; i < windowEntries; i++)
+			mul(table[i], table[i - 1], a);
+		for (unsigned window = (mpz_sizeinbase(pow.get_mpz_t(), 2)
+				+ windowBits - 1) / windowBits; window-- > 0; )
+		{
+			for (unsigned s = 0; s < windowBits; s++)
+				sqr(acc, acc);
+			if (const unsigned i = digit(pow, window))
+				mul(acc, acc, table[i]);
+		}
+		out = acc;
+	}
+
+	bool Ed25519Group::isZero(const Fe& a) const
+	{
+		mp_limb_t words[4];
+		pack(words, a);
+		return (words[0] | words[1] | words[2] | words[3]) == 0;
+	}
+
+	bool Ed25519Group::equal(const Fe& a, const Fe& b) const
+	{
+		Fe diff;
+		sub(diff, a, b);
+		return isZero(diff);
+	}
+
+	void Ed25519Group::identity(Element& out) const
+	{
+		out = Element();
+		out.Y = one();
+		out.Z = one();
+	}
+
+	bool Ed25519Group::isIdentity(const Element& a) const
+	{
+		return isZero(a.X) && equal(a.Y, a.Z);
+	}
+
+	void Ed25519Group::mul(Element& out, const Element& a,
+			const Element& b) const
+	{
+		// Complete addition for a = -1 (RFC 8032, 5.1.4); also correct for
+		// doubling and the identity.
+		Fe A, B, C, D, E, F, G, H, t;
+		sub(A, a.Y, a.X);
+		sub(t, b.Y, b.X);
+		mul(A, A, t);
+		add(B, a.Y, a.X);
+		add(t, b.Y, b.X);
+		mul(B, B, t);
+		mul(C, a.T, b.T);
+		mul(C, C, d2);
+		mul(D, a.Z, b.Z);
+		add(D, D, D);
+		sub(E, B, A);
+		sub(F, D, C);
+		add(G, D, C);
+		add(H, B, A);
+		mul(out.X, E, F);
+		mul(out.Y, G, H);
+		mul(out.T, E, H);
+		mul(out.Z, F, G);
+	}
+
+	void Ed25519Group::dbl(Element& out, const Element& a) const
+	{
+		Fe A, B, C, E, F, G, H;
+		sqr(A, a.X);
+		sqr(B, a.Y);
+		sqr(C, a.Z);
+		add(C, C, C);
+		add(H, A, B);
+		add(E, a.X, a.Y);
+		sqr(E, E);
+		sub(E, H, E);
+		sub(G, A, B);
+		add(F, C, G);
+		mul(out.X, E, F);
+		mul(out.Y, G, H);
+		mul(out.T, E, H);
+		mul(out.Z, F, G);
+	}
+
+	void Ed25519Group::inverse(Element& out, const Element& a) const
+	{
+		const Fe zero = { };
+		sub(out.X, zero, a.X);
+		out.Y = a.Y;
+		out.Z = a.Z;
+		sub(out.T, zero, a.T);
+	}
+
+	bool Ed25519Group::equal(const Element& a, const Element& b) const
+	{
+		// Compare X/Z and Y/Z without inverting.
+		Fe left, right;
+		mul(left, a.X, b.Z);
+		mul(right, b.X, a.Z);
+		const bool xEqual = equal(left, right);
+		mul(left, a.Y, b.Z);
+		mul(right, b.Y, a.Z);
+		return xEqual & equal(left, right);
+	}
+
+	void Ed25519Group::scalarMul(Element& out, const Element& a,
+			const mpz_class& pow, const bool secret) const
+	{
+		assert(sgn(pow) >= 0 && mpz_sizeinbase(pow.get_mpz_t(), 2) <= 256);
+		Element table[windowEntries];
+		identity(table[0]);
+		table[1] = a;
+		for (size_t i = 2; i < windowEntries; i++)
+			mul(table[i], table[i - 1], a);
+
+		// A secret scalar takes every window and reads every entry, so
+		// neither the operations nor the memory accesses depend on it.
+		Element acc, entry;
+		identity(acc);
+		const unsigned windows = secret ? scalarWindows
+				: (mpz_sizeinbase(pow.get_mpz_t(), 2) + windowBits - 1)
+						/ windowBits;
+		for (unsigned window = windows; window-- > 0; )
+		{
+			for (unsigned s = 0; s < windowBits; s++)
+				dbl(acc, acc);
+			if (secret)
+			{
+				mpn_sec_tabselect(flat(entry), flat(table), pointLimbs,
+						windowEntries, digit(pow, window));
+				mul(acc, acc, entry);
+			}
+			else if (const unsigned i = digit(pow, window))
+				mul(acc, acc, table[i]);
+		}
+		out = acc;
+	}
+
+	// pow mod l, in a slot from frame unless it is already reduced.
+	static const mpz_class& reduced(ScratchArena::Frame& frame,
+			const mpz_class& pow, const mpz_class& l)
+	{
+		if (sgn(pow) >= 0 && pow < l)
+			return pow;
+		mpz_class& r = frame.mpz();
+		mpz_mod(r.get_mpz_t(), pow.get_mpz_t(), l.get_mpz_t());
+		return r;
+	}
+
+	void Ed25519Group::exp(Element& out, const Element& base,
+			const mpz_class& pow, SecretExponent) const
+	{
+		ScratchArena::Frame frame(256);
+		scalarMul(out, base, reduced(frame, pow, l), true);
+	}
+
+	void Ed25519Group::exp(Element& out, const Element& base,
+			const mpz_class& pow, PublicExponent) const
+	{
+		ScratchArena::Frame frame(256);
+		scalarMul(out, base, reduced(frame, pow, l), false);
+	}
+
+	void Ed25519Group::expG(Element& out, const mpz_class& pow) const
+	{
+		// One table scan and one addition per window, no doublings.
+		ScratchArena::Frame frame(256);
+		const mpz_class& k = reduced(frame, pow, l);
+		Element acc, entry;
+		identity(acc);
+		for (unsigned window = 0; window < scalarWindows; window++)
+		{
+			mpn_sec_tabselect(flat(entry), flat(&baseTable[window * windowEntries]),
+					pointLimbs, windowEntries, digit(k, window));
+			mul(acc, acc, entry);
+		}
+		out = acc;
+	}
+
+	void Ed25519Group::randomExponent(mpz_class& out,
+			RandomSource& rand) const
+	{
+		// l is just above 2^252, so about half of 253-bit draws are kept.
+		rand.uniform(out, l);
+	}
+
+	bool Ed25519Group::decompress(Element& out, const Fe& y,
+			const unsigned sign) const
+	{
+		// x^2 = u / v with u = y^2 - 1 and v = d y^2 + 1.  Since p = 5 mod 8,
+		// a root is u v^3 (u v^7)^((p - 5) / 8), possibly times sqrt(-1)
+		// (RFC 8032, 5.1.3).
+		Fe yy, u, v, v3, t, x, check, negU;
+		const Fe zero = { };
+		sqr(yy, y);
+		sub(u, yy, one());
+		mul(v, yy, d);
+		add(v, v, one());
+		sqr(v3, v);
+		mul(v3, v3, v);
+		sqr(t, v3);
+		mul(t, t, v);
+		mul(t, t, u);
+		pow(t, t, sqrtExp);
+		mul(x, u, v3);
+		mul(x, x, t);
+
+		sqr(check, x);
+		mul(check, check, v);
+		sub(negU, zero, u);
+		if (equal(check, negU))
+			mul(x, x, sqrtMinus1);
+		else if (!equal(check, u))
+			return false;
+
+		mp_limb_t words[4];
+		pack(words, x);
+		if (isZero(x) && sign)
+			return false;
+		if ((words[0] & 1) != sign)
+			sub(x, zero, x);
+
+		out.X = x;
+		out.Y = y;
+		out.Z = one();
+		mul(out.T, x, y);
+		return true;
+	}
+
+	uint8_t* Ed25519Group::write(const Element& a, uint8_t* out) const
+	{
+		Fe zInv, x, y;
+		pow(zInv, a.Z, pMinus2);
+		mul(x, a.X, zInv);
+		mul(y, a.Y, zInv);
+		mp_limb_t xs[4], ys[4];
+		pack(xs, x);
+		pack(ys, y);
+		for (size_t i = 0; i < encodedBytes; i++)
+			out[i] = ys[i / 8] >> (8 * (i % 8));
+		out[encodedBytes - 1] |= (xs[0] & 1) << 7;
+		return out + encodedBytes;
+	}
+
+	const uint8_t* Ed25519Group::read(Element& a, const uint8_t* in,
+			const uint8_t* end) const
+	{
+		if (in == nullptr || static_cast<size_t>(end - in) < encodedBytes)
+			return nullptr;
+		mp_limb_t words[4] = { };
+		for (size_t i = 0; i < encodedBytes; i++)
+			words[i / 8] |= mp_limb_t(in[i]) << (8 * (i % 8));
+		const unsigned sign = words[3] >> 63;
+		words[3] &= ~(mp_limb_t(1) << 63);
+		if (mpn_cmp(words, prime, 4) >= 0)
+			return nullptr;
+		Fe y;
+		unpack(y, words);
+
+		if (!decompress(a, y, sign))
+			return nullptr;
+
+		// The curve has cofactor 8; keep out points of small order, which
+		// would leak a secret exponent mod 8.
+		Element check;
+		scalarMul(check, a, l, false);
+		return isIdentity(check) ? in + encodedBytes : nullptr;
+	}
+
+}
@@ -1,15 +1,25 @@
+#include <algorithm>
 #include <cassert>
 #include "ElGamal.h"
+#include "Instrument.h"
+#include "PrecomputeCache.h"
+#include "PrecomputePool.h"
 
 namespace ElGamal {
 	
 	mpz_class powerOf2(const unsigned pow)
 	{
 		mpz_class out;
-		mpz_ui_pow_ui(out.get_mpz_t(), 2, pow);
+		powerOf2(out, pow);
 		return out;
 	}
 	
+	void powerOf2(mpz_class& out, const unsigned pow)
+	{
+		out = 0;
+		mpz_setbit(out.get_mpz_t(), pow);
+	}
+	
 	int tryLogBase2(const Params& params, const mpz_class& n)
 	{
 		return tryLogBase2(n, 0, params.keyBits);
@@ -17,85 +27,413 @@ namespace ElGamal {
 	
 	int tryLogBase2(const mpz_class& n, unsigned low, unsigned high)
 	{
-		// Find the discrete logarithm.  This method only performs a binary
-		// search in the range [low, high).
-		while (high > low)
-		{
-			const unsigned current = (high + low) >> 1;
-			const mpz_class currentPow = powerOf2(current);
-			
-			const int compare = cmp(currentPow, n);
-			if (compare < 0)
-				low = current + 1;
-			else if (compare > 0)
-				high = current;
-			else
-				return current;
-		}
+		// A power of 2 has exactly one bit set, and its position is the
+		// logarithm; no candidate powers need to be built.  Only values in
+		// [low, high) are reported.
+		if (sgn(n) <= 0 || mpz_popcount(n.get_mpz_t()) != 1)
+			return -1;
 		
-		return -1;
+		const mp_bitcnt_t log = mpz_scan1(n.get_mpz_t(), 0);
+		return log >= low && log < high ? static_cast<int>(log) : -1;
 	}
 	
-	mpz_class Params::modExp(const mpz_class& base, const mpz_class& pow) const
+	mpz_class Params::modExp(const mpz_class& base, const mpz_class& pow,
+			SecretExponent) const
 	{
 		mpz_class out;
-#ifdef secure_exponentiation
-		if (pow >= 0)
+		modExp(out, base, pow, secretExponent);
+		return out;
+	}
+	
+	mpz_class Params::modExp(const mpz_class& base, const mpz_class& pow,
+			PublicExponent) const
+	{
+		mpz_class out;
+		modExp(out, base, pow, publicExponent);
+		return out;
+	}
+	
+	void Params::modExp(mpz_class& out, const mpz_class& base,
+			const mpz_class& pow, SecretExponent) const
+	{
+		// mpz_powm_sec needs a positive exponent.  Since base^(p-1) = 1
+		// for any base coprime to p, a negative one is reduced mod p - 1
+		// rather than paying for an inversion.
+		const mpz_class* exponent = &pow;
+		ScratchArena::Frame frame(keyBits);
+		if (sgn(pow) < 0)
 		{
-			mpz_powm_sec(
-					out.get_mpz_t(), base.get_mpz_t(),
-					pow.get_mpz_t(), p.get_mpz_t());
+			mpz_class& reduced = frame.mpz();
+			mpz_sub_ui(reduced.get_mpz_t(), p.get_mpz_t(), 1);
+			mpz_fdiv_r(reduced.get_mpz_t(), pow.get_mpz_t(),
+					reduced.get_mpz_t());
+			exponent = &reduced;
 		}
+		
+		if (Instrument::enabled)
+			Instrument::record(Instrument::ModExpSecretBits,
+					mpz_sizeinbase(exponent->get_mpz_t(), 2));
+		if (sgn(*exponent) == 0)
+			out = 1;
 		else
-		{ // mpz_powm_sec does not support negative exponents.
 			mpz_powm_sec(
 					out.get_mpz_t(), base.get_mpz_t(),
-					mpz_class(-pow).get_mpz_t(), p.get_mpz_t());
-			out = modInv(out);
-		}
-#else
+					exponent->get_mpz_t(), p.get_mpz_t());
+	}
+	
+	void Params::modExp(mpz_class& out, const mpz_class& base,
+			const mpz_class& pow, PublicExponent) const
+	{
+		if (Instrument::enabled)
+			Instrument::record(Instrument::ModExpPublicBits,
+					mpz_sizeinbase(pow.get_mpz_t(), 2));
 		mpz_powm(
 				out.get_mpz_t(), base.get_mpz_t(),
 				pow.get_mpz_t(), p.get_mpz_t());
-#endif
-		
+	}
+	
+	mpz_class Params::modExp(const mpz_class& base, const unsigned pow,
+			SecretExponent) const
+	{
+		mpz_class out;
+		modExp(out, base, pow, secretExponent);
 		return out;
 	}
 	
-	mpz_class Params::modExp(const mpz_class& base, const unsigned pow) const
+	mpz_class Params::modExp(const mpz_class& base, const unsigned pow,
+			PublicExponent) const
 	{
 		mpz_class out;
-#ifdef secure_exponentiation
-		mpz_powm_sec(
-				out.get_mpz_t(), base.get_mpz_t(),
-				mpz_class(pow).get_mpz_t(), p.get_mpz_t());
-#else
+		modExp(out, base, pow, publicExponent);
+		return out;
+	}
+	
+	void Params::modExp(mpz_class& out, const mpz_class& base,
+			const unsigned pow, SecretExponent) const
+	{
+		ScratchArena::Frame frame(keyBits);
+		mpz_class& powZ = frame.mpz();
+		powZ = pow;
+		modExp(out, base, powZ, secretExponent);
+	}
+	
+	void Params::modExp(mpz_class& out, const mpz_class& base,
+			const unsigned pow, PublicExponent) const
+	{
+		if (Instrument::enabled)
+			Instrument::record(Instrument::ModExpPublicBits,
+					pow ? 32 - __builtin_clz(pow) : 0);
 		mpz_powm_ui(
 				out.get_mpz_t(), base.get_mpz_t(),
 				pow, p.get_mpz_t());
-#endif
+	}
+	
+	// Below this many, a batch is cheaper one at a time: the kernel costs
+	// the same for a partial batch as a full one.
+	static const size_t minMultiBuffer = MultiBufferExp::lanes / 2;
+	
+	void Params::modExpBatch(mpz_class* const* out,
+			const mpz_class* const* bases,
+			const mpz_class* const* pows, const size_t count,
+			SecretExponent) const
+	{
+		size_t bits = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			assert(sgn(*pows[i]) >= 0 && *pows[i] < order);
+			bits = std::max(bits, mpz_sizeinbase(pows[i]->get_mpz_t(), 2));
+		}
+		bits = bits <= exponentBits ? exponentBits
+				: mpz_sizeinbase(order.get_mpz_t(), 2);
 		
+		// A short tail goes to GMP; its length is public.
+		const size_t tail = !multiBuffer ? count
+				: count % MultiBufferExp::lanes < minMultiBuffer
+				? count % MultiBufferExp::lanes : 0;
+		if (multiBuffer && count > tail)
+		{
+			multiBuffer->modExp(out, bases, pows, count - tail, bits);
+			for (size_t i = 0; i < count - tail; i++)
+				Instrument::record(Instrument::ModExpSecretBits, bits);
+		}
+		for (size_t i = count - tail; i < count; i++)
+			modExp(*out[i], *bases[i], *pows[i], secretExponent);
+	}
+	
+	void Params::modExpBatch(mpz_class* const* out,
+			const mpz_class* const* bases,
+			const mpz_class* const* pows, const size_t count,
+			PublicExponent) const
+	{
+		size_t bits = 0;
+		for (size_t i = 0; i < count; i++)
+			bits = std::max(bits, mpz_sizeinbase(pows[i]->get_mpz_t(), 2));
+		
+		const size_t tail = !multiBuffer ? count
+				: count % MultiBufferExp::lanes < minMultiBuffer
+				? count % MultiBufferExp::lanes : 0;
+		if (multiBuffer && count > tail)
+		{
+			multiBuffer->modExp(out, bases, pows, count - tail, bits);
+			for (size_t i = 0; i < count - tail; i++)
+				Instrument::record(Instrument::ModExpPublicBits, bits);
+		}
+		for (size_t i = count - tail; i < count; i++)
+			modExp(*out[i], *bases[i], *pows[i], publicExponent);
+	}
+	
+	mpz_class Params::modExpG(const mpz_class& pow) const
+	{
+		mpz_class out;
+		modExpG(out, pow);
+		return out;
+	}
+	
+	void Params::modExpG(mpz_class& out, const mpz_class& pow) const
+	{
+		if (gTable && gTable->covers(pow))
+			gTable->modExp(out, pow);
+		else
+			modExp(out, g, pow);
+	}
+	
+	Params Params::primeOrderSubgroup(const mpz_class& p, const mpz_class& g,
+			const unsigned exponentBits, const unsigned tableWindowBits,
+			shared_ptr<const PrecomputeCache> cache)
+	{
+		const mpz_class q = (p - 1) / 2;
+		assert(exponentBits > 0
+				&& exponentBits < mpz_sizeinbase(q.get_mpz_t(), 2));
+		Params params(p, g, q, exponentBits, tableWindowBits, move(cache));
+		assert(g > 1 && params.modExp(g, q, publicExponent) == 1);
+		return params;
+	}
+	
+	void Params::randomExponent(mpz_class& out, RandomSource& rand) const
+	{
+		// A short exponent is always below the order.
+		if (shortExponents())
+			rand.bits(out, exponentBits);
+		else
+			rand.uniform(out, order);
+	}
+	
+	void Params::randomExponents(mpz_class* out, const size_t count,
+			RandomSource& rand) const
+	{
+		if (!shortExponents())
+			rand.uniform(out, count, order);
+		else
+			for (size_t i = 0; i < count; i++)
+				rand.bits(out[i], exponentBits);
+	}
+	
+	void Params::modExpGMont(mp_limb_t* out, const mpz_class& pow) const
+	{
+		if (gTable && gTable->covers(pow))
+			gTable->modExpMont(out, pow);
+		else
+		{
+			ScratchArena::Frame frame(keyBits);
+			mpz_class& power = frame.mpz();
+			modExp(power, g, pow);
+			mont->toMont(out, power, frame.limbs(mont->scratchLimbs()));
+		}
+	}
+	
+	// Bits [bit, bit + width) of n >= 0.
+	static unsigned long windowDigit(const mpz_class& n, const unsigned bit,
+			const unsigned width)
+	{
+		const mp_size_t limb = bit / GMP_NUMB_BITS;
+		const unsigned shift = bit % GMP_NUMB_BITS;
+		mp_limb_t digit = mpz_getlimbn(n.get_mpz_t(), limb) >> shift;
+		if (shift + width > GMP_NUMB_BITS)
+			digit |= mpz_getlimbn(n.get_mpz_t(), limb + 1)
+					<< (GMP_NUMB_BITS - shift);
+		return digit & ((mp_limb_t(1) << width) - 1);
+	}
+	
+	mpz_class Params::multiExp(const vector<const mpz_class*>& bases,
+			const vector<mpz_class>& pows) const
+	{
+		mpz_class out;
+		multiExp(out, bases, pows);
 		return out;
 	}
 	
+	void Params::multiExp(mpz_class& out, const vector<const mpz_class*>& bases,
+			const vector<mpz_class>& pows) const
+	{
+		assert(bases.size() == pows.size());
+		const unsigned windowBits = 4;
+		const size_t entries = size_t(1) << windowBits;
+		
+		size_t maxBits = 0;
+		for (const auto& pow : pows)
+		{
+			assert(sgn(pow) >= 0);
+			maxBits = std::max(maxBits, mpz_sizeinbase(pow.get_mpz_t(), 2));
+		}
+		
+		// base^d for every base and digit d in [1, 2^w), in Montgomery form.
+		const MontgomeryContext& m = *mont;
+		const mp_size_t limbs = m.limbs();
+		ScratchArena::Frame frame(keyBits);
+		mp_limb_t* const table = frame.limbs(bases.size() * entries * limbs);
+		mp_limb_t* const acc = frame.limbs(limbs);
+		mp_limb_t* const scratch = frame.limbs(m.scratchLimbs());
+		mpz_class& reduced = frame.mpz();
+		for (size_t i = 0; i < bases.size(); i++)
+		{
+			mp_limb_t* powers = &table[i * entries * limbs];
+			mpz_mod(reduced.get_mpz_t(), bases[i]->get_mpz_t(), p.get_mpz_t());
+			m.toMont(powers + limbs, reduced, scratch);
+			for (size_t d = 2; d < entries; d++)
+				m.mul(powers + d * limbs, powers + (d - 1) * limbs,
+						powers + limbs, scratch);
+		}
+		
+		// Scan all exponents together from the top window down, so the
+		// squarings are shared instead of repeated for each base.
+		mpn_copyi(acc, m.one(), limbs);
+		bool started = false;
+		for (unsigned window = (maxBits + windowBits - 1) / windowBits;
+				window-- > 0; )
+		{
+			if (started)
+				for (unsigned s = 0; s < windowBits; s++)
+					m.sqr(acc, acc, scratch);
+			for (size_t i = 0; i < bases.size(); i++)
+			{
+				const unsigned long digit = windowDigit(pows[i],
+						window * windowBits, windowBits);
+				if (digit == 0)
+					continue;
+				m.mul(acc, acc, &table[(i * entries + digit) * limbs], scratch);
+				started = true;
+			}
+		}
+		
+		m.fromMont(out, acc, scratch);
+	}
+	
+	shared_ptr<const FixedBaseTable> Params::makeTable(
+			const mpz_class& base) const
+	{
+		if (tableWindowBits == 0)
+			return nullptr;
+		if (cache)
+			if (auto table = cache->table(mont, base, exponentBits,
+					tableWindowBits))
+				return table;
+		return std::make_shared<const FixedBaseTable>(
+				mont, base, exponentBits, tableWindowBits);
+	}
+	
+	shared_ptr<const MontgomeryContext> Params::makeMontgomery() const
+	{
+		if (cache)
+			if (auto context = cache->montgomery(p))
+				return context;
+		return std::make_shared<const MontgomeryContext>(p);
+	}
+	
 	mpz_class Params::modInv(const mpz_class& n) const
 	{
 		mpz_class out;
+		modInv(out, n);
+		return out;
+	}
+	
+	void Params::secretModInv(mpz_class& out, const mpz_class& n) const
+	{
+		assert(sgn(n) > 0 && n < p);
+		const mp_size_t limbs = mont->limbs();
+		ScratchArena::Frame frame(keyBits);
+		mp_limb_t* const in = frame.limbs(limbs);
+		mp_limb_t* const inverse = frame.limbs(limbs);
+		mp_limb_t* const scratch = frame.limbs(mpn_sec_invert_itch(limbs));
+		for (mp_size_t i = 0; i < limbs; i++)
+			in[i] = mpz_getlimbn(n.get_mpz_t(), i);
+		
+		const int invertible = mpn_sec_invert(inverse, in,
+				mont->modulusLimbs(), limbs, 2 * limbs * GMP_NUMB_BITS, scratch);
+		assert(invertible);
+		(void) invertible;
+		mpn_copyi(mpz_limbs_write(out.get_mpz_t(), limbs), inverse, limbs);
+		mpz_limbs_finish(out.get_mpz_t(), limbs);
+	}
+	
+	void Params::secretModInvBatch(mpz_class* const* out,
+			const mpz_class* const* ns, const size_t count) const
+	{
+		if (count == 0)
+			return;
+		
+		// Montgomery multiplies of plain residues scale each product by
+		// R^-1, but the trick only needs the last prefix's true inverse:
+		// with prefix[i] = prefix[i - 1] * n[i] / R,
+		//   n[i]^-1 = prefix[i]^-1 * prefix[i - 1] / R,
+		//   prefix[i - 1]^-1 = prefix[i]^-1 * n[i] / R.
+		const mp_size_t limbs = mont->limbs();
+		ScratchArena::Frame frame(keyBits);
+		mp_limb_t* const values = frame.limbs(count * limbs);
+		mp_limb_t* const prefixes = frame.limbs(count * limbs);
+		mp_limb_t* const inverse = frame.limbs(limbs);
+		mp_limb_t* const single = frame.limbs(limbs);
+		mp_limb_t* const scratch = frame.limbs(mont->scratchLimbs());
+		for (size_t i = 0; i < count; i++)
+		{
+			assert(sgn(*ns[i]) > 0 && *ns[i] < p);
+			mp_limb_t* const value = values + i * limbs;
+			for (mp_size_t j = 0; j < limbs; j++)
+				value[j] = mpz_getlimbn(ns[i]->get_mpz_t(), j);
+		}
+		
+		mpn_copyi(prefixes, values, limbs);
+		for (size_t i = 1; i < count; i++)
+			mont->mul(prefixes + i * limbs, prefixes + (i - 1) * limbs,
+					values + i * limbs, scratch);
+		
+		mpz_class& last = frame.mpz();
+		const mp_limb_t* const lastLimbs = prefixes + (count - 1) * limbs;
+		mpn_copyi(mpz_limbs_write(last.get_mpz_t(), limbs), lastLimbs, limbs);
+		mpz_limbs_finish(last.get_mpz_t(), limbs);
+		secretModInv(last, last);
+		for (mp_size_t j = 0; j < limbs; j++)
+			inverse[j] = mpz_getlimbn(last.get_mpz_t(), j);
+		
+		for (size_t i = count - 1; i > 0; i--)
+		{
+			mont->mul(single, inverse, prefixes + (i - 1) * limbs, scratch);
+			mont->mul(inverse, inverse, values + i * limbs, scratch);
+			mpn_copyi(mpz_limbs_write(out[i]->get_mpz_t(), limbs), single,
+					limbs);
+			mpz_limbs_finish(out[i]->get_mpz_t(), limbs);
+		}
+		mpn_copyi(mpz_limbs_write(out[0]->get_mpz_t(), limbs), inverse, limbs);
+		mpz_limbs_finish(out[0]->get_mpz_t(), limbs);
+	}
+	
+	void Params::modInv(mpz_class& out, const mpz_class& n) const
+	{
 #if NDEBUG
 		mpz_invert( out.get_mpz_t(), n.get_mpz_t(), p.get_mpz_t());
 #else
 		assert(0 != mpz_invert(out.get_mpz_t(), n.get_mpz_t(), p.get_mpz_t()));
 #endif
-		return out;
 	}
 	
-	KeyPair Params::makeKeys(gmp_randclass& rand) const
+	KeyPair Params::makeKeys(RandomSource& rand) const
 	{
-		// Secret in range [0, p-2].
-		mpz_class a = rand.get_z_range(p - 1);
+		mpz_class a;
+		randomExponent(a, rand);
 		
 		// A = g^a mod p
-		return std::make_pair(PrivateKey(std::move(a)), PublicKey(modExp(g, a)));
+		mpz_class A = modExpG(a);
+		return std::make_pair(PrivateKey(std::move(a)),
+				PublicKey(*this, std::move(A)));
 	}
 	
 	void Ciphertext::mult(const Params& params, const mpz_class& plainFactor)
@@ -115,8 +453,9 @@ namespace ElGamal {
 	
 	void Ciphertext::pow(const Params& params, const unsigned power)
 	{
-		B = params.modExp(B, power);
-		c = params.modExp(c, power);
+		// The power is a homomorphic scalar, not a secret.
+		params.modExp(B, B, power, publicExponent);
+		params.modExp(c, c, power, publicExponent);
 	}
 	
 	void Ciphertext::encryptPrecomputed(const Params& params,
@@ -135,21 +474,93 @@ namespace ElGamal {
 		return out << cipher.B.get_mpz_t() << ' ' << cipher.c.get_mpz_t();
 	}
 	
+	mpz_class PublicKey::modExpA(const Params& params,
+			const mpz_class& pow) const
+	{
+		mpz_class out;
+		modExpA(out, params, pow);
+		return out;
+	}
+	
+	void PublicKey::modExpA(mpz_class& out, const Params& params,
+			const mpz_class& pow) const
+	{
+		if (aTable && aTable->covers(pow))
+			aTable->modExp(out, pow);
+		else
+			params.modExp(out, A, pow);
+	}
+	
+	void PublicKey::modExpAMont(mp_limb_t* out, const Params& params,
+			const mpz_class& pow) const
+	{
+		if (aTable && aTable->covers(pow))
+			aTable->modExpMont(out, pow);
+		else
+		{
+			ScratchArena::Frame frame(params.keyBits);
+			mpz_class& power = frame.mpz();
+			params.modExp(power, A, pow);
+			params.mont->toMont(out, power,
+					frame.limbs(params.mont->scratchLimbs()));
+		}
+	}
+	
 	Ciphertext PublicKey::compute(const Params& params,
-			gmp_randclass& rand) const
+			RandomSource& rand) const
+	{
+		Ciphertext out;
+		compute(out, params, rand);
+		return out;
+	}
+	
+	void PublicKey::compute(Ciphertext& out, const Params& params,
+			RandomSource& rand) const
 	{
-		// Message secret in range [0, p-2].
-		mpz_class b = rand.get_z_range(params.p - 1);
+		Instrument::Timer timer(Instrument::ComputeNanos);
+		ScratchArena::Frame frame(params.keyBits);
+		mpz_class& b = frame.mpz();
+		params.randomExponent(b, rand);
 		
 		// B = g^b mod p
 		// c = msg * (A^b = g^(ab)) mod p
-		return Ciphertext(params.modExp(params.g, b), params.modExp(A, b));
+		params.modExpG(out.B, b);
+		modExpA(out.c, params, b);
+	}
+	
+	void PublicKey::compute(Ciphertext* out, const size_t count,
+			const Params& params, RandomSource& rand) const
+	{
+		vector<mpz_class> bs(count);
+		params.randomExponents(bs.data(), count, rand);
+		for (size_t i = 0; i < count; i++)
+		{
+			Instrument::Timer timer(Instrument::ComputeNanos);
+			params.modExpG(out[i].B, bs[i]);
+			modExpA(out[i].c, params, bs[i]);
+		}
 	}
 
 	Ciphertext PublicKey::encrypt(const Params& params,
-			const mpz_class& msg, gmp_randclass& rand) const
+			const mpz_class& msg, RandomSource& rand) const
+	{
+		Ciphertext out;
+		encrypt(out, params, msg, rand);
+		return out;
+	}
+	
+	void PublicKey::encrypt(Ciphertext& out, const Params& params,
+			const mpz_class& msg, RandomSource& rand) const
 	{
-		Ciphertext c = compute(params, rand);
+		compute(out, params, rand);
+		out.encryptPrecomputed(params, msg);
+	}
+	
+	Ciphertext PublicKey::encrypt(const Params& params, const mpz_class& msg,
+			PrecomputePool& pool, RandomSource& rand) const
+	{
+		assert(pool.key().A == A);
+		Ciphertext c = pool.take(rand);
 		c.encryptPrecomputed(params, msg);
 		return c;
 	}
@@ -157,8 +568,33 @@ namespace ElGamal {
 	mpz_class PrivateKey::decrypt(const Params& params,
 			const Ciphertext& cipher) const
 	{
-		// msg = (c / (g^ab) = c * g^(-ab) = c * B^-a) mod p
-		return (cipher.c * params.modExp(cipher.B, -a)) % params.p;
+		mpz_class out;
+		decrypt(out, params, cipher);
+		return out;
+	}
+	
+	void PrivateKey::decrypt(mpz_class& out, const Params& params,
+			const Ciphertext& cipher) const
+	{
+		Instrument::Timer timer(Instrument::DecryptNanos);
+		// msg = (c / (g^ab) = c * g^(-ab) = c * B^-a) mod p.  With full
+		// length secrets B^-a is taken as B^(order - a), which needs no
+		// inverse; with short ones that exponent would be full length, so
+		// B^a is inverted instead.
+		if (params.shortExponents())
+		{
+			params.modExp(out, cipher.B, a, secretExponent);
+			params.secretModInv(out, out);
+		}
+		else
+		{
+			ScratchArena::Frame frame(params.keyBits);
+			mpz_class& pow = frame.mpz();
+			mpz_sub(pow.get_mpz_t(), params.order.get_mpz_t(), a.get_mpz_t());
+			params.modExp(out, cipher.B, pow, secretExponent);
+		}
+		mpz_mul(out.get_mpz_t(), out.get_mpz_t(), cipher.c.get_mpz_t());
+		mpz_mod(out.get_mpz_t(), out.get_mpz_t(), params.p.get_mpz_t());
 	}
 	
 }
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "ElGamal.h"
+#include "Instrument.h"
+#include "Random.h"
+
+namespace ElGamal
+{
+	
+	// Batched exponentiations split into tasks by whole kernel batches, so
+	// no task is left a partial one it could have shared.
+	static size_t laneGroups(const size_t count)
+	{
+		return (count + MultiBufferExp::lanes - 1) / MultiBufferExp::lanes;
+	}
+	
+	static size_t laneBegin(const size_t task, const size_t tasks,
+			const size_t count)
+	{
+		return std::min(count, MultiBufferExp::lanes
+				* ThreadPool::taskBegin(task, tasks, laneGroups(count)));
+	}
+	
+	vector<Ciphertext> PublicKey::encryptBatch(const Params& params,
+			const vector<mpz_class>& msgs, RandomSource& rand,
+			ThreadPool& pool) const
+	{
+		Instrument::Span span("encryptBatch");
+		// A RandomSource is not thread-safe, so each task draws from its own
+		// ChaCha20 stream, which is cheap to key.  Streams are keyed up front
+		// so the output depends only on rand, not on scheduling.
+		const size_t tasks = pool.tasksFor(msgs.size());
+		vector<ChaCha20Random> streams;
+		streams.reserve(tasks);
+		for (size_t i = 0; i < tasks; i++)
+			streams.push_back(ChaCha20Random::derive(rand));
+		
+		vector<Ciphertext> ciphers(msgs.size());
+		pool.run(tasks, [&](const size_t task)
+		{
+			const size_t begin = ThreadPool::taskBegin(task, tasks, msgs.size());
+			const size_t end = ThreadPool::taskBegin(task + 1, tasks, msgs.size());
+			compute(&ciphers[begin], end - begin, params, streams[task]);
+			for (size_t i = begin; i < end; i++)
+				ciphers[i].encryptPrecomputed(params, msgs[i]);
+		});
+		return ciphers;
+	}
+	
+	vector<mpz_class> PrivateKey::decryptBatch(const Params& params,
+			const vector<Ciphertext>& ciphers, ThreadPool& pool) const
+	{
+		Instrument::Span span("decryptBatch");
+		// As decrypt, with each task's exponentiations in one batch and, for
+		// short exponents, its inverses sharing one inversion.
+		const bool invert = params.shortExponents();
+		const mpz_class pow = invert ? a : params.order - a;
+		vector<mpz_class> msgs(ciphers.size());
+		const size_t tasks = pool.tasksFor(laneGroups(ciphers.size()));
+		pool.run(tasks, [&](const size_t task)
+		{
+			const size_t begin = laneBegin(task, tasks, ciphers.size());
+			const size_t end = laneBegin(task + 1, tasks, ciphers.size());
+			vector<mpz_class*> outs;
+			vector<const mpz_class*> bases;
+			for (size_t i = begin; i < end; i++)
+			{
+				outs.push_back(&msgs[i]);
+				bases.push_back(&ciphers[i].B);
+			}
+			const vector<const mpz_class*> pows(end - begin, &pow);
+			params.modExpBatch(outs.data(), bases.data(), pows.data(),
+					end - begin, secretExponent);
+			if (invert)
+				params.secretModInvBatch(outs.data(), outs.data(),
+						end - begin);
+			
+			for (size_t i = begin; i < end; i++)
+			{
+				mpz_mul(msgs[i].get_mpz_t(), msgs[i].get_mpz_t(),
+						ciphers[i].c.get_mpz_t());
+				mpz_mod(msgs[i].get_mpz_t(), msgs[i].get_mpz_t(),
+						params.p.get_mpz_t());
+			}
+		});
+		return msgs;
+	}
+	
+	vector<DecryptShare> Keyshare::decryptShareBatch(const Params& params,
+			const vector<Ciphertext>& ciphers, ThreadPool& pool) const
+	{
+		Instrument::Span span("decryptShareBatch");
+		vector<DecryptShare> shares(ciphers.size());
+		const size_t tasks = pool.tasksFor(laneGroups(ciphers.size()));
+		pool.run(tasks, [&](const size_t task)
+		{
+			const size_t begin = laneBegin(task, tasks, ciphers.size());
+			const size_t end = laneBegin(task + 1, tasks, ciphers.size());
+			vector<mpz_class*> outs;
+			vector<const mpz_class*> bases;
+			for (size_t i = begin; i < end; i++)
+			{
+				shares[i].x = x;
+				outs.push_back(&shares[i].share);
+				bases.push_back(&ciphers[i].B);
+			}
+			const vector<const mpz_class*> pows(end - begin, &y);
+			params.modExpBatch(outs.data(), bases.data(), pows.data(),
+					end - begin, secretExponent);
+		});
+		return shares;
+	}
+	
+	vector<DecryptShare> Keyshare::decryptShareBatch(const Params& params,
+			const vector<Ciphertext>& ciphers, vector<ShareProof>& proofs,
+			RandomSource& rand, ThreadPool& pool) const
+	{
+		Instrument::Span span("decryptShareBatch_proved");
+		// As decryptShareBatch, with each task's commitments in two more
+		// batches and its nonces from its own stream, as in encryptBatch.
+		const mpz_class key = verificationKey(params);
+		const size_t tasks = pool.tasksFor(laneGroups(ciphers.size()));
+		vector<ChaCha20Random> streams;
+		streams.reserve(tasks);
+		for (size_t i = 0; i < tasks; i++)
+			streams.push_back(ChaCha20Random::derive(rand));
+		
+		vector<DecryptShare> shares(ciphers.size());
+		proofs.assign(ciphers.size(), ShareProof());
+		pool.run(tasks, [&](const size_t task)
+		{
+			const size_t begin = laneBegin(task, tasks, ciphers.size());
+			const size_t end = laneBegin(task + 1, tasks, ciphers.size());
+			vector<mpz_class> rs(end - begin);
+			streams[task].uniform(rs.data(), rs.size(), params.order);
+			vector<mpz_class*> outs, t1s, t2s;
+			vector<const mpz_class*> bases, gs, rPows;
+			for (size_t i = begin; i < end; i++)
+			{
+				shares[i].x = x;
+				outs.push_back(&shares[i].share);
+				t1s.push_back(&proofs[i].t1);
+				t2s.push_back(&proofs[i].t2);
+				bases.push_back(&ciphers[i].B);
+				gs.push_back(&params.g);
+				rPows.push_back(&rs[i - begin]);
+			}
+			// Kept apart from the nonces, which are full length, so that
+			// short keyshares still get short exponentiations.
+			const vector<const mpz_class*> ys(end - begin, &y);
+			params.modExpBatch(outs.data(), bases.data(), ys.data(),
+					end - begin, secretExponent);
+			params.modExpBatch(t1s.data(), gs.data(), rPows.data(),
+					end - begin, secretExponent);
+			params.modExpBatch(t2s.data(), bases.data(), rPows.data(),
+					end - begin, secretExponent);
+			for (size_t i = begin; i < end; i++)
+				proofs[i].respond(params, key, ciphers[i], shares[i].share, y,
+						rs[i - begin]);
+		});
+		return shares;
+	}
+	
+}
@@ -1,5 +1,6 @@
 #include <cassert>
 #include "ElGamal.h"
+#include "Instrument.h"
 
 // DEBUG
 #include <iostream>
@@ -8,20 +9,18 @@ using std::cout;
 namespace ElGamal
 {
 
-	vector<Keyshare> PrivateKey::generateShares(const Params& params,
-			const unsigned threshold, const unsigned numShares,
-			gmp_randclass& rand) const
+	vector<mpz_class> shamirShares(const mpz_class& secret,
+			const mpz_class& order, const unsigned threshold,
+			const unsigned numShares, RandomSource& rand)
 	{
-		vector<mpz_class> coeffs;
-		coeffs.reserve(threshold - 1);
-		for (unsigned pow = 1; pow < threshold; pow++)
-			coeffs.emplace_back(rand.get_z_range(params.p));
+		vector<mpz_class> coeffs(threshold - 1);
+		rand.uniform(coeffs.data(), coeffs.size(), order);
 		
-		vector<Keyshare> shares;
-		coeffs.reserve(numShares);
+		vector<mpz_class> ys;
+		ys.reserve(numShares);
 		for (unsigned x = 1; x <= numShares; x++)
 		{
-			mpz_class y = a;
+			mpz_class y = secret;
 			// DEBUG
 //			cout << "x^0 * " << y.get_str() << " = " << y.get_str() << '\n';
 			for (unsigned pow = 1, xPow = x;
@@ -35,8 +34,23 @@ namespace ElGamal
 //								<< ") = " << y.get_str() << '\n';
 					}
 				
-			shares.emplace_back(Keyshare(x, y % params.p));
+			// Shares live in the exponent, so they are reduced mod the
+			// group order, not mod p.
+			ys.emplace_back(y % order);
 		}
+		return ys;
+	}
+	
+	vector<Keyshare> PrivateKey::generateShares(const Params& params,
+			const unsigned threshold, const unsigned numShares,
+			RandomSource& rand) const
+	{
+		vector<mpz_class> ys = shamirShares(a, params.order, threshold,
+				numShares, rand);
+		vector<Keyshare> shares;
+		shares.reserve(numShares);
+		for (unsigned x = 1; x <= numShares; x++)
+			shares.emplace_back(Keyshare(x, move(ys[x - 1])));
 		return shares;
 	}
 	
@@ -53,14 +67,24 @@ namespace ElGamal
 	DecryptShare Keyshare::decryptShare(const Params& params,
 			const Ciphertext& cipher) const
 	{
-		return DecryptShare(x, params.modExp(cipher.B, y));
+		DecryptShare out;
+		decryptShare(out, params, cipher);
+		return out;
+	}
+	
+	void Keyshare::decryptShare(DecryptShare& out, const Params& params,
+			const Ciphertext& cipher) const
+	{
+		Instrument::Timer timer(Instrument::DecryptShareNanos);
+		out.x = x;
+		params.modExp(out.share, cipher.B, y, secretExponent);
 	}
 	
 	mpz_class DecryptShare::lagrangeFactor(const Params& params,
 			const vector<DecryptShare>& shares) const
 	{
 		mpq_class product(1);
-		for (auto share : shares)
+		for (const auto& share : shares)
 		{
 			if (x == share.x)
 				continue;
@@ -72,17 +96,90 @@ namespace ElGamal
 		return product.get_num();
 	}
 	
-	mpz_class Ciphertext::decryptWith(const Params& params,
-			const vector<DecryptShare>& shares) const
+	vector<mpz_class> negatedLagrangeCoeffs(const mpz_class& order,
+			const vector<unsigned>& xs)
 	{
-		// g^ab, calculated as the product of keyshares ^ Lagrange factor.
-		mpz_class AB(1);
-		for (auto share : shares)
+		// lambda_i = prod_{j != i} x_j / (x_j - x_i), reduced mod the order.
+		// The quotient is exact for most subsets; otherwise the denominator
+		// must be invertible mod the order.
+		vector<mpz_class> coeffs;
+		coeffs.reserve(xs.size());
+		for (const unsigned xi : xs)
 		{
-			AB *= params.modExp(share.share,
-					share.lagrangeFactor(params, shares));
+			mpz_class num(1), den(1);
+			for (const unsigned xj : xs)
+			{
+				if (xj == xi)
+					continue;
+				num *= xj;
+				den *= static_cast<long>(xj) - static_cast<long>(xi);
+			}
+			
+			mpz_class lambda;
+			if (mpz_divisible_p(num.get_mpz_t(), den.get_mpz_t()))
+				mpz_divexact(lambda.get_mpz_t(), num.get_mpz_t(), den.get_mpz_t());
+			else
+			{
+				mpz_class denInv;
+				const int invertible = mpz_invert(denInv.get_mpz_t(),
+						den.get_mpz_t(), order.get_mpz_t());
+				assert(invertible);
+				(void) invertible;
+				lambda = num * denInv;
+			}
+			
+			mpz_class negated = -lambda;
+			mpz_mod(negated.get_mpz_t(), negated.get_mpz_t(),
+					order.get_mpz_t());
+			coeffs.push_back(move(negated));
 		}
-		return (c * params.modInv(AB)) % params.p;
+		
+		return coeffs;
+	}
+	
+	shared_ptr<const vector<mpz_class>> LagrangeCache::negatedCoeffs(
+			const Params& params, const vector<DecryptShare>& shares)
+	{
+		// Reused, so that cache hits allocate nothing.
+		static thread_local vector<unsigned> xs;
+		xs.clear();
+		for (const auto& share : shares)
+			xs.push_back(share.x);
+		
+		std::lock_guard<std::mutex> lock(mut);
+		const auto found = cache.find(xs);
+		if (found != cache.end())
+			return found->second;
+		
+		auto coeffs = std::make_shared<const vector<mpz_class>>(
+				negatedLagrangeCoeffs(params.order, xs));
+		cache.emplace(xs, coeffs);
+		return coeffs;
+	}
+	
+	mpz_class Ciphertext::decryptWith(const Params& params,
+			const vector<DecryptShare>& shares) const
+	{
+		mpz_class out;
+		decryptWith(out, params, shares);
+		return out;
+	}
+	
+	void Ciphertext::decryptWith(mpz_class& out, const Params& params,
+			const vector<DecryptShare>& shares) const
+	{
+		Instrument::Timer timer(Instrument::DecryptWithNanos);
+		// (g^ab)^-1, calculated as the product of keyshares ^ -(Lagrange
+		// factor), so that the message falls out of a single multiply.
+		const auto coeffs = params.lagrange->negatedCoeffs(params, shares);
+		static thread_local vector<const mpz_class*> bases;
+		bases.clear();
+		for (const auto& share : shares)
+			bases.push_back(&share.share);
+		
+		params.multiExp(out, bases, *coeffs);
+		mpz_mul(out.get_mpz_t(), out.get_mpz_t(), c.get_mpz_t());
+		mpz_mod(out.get_mpz_t(), out.get_mpz_t(), params.p.get_mpz_t());
 	}
 
 }
\ No newline at end of file
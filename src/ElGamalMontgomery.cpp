@@ -0,0 +1,75 @@
+#include <cassert>
+#include "ElGamal.h"
+
+namespace ElGamal {
+	
+	MontgomeryCiphertext::MontgomeryCiphertext(const Params& params,
+			const Ciphertext& cipher) : limbs(params.mont->limbs()),
+			data(2 * limbs + params.mont->powScratchLimbs())
+	{
+		params.mont->toMont(B(), cipher.B, scratch());
+		params.mont->toMont(c(), cipher.c, scratch());
+	}
+	
+	void MontgomeryCiphertext::mult(const Params& params,
+			const mpz_class& plainFactor)
+	{
+		// Converting in costs one multiply, so do it in place of c's.
+		mp_limb_t* factor = scratch() + params.mont->scratchLimbs();
+		if (sgn(plainFactor) >= 0 && plainFactor < params.p)
+			params.mont->toMont(factor, plainFactor, scratch());
+		else
+			params.mont->toMont(factor, mpz_class(plainFactor % params.p
+					+ params.p) % params.p, scratch());
+		params.mont->mul(c(), c(), factor, scratch());
+	}
+	
+	void MontgomeryCiphertext::mult(const Params& params,
+			const MontgomeryCiphertext& cipherFactor)
+	{
+		assert(cipherFactor.limbs == limbs);
+		params.mont->mul(B(), B(), cipherFactor.data.data(), scratch());
+		params.mont->mul(c(), c(), cipherFactor.data.data() + limbs, scratch());
+	}
+	
+	void MontgomeryCiphertext::pow(const Params& params, const mpz_class& power,
+			SecretExponent)
+	{
+		assert(power < params.order);
+		const size_t bits = mpz_sizeinbase(params.order.get_mpz_t(), 2);
+		params.mont->secretPow(B(), B(), power, bits, scratch());
+		params.mont->secretPow(c(), c(), power, bits, scratch());
+	}
+	
+	void MontgomeryCiphertext::pow(const Params& params, const mpz_class& power,
+			PublicExponent)
+	{
+		params.mont->pow(B(), B(), power, scratch());
+		params.mont->pow(c(), c(), power, scratch());
+	}
+	
+	void MontgomeryCiphertext::rerandomize(const Params& params,
+			const PublicKey& key, RandomSource& rand)
+	{
+		// (g^r, A^r), as in PublicKey::compute.
+		ScratchArena::Frame frame(params.keyBits);
+		mpz_class& r = frame.mpz();
+		params.randomExponent(r, rand);
+		mp_limb_t* factor = scratch() + params.mont->scratchLimbs();
+		
+		params.modExpGMont(factor, r);
+		params.mont->mul(B(), B(), factor, scratch());
+		key.modExpAMont(factor, params, r);
+		params.mont->mul(c(), c(), factor, scratch());
+	}
+	
+	Ciphertext MontgomeryCiphertext::toCiphertext(const Params& params) const
+	{
+		vector<mp_limb_t> scratch(params.mont->scratchLimbs());
+		Ciphertext out;
+		params.mont->fromMont(out.B, data.data(), scratch.data());
+		params.mont->fromMont(out.c, data.data() + limbs, scratch.data());
+		return out;
+	}
+	
+}
@@ -0,0 +1,175 @@
+#include <map>
+#include "ElGamal.h"
+#include "Sha256.h"
+
+namespace ElGamal
+{
+	
+	// Challenges and batch weights are this long; a false proof passes
+	// either check with probability about 2^-128.
+	static const unsigned challengeBits = 128;
+	
+	// Proofs are only sound in the order-q subgroup of a safe prime.
+	static bool primeOrder(const Params& params)
+	{
+		return params.order * 2 + 1 == params.p;
+	}
+	
+	// x in (0, p) is in the order-q subgroup iff it is a square mod p.
+	static bool inGroup(const Params& params, const mpz_class& x)
+	{
+		return sgn(x) > 0 && x < params.p
+				&& mpz_legendre(x.get_mpz_t(), params.p.get_mpz_t()) == 1;
+	}
+	
+	static void hashElement(Sha256& hash, const Params& params,
+			const mpz_class& x)
+	{
+		// Fixed width, so the encoding of the statement is unambiguous.
+		const size_t width = (mpz_sizeinbase(params.p.get_mpz_t(), 2) + 7) / 8;
+		const size_t bytes = (mpz_sizeinbase(x.get_mpz_t(), 2) + 7) / 8;
+		vector<uint8_t> out(width);
+		if (sgn(x) != 0)
+			mpz_export(&out[width - bytes], nullptr, 1, 1, 1, 0, x.get_mpz_t());
+		hash.update(out.data(), out.size());
+	}
+	
+	static mpz_class challenge(const Params& params, const mpz_class& key,
+			const Ciphertext& cipher, const mpz_class& share,
+			const mpz_class& t1, const mpz_class& t2)
+	{
+		static const char tag[] = "ElGamal decryption share proof";
+		Sha256 hash;
+		hash.update(tag, sizeof tag);
+		for (const mpz_class* x : { &params.p, &params.g, &key, &cipher.B,
+				&share, &t1, &t2 })
+			hashElement(hash, params, *x);
+		uint8_t digest[Sha256::digestBytes];
+		hash.final(digest);
+		mpz_class out;
+		mpz_import(out.get_mpz_t(), challengeBits / 8, 1, 1, 1, 0, digest);
+		return out;
+	}
+	
+	// Everything but the proof's equations.
+	static bool wellFormed(const Params& params, const mpz_class& key,
+			const Ciphertext& cipher, const DecryptShare& share,
+			const ShareProof& proof)
+	{
+		return inGroup(params, key) && inGroup(params, cipher.B)
+				&& inGroup(params, share.share) && inGroup(params, proof.t1)
+				&& inGroup(params, proof.t2) && sgn(proof.s) >= 0
+				&& proof.s < params.order;
+	}
+	
+	istream& operator>>(istream& in, ShareProof& proof)
+	{
+		return in >> proof.t1.get_mpz_t() >> proof.t2.get_mpz_t()
+				>> proof.s.get_mpz_t();
+	}
+	
+	ostream& operator<<(ostream& out, const ShareProof& proof)
+	{
+		return out << proof.t1.get_mpz_t() << ' ' << proof.t2.get_mpz_t()
+				<< ' ' << proof.s.get_mpz_t();
+	}
+	
+	bool ShareProof::verify(const Params& params, const mpz_class& key,
+			const Ciphertext& cipher, const DecryptShare& share) const
+	{
+		if (!primeOrder(params)
+				|| !wellFormed(params, key, cipher, share, *this))
+			return false;
+	
+		// g^s key^-c == t1 and B^s share^-c == t2, with x^-c = x^(q - c)
+		// for x in the subgroup.
+		const mpz_class c = challenge(params, key, cipher, share.share, t1, t2);
+		const vector<mpz_class> pows = { s, params.order - c };
+		mpz_class check;
+		params.multiExp(check, { &params.g, &key }, pows);
+		if (check != t1)
+			return false;
+		params.multiExp(check, { &cipher.B, &share.share }, pows);
+		return check == t2;
+	}
+	
+	bool verifyShareProofs(const Params& params,
+			const vector<ShareClaim>& claims, RandomSource& rand)
+	{
+		if (!primeOrder(params))
+			return false;
+	
+		// With random weights a_i and b_i, every proof holds only if
+		//   prod t1_i^a_i key_i^(a_i c_i) g^-(a_i s_i)
+		//       t2_i^b_i share_i^(b_i c_i) B_i^-(b_i s_i) == 1,
+		// except with probability about 2^-128.  That needs every element
+		// in the prime-order subgroup, which wellFormed checks.  Powers of
+		// g, of each key and of each B are summed mod q, so each distinct
+		// one costs one full-length base; the rest have short exponents,
+		// which the shared chain of squarings makes cheap.
+		std::map<mpz_class, mpz_class> merged;
+		vector<const mpz_class*> bases;
+		vector<mpz_class> pows;
+		bases.reserve(3 * claims.size());
+		pows.reserve(3 * claims.size());
+		mpz_class& gPow = merged[params.g];
+		for (const ShareClaim& claim : claims)
+		{
+			const ShareProof& proof = *claim.proof;
+			if (!wellFormed(params, *claim.key, *claim.cipher, *claim.share,
+					proof))
+				return false;
+	
+			const mpz_class c = challenge(params, *claim.key, *claim.cipher,
+					claim.share->share, proof.t1, proof.t2);
+			mpz_class a = rand.bits(challengeBits);
+			mpz_class b = rand.bits(challengeBits);
+			merged[*claim.key] += a * c;
+			gPow -= a * proof.s;
+			merged[claim.cipher->B] -= b * proof.s;
+			bases.push_back(&claim.share->share);
+			pows.push_back(b * c);
+			bases.push_back(&proof.t1);
+			pows.push_back(move(a));
+			bases.push_back(&proof.t2);
+			pows.push_back(move(b));
+		}
+	
+		for (auto& base : merged)
+		{
+			mpz_mod(base.second.get_mpz_t(), base.second.get_mpz_t(),
+					params.order.get_mpz_t());
+			bases.push_back(&base.first);
+			pows.push_back(base.second);
+		}
+		mpz_class product;
+		params.multiExp(product, bases, pows);
+		return product == 1;
+	}
+	
+	void ShareProof::respond(const Params& params, const mpz_class& key,
+			const Ciphertext& cipher, const mpz_class& share,
+			const mpz_class& y, const mpz_class& r)
+	{
+		const mpz_class c = challenge(params, key, cipher, share, t1, t2);
+		s = r + c * y;
+		mpz_mod(s.get_mpz_t(), s.get_mpz_t(), params.order.get_mpz_t());
+	}
+	
+	mpz_class Keyshare::verificationKey(const Params& params) const
+	{
+		return params.modExpG(y);
+	}
+	
+	void Keyshare::decryptShare(DecryptShare& out, ShareProof& proof,
+			const Params& params, const Ciphertext& cipher,
+			RandomSource& rand) const
+	{
+		decryptShare(out, params, cipher);
+		const mpz_class r = rand.uniform(params.order);
+		params.modExpG(proof.t1, r);
+		params.modExp(proof.t2, cipher.B, r, secretExponent);
+		proof.respond(params, verificationKey(params), cipher, out.share, y, r);
+	}
+	
+}
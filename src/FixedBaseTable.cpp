@@ -0,0 +1,147 @@
+#include <cassert>
+#include "FixedBaseTable.h"
+
+namespace ElGamal {
+	
+	FixedBaseTable::FixedBaseTable(shared_ptr<const MontgomeryContext> _mont,
+			const mpz_class& base, const unsigned expBits,
+			const unsigned _windowBits) :
+			mont(std::move(_mont)), windowBits(_windowBits),
+			windows((expBits + _windowBits - 1) / _windowBits)
+	{
+		assert(windowBits > 0 && windowBits < 16);
+		const mp_size_t limbs = mont->limbs();
+		const size_t entries = size_t(1) << windowBits;
+		auto owned = std::make_shared<vector<mp_limb_t>>(
+				tableLimbs(*mont, expBits, windowBits));
+		vector<mp_limb_t> cur(limbs), scratch(mont->scratchLimbs());
+		
+		// cur = base^(2^(w*i)) for the current window i.
+		mont->toMont(cur.data(), base % mont->modulus(), scratch.data());
+		for (unsigned i = 0; i < windows; i++)
+		{
+			mp_limb_t* window = &(*owned)[i * entries * limbs];
+			mpn_copyi(window, mont->one(), limbs);
+			for (size_t d = 1; d < entries; d++)
+				mont->mul(window + d * limbs, window + (d - 1) * limbs,
+						cur.data(), scratch.data());
+			for (unsigned s = 0; s < windowBits; s++)
+				mont->sqr(cur.data(), cur.data(), scratch.data());
+		}
+		table = owned->data();
+		storage = std::move(owned);
+	}
+	
+	FixedBaseTable::FixedBaseTable(shared_ptr<const MontgomeryContext> _mont,
+			const unsigned expBits, const unsigned _windowBits,
+			const mp_limb_t* const _table, shared_ptr<const void> _storage) :
+			mont(std::move(_mont)), windowBits(_windowBits),
+			windows((expBits + _windowBits - 1) / _windowBits),
+			table(_table), storage(std::move(_storage))
+	{
+		assert(windowBits > 0 && windowBits < 16);
+	}
+	
+	size_t FixedBaseTable::tableLimbs(const MontgomeryContext& mont,
+			const unsigned expBits, const unsigned windowBits)
+	{
+		const size_t windows = (expBits + windowBits - 1) / windowBits;
+		return (windows << windowBits) * mont.limbs();
+	}
+	
+	bool FixedBaseTable::covers(const mpz_class& pow) const
+	{
+		return sgn(pow) >= 0
+				&& mpz_sizeinbase(pow.get_mpz_t(), 2) <= expBits();
+	}
+	
+	void FixedBaseTable::windowProduct(mp_limb_t* out, const mpz_class& pow,
+			const bool secret) const
+	{
+		assert(covers(pow));
+		const mp_size_t limbs = mont->limbs();
+		const size_t entries = size_t(1) << windowBits;
+		const mp_limb_t digitMask = (mp_limb_t(1) << windowBits) - 1;
+		
+		ScratchArena::Frame frame(limbs * GMP_NUMB_BITS);
+		mp_limb_t* const product = frame.limbs(mont->scratchLimbs());
+		mpn_copyi(out, mont->one(), limbs);
+		mp_limb_t* const entry = secret ? frame.limbs(limbs) : nullptr;
+		mp_limb_t* const scratch = secret
+				? frame.limbs(mpn_sec_mul_itch(limbs, limbs)) : nullptr;
+		
+		for (unsigned i = 0; i < windows; i++)
+		{
+			// The window may straddle a limb boundary.
+			const unsigned bit = i * windowBits;
+			const mp_size_t limb = bit / GMP_NUMB_BITS;
+			const unsigned shift = bit % GMP_NUMB_BITS;
+			mp_limb_t digit = mpz_getlimbn(pow.get_mpz_t(), limb) >> shift;
+			if (shift + windowBits > GMP_NUMB_BITS)
+				digit |= mpz_getlimbn(pow.get_mpz_t(), limb + 1)
+						<< (GMP_NUMB_BITS - shift);
+			digit &= digitMask;
+			
+			const mp_limb_t* window = table + i * entries * limbs;
+			if (secret)
+			{
+				// Touch every entry of the window and multiply even by the
+				// identity, so neither memory access nor timing depends on
+				// pow.
+				mpn_sec_tabselect(entry, window, limbs, entries, digit);
+				mpn_sec_mul(product, out, limbs, entry, limbs, scratch);
+				mont->redc(out, product);
+			}
+			else if (digit != 0)
+				mont->mul(out, out, window + digit * limbs, product);
+		}
+	}
+	
+	void FixedBaseTable::modExpMont(mp_limb_t* out, const mpz_class& pow,
+			SecretExponent) const
+	{
+		windowProduct(out, pow, true);
+	}
+	
+	void FixedBaseTable::modExpMont(mp_limb_t* out, const mpz_class& pow,
+			PublicExponent) const
+	{
+		windowProduct(out, pow, false);
+	}
+	
+	void FixedBaseTable::modExp(mpz_class& out, const mpz_class& pow,
+			const bool secret) const
+	{
+		ScratchArena::Frame frame(mont->limbs() * GMP_NUMB_BITS);
+		mp_limb_t* const acc = frame.limbs(mont->limbs());
+		windowProduct(acc, pow, secret);
+		mont->fromMont(out, acc, frame.limbs(mont->scratchLimbs()));
+	}
+	
+	mpz_class FixedBaseTable::modExp(const mpz_class& pow, SecretExponent) const
+	{
+		mpz_class out;
+		modExp(out, pow, true);
+		return out;
+	}
+	
+	mpz_class FixedBaseTable::modExp(const mpz_class& pow, PublicExponent) const
+	{
+		mpz_class out;
+		modExp(out, pow, false);
+		return out;
+	}
+	
+	void FixedBaseTable::modExp(mpz_class& out, const mpz_class& pow,
+			SecretExponent) const
+	{
+		modExp(out, pow, true);
+	}
+	
+	void FixedBaseTable::modExp(mpz_class& out, const mpz_class& pow,
+			PublicExponent) const
+	{
+		modExp(out, pow, false);
+	}
+	
+}
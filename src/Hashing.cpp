@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include "Bytes.h"
+#include "Hashing.h"
+
+using Bytes::getWord;
+using Bytes::putWord;
+using std::function;
+
+namespace SetIntersection
+{
+
+	static const unsigned maxKicks = 512;
+	static const size_t minBins = 16;
+
+	static uint64_t rotate(const uint64_t x, const unsigned bits)
+	{
+		return (x << bits) | (x >> (64 - bits));
+	}
+
+	static void sipRound(uint64_t* v)
+	{
+		v[0] += v[1];
+		v[1] = rotate(v[1], 13);
+		v[1] ^= v[0];
+		v[0] = rotate(v[0], 32);
+		v[2] += v[3];
+		v[3] = rotate(v[3], 16);
+		v[3] ^= v[2];
+		v[0] += v[3];
+		v[3] = rotate(v[3], 21);
+		v[3] ^= v[0];
+		v[2] += v[1];
+		v[1] = rotate(v[1], 17);
+		v[1] ^= v[2];
+		v[2] = rotate(v[2], 32);
+	}
+
+	static void sipCompress(uint64_t* v, const uint64_t m)
+	{
+		v[3] ^= m;
+		sipRound(v);
+		sipRound(v);
+		v[0] ^= m;
+	}
+
+	static uint64_t sipFinish(uint64_t* v)
+	{
+		for (unsigned i = 0; i < 4; i++)
+			sipRound(v);
+		return v[0] ^ v[1] ^ v[2] ^ v[3];
+	}
+
+	void sipHash128(const HashKey& key, const void* data, const size_t bytes,
+			uint64_t* out)
+	{
+		const uint8_t* in = static_cast<const uint8_t*>(data);
+		uint64_t v[4] = {
+			key[0] ^ 0x736f6d6570736575ull,
+			key[1] ^ 0x646f72616e646f6dull ^ 0xee,
+			key[0] ^ 0x6c7967656e657261ull,
+			key[1] ^ 0x7465646279746573ull
+		};
+		const size_t whole = bytes / 8 * 8;
+		for (size_t i = 0; i < whole; i += 8)
+			sipCompress(v, getWord(in + i));
+		sipCompress(v, getWord(in + whole, bytes - whole)
+				| uint64_t(bytes) << 56);
+		v[2] ^= 0xee;
+		out[0] = sipFinish(v);
+		v[1] ^= 0xdd;
+		out[1] = sipFinish(v);
+	}
+
+	HashLayout::HashLayout(const size_t elements, const HashOptions& options,
+			RandomSource& rand) :
+			bins(std::max<size_t>(std::ceil(elements * options.binsPerElement),
+					minBins)),
+			partitions(std::max<size_t>(bins / options.partitionBins, 1)),
+			hashCount(options.hashCount),
+			stashSize(options.stashSize)
+	{
+		assert(hashCount >= 1 && hashCount <= maxHashCount);
+		assert(stashSize <= maxStashSize);
+		rekey(rand);
+	}
+
+	void HashLayout::rekey(RandomSource& rand)
+	{
+		key[0] = rand.word();
+		key[1] = rand.word();
+	}
+
+	void HashLayout::write(uint8_t* out) const
+	{
+		putWord(out, key[0]);
+		putWord(out + 8, key[1]);
+		putWord(out + 16, bins);
+		putWord(out + 24, partitions);
+		out[32] = hashCount;
+		out[33] = stashSize;
+	}
+
+	bool HashLayout::read(const uint8_t* in)
+	{
+		key[0] = getWord(in);
+		key[1] = getWord(in + 8);
+		bins = getWord(in + 16);
+		partitions = getWord(in + 24);
+		hashCount = in[32];
+		stashSize = in[33];
+		return bins > 0 && partitions > 0 && partitions <= bins
+				&& hashCount >= 1 && hashCount <= maxHashCount
+				&& stashSize <= maxStashSize;
+	}
+
+	void HashLayout::hash(const vector<string>& set,
+			vector<ElementHash>& hashes, ThreadPool* pool) const
+	{
+		hashes.resize(set.size());
+		ThreadPool::parallelFor(pool, set.size(), [&](const size_t begin,
+					const size_t end)
+		{
+			uint64_t out[2];
+			for (size_t i = begin; i < end; i++)
+			{
+				sipHash128(key, set[i].data(), set[i].size(), out);
+				hashes[i] = { out[0], out[1] };
+			}
+		});
+	}
+
+	size_t BinLists::maxLoad() const
+	{
+		size_t load = 0;
+		for (size_t bin = 0; bin < bins(); bin++)
+			load = std::max(load, size(bin));
+		return load;
+	}
+
+	// Element indices sorted by partition, stably: partition p's are
+	// order[first[p], first[p + 1]).  Each task counts its own slice of
+	// the elements, then scatters it behind the slices before it.
+	static void groupByPartition(const HashLayout& layout,
+			const vector<ElementHash>& hashes, vector<size_t>& first,
+			vector<uint64_t>& order, ThreadPool* pool)
+	{
+		const size_t tasks = pool == nullptr ? 1 : pool->tasksFor(hashes.size());
+		vector<size_t> counts(tasks * layout.partitions, 0);
+		auto forTasks = [&](const function<void(size_t, size_t, size_t)>& body)
+		{
+			auto task = [&](const size_t t)
+			{
+				body(t, ThreadPool::taskBegin(t, tasks, hashes.size()),
+						ThreadPool::taskBegin(t + 1, tasks, hashes.size()));
+			};
+			if (pool == nullptr)
+				task(0);
+			else
+				pool->run(tasks, task);
+		};
+
+		forTasks([&](const size_t t, const size_t begin, const size_t end)
+		{
+			size_t* count = &counts[t * layout.partitions];
+			for (size_t i = begin; i < end; i++)
+				count[layout.partitionOf(hashes[i])]++;
+		});
+		first.assign(layout.partitions + 1, 0);
+		size_t total = 0;
+		for (size_t p = 0; p < layout.partitions; p++)
+		{
+			first[p] = total;
+			for (size_t t = 0; t < tasks; t++)
+			{
+				const size_t count = counts[t * layout.partitions + p];
+				counts[t * layout.partitions + p] = total;
+				total += count;
+			}
+		}
+		first[layout.partitions] = total;
+
+		order.resize(hashes.size());
+		forTasks([&](const size_t t, const size_t begin, const size_t end)
+		{
+			size_t* next = &counts[t * layout.partitions];
+			for (size_t i = begin; i < end; i++)
+				order[next[layout.partitionOf(hashes[i])]++] = i;
+		});
+	}
+
+	void simpleBins(const HashLayout& layout, const vector<ElementHash>& hashes,
+			BinLists& lists, ThreadPool* pool)
+	{
+		vector<size_t> partitionFirst;
+		vector<uint64_t> order;
+		groupByPartition(layout, hashes, partitionFirst, order, pool);
+
+		// A partition's entries follow those of the partitions before it,
+		// hashCount per element.  Its bins are counted and filled through a
+		// local array of starts, partitionBins long.
+		lists.first.resize(layout.bins + 1);
+		lists.entries.resize(hashes.size() * layout.hashCount);
+		lists.stash.clear();
+		ThreadPool::parallelFor(pool, layout.partitions, [&](const size_t begin,
+				const size_t end)
+		{
+			vector<size_t> next;
+			for (size_t p = begin; p < end; p++)
+			{
+				const size_t binBegin = layout.partitionBegin(p);
+				const size_t binEnd = layout.partitionBegin(p + 1);
+				next.assign(binEnd - binBegin + 1, 0);
+				for (size_t j = partitionFirst[p]; j < partitionFirst[p + 1]; j++)
+					for (unsigned h = 0; h < layout.hashCount; h++)
+						next[layout.bin(hashes[order[j]], h) - binBegin + 1]++;
+				next[0] = partitionFirst[p] * layout.hashCount;
+				for (size_t bin = binBegin; bin < binEnd; bin++)
+				{
+					next[bin - binBegin + 1] += next[bin - binBegin];
+					lists.first[bin] = next[bin - binBegin];
+				}
+
+				for (size_t j = partitionFirst[p]; j < partitionFirst[p + 1]; j++)
+					for (unsigned h = 0; h < layout.hashCount; h++)
+						lists.entries[next[layout.bin(hashes[order[j]], h)
+								- binBegin]++] = { order[j], h };
+			}
+		});
+		lists.first[layout.bins] = lists.entries.size();
+	}
+
+	// Cuckoo hashing by random walk within one partition.  slots[bin -
+	// binBegin] is element * hashCount + h + 1 for the element placed by
+	// hash h, or 0 if empty.
+	static void cuckooPartition(const HashLayout& layout,
+			const vector<ElementHash>& hashes, const uint64_t* elements,
+			const size_t count, const size_t binBegin, uint64_t* slots,
+			vector<uint64_t>& stash, uint64_t walk)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t current = elements[i];
+			bool placed = false;
+			for (unsigned kick = 0; kick < maxKicks && !placed; kick++)
+			{
+				const ElementHash& hash = hashes[current];
+				for (unsigned h = 0; h < layout.hashCount && !placed; h++)
+				{
+					uint64_t& slot = slots[layout.bin(hash, h) - binBegin];
+					if (slot == 0)
+					{
+						slot = current * layout.hashCount + h + 1;
+						placed = true;
+					}
+				}
+				if (placed)
+					break;
+
+				// Evict the occupant of a random one of the bins.
+				walk ^= walk << 13;
+				walk ^= walk >> 7;
+				walk ^= walk << 17;
+				const unsigned h = walk % layout.hashCount;
+				uint64_t& slot = slots[layout.bin(hash, h) - binBegin];
+				const uint64_t evicted = slot;
+				slot = current * layout.hashCount + h + 1;
+				current = (evicted - 1) / layout.hashCount;
+			}
+			if (!placed)
+				stash.push_back(current);
+		}
+	}
+
+	bool cuckooBins(const HashLayout& layout, const vector<ElementHash>& hashes,
+			BinLists& lists, ThreadPool* pool)
+	{
+		vector<size_t> partitionFirst;
+		vector<uint64_t> order;
+		groupByPartition(layout, hashes, partitionFirst, order, pool);
+
+		// Each partition walks with its own generator, so the table does
+		// not depend on which task ran it.
+		vector<uint64_t> slots(layout.bins, 0);
+		vector<vector<uint64_t>> stashes(layout.partitions);
+		ThreadPool::parallelFor(pool, layout.partitions, [&](const size_t begin,
+				const size_t end)
+		{
+			for (size_t p = begin; p < end; p++)
+			{
+				const size_t binBegin = layout.partitionBegin(p);
+				cuckooPartition(layout, hashes, &order[partitionFirst[p]],
+						partitionFirst[p + 1] - partitionFirst[p], binBegin,
+						&slots[binBegin], stashes[p],
+						(layout.key[0] ^ (p * 0x9e3779b97f4a7c15ull)) | 1);
+			}
+		});
+
+		lists.stash.clear();
+		for (const auto& stash : stashes)
+			lists.stash.insert(lists.stash.end(), stash.begin(), stash.end());
+		if (lists.stash.size() > layout.stashSize)
+			return false;
+		std::sort(lists.stash.begin(), lists.stash.end());
+
+		lists.first.resize(layout.bins + 1);
+		lists.entries.resize(hashes.size() - lists.stash.size());
+		size_t next = 0;
+		for (size_t bin = 0; bin < layout.bins; bin++)
+		{
+			lists.first[bin] = next;
+			if (slots[bin] != 0)
+				lists.entries[next++] = { (slots[bin] - 1) / layout.hashCount,
+						uint32_t((slots[bin] - 1) % layout.hashCount) };
+		}
+		lists.first[layout.bins] = next;
+		return true;
+	}
+
+}
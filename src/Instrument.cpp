@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "Instrument.h"
+
+using std::atomic;
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+namespace Instrument
+{
+
+	static const char* const counterNames[counterCount] =
+	{
+		"channel_messages_sent",
+		"channel_bytes_sent",
+		"channel_messages_received",
+		"channel_bytes_received",
+	};
+
+	static const char* const histogramNames[histogramCount] =
+	{
+		"modexp_secret_bits",
+		"modexp_public_bits",
+		"compute_ns",
+		"decrypt_ns",
+		"decrypt_share_ns",
+		"decrypt_with_ns",
+		"channel_wait_ns",
+		"buffer_depth",
+	};
+
+	const char* name(const Counter counter)
+	{
+		return counterNames[counter];
+	}
+
+	const char* name(const Histogram histogram)
+	{
+		return histogramNames[histogram];
+	}
+
+	static uint64_t clockNanos()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	struct Event
+	{
+		const char* name;
+		uint64_t start, duration;
+		unsigned thread;
+	};
+
+	// One thread's slots.  Only the owner writes them, so updates are a
+	// plain load and store; relaxed atomics only keep snapshots race-free.
+	struct ThreadStats
+	{
+		struct Distribution
+		{
+			atomic<uint64_t> count, sum;
+			atomic<uint64_t> buckets[histogramBuckets];
+		};
+
+		atomic<uint64_t> counters[counterCount] = {};
+		Distribution histograms[histogramCount] = {};
+		unsigned thread;
+
+		mutex traceMut; // events, against writeTrace
+		vector<Event> events;
+
+		ThreadStats();
+		~ThreadStats();
+	};
+
+	// Leaked, so that threads exiting after static destruction can still
+	// fold in their totals.
+	struct Registry
+	{
+		mutex mut;
+		vector<ThreadStats*> threads;
+		unsigned nextThread = 1;
+		Snapshot retired = {}; // threads that have exited
+		Snapshot baseline = {}; // subtracted by snapshot(), set by reset()
+		vector<Event> retiredEvents;
+		atomic<bool> tracing{false};
+		uint64_t traceStart = 0;
+	};
+
+	static Registry& registry()
+	{
+		static Registry* const instance = new Registry;
+		return *instance;
+	}
+
+	static void add(Snapshot& out, const ThreadStats& stats)
+	{
+		for (unsigned i = 0; i < counterCount; i++)
+			out.counters[i] += stats.counters[i].load(std::memory_order_relaxed);
+		for (unsigned h = 0; h < histogramCount; h++)
+		{
+			const ThreadStats::Distribution& in = stats.histograms[h];
+			Snapshot::Distribution& total = out.histograms[h];
+			total.count += in.count.load(std::memory_order_relaxed);
+			total.sum += in.sum.load(std::memory_order_relaxed);
+			for (unsigned b = 0; b < histogramBuckets; b++)
+				total.buckets[b] += in.buckets[b].load(std::memory_order_relaxed);
+		}
+	}
+
+	ThreadStats::ThreadStats()
+	{
+		Registry& reg = registry();
+		lock_guard<mutex> lock(reg.mut);
+		thread = reg.nextThread++;
+		reg.threads.push_back(this);
+	}
+
+	ThreadStats::~ThreadStats()
+	{
+		Registry& reg = registry();
+		lock_guard<mutex> lock(reg.mut);
+		add(reg.retired, *this);
+		reg.retiredEvents.insert(reg.retiredEvents.end(), events.begin(),
+				events.end());
+		reg.threads.erase(std::find(reg.threads.begin(), reg.threads.end(),
+				this));
+	}
+
+	Snapshot snapshot()
+	{
+		Registry& reg = registry();
+		lock_guard<mutex> lock(reg.mut);
+		Snapshot out = reg.retired;
+		for (const ThreadStats* stats : reg.threads)
+			add(out, *stats);
+
+		for (unsigned i = 0; i < counterCount; i++)
+			out.counters[i] -= reg.baseline.counters[i];
+		for (unsigned h = 0; h < histogramCount; h++)
+		{
+			Snapshot::Distribution& total = out.histograms[h];
+			const Snapshot::Distribution& base = reg.baseline.histograms[h];
+			total.count -= base.count;
+			total.sum -= base.sum;
+			for (unsigned b = 0; b < histogramBuckets; b++)
+				total.buckets[b] -= base.buckets[b];
+		}
+		return out;
+	}
+
+	void reset()
+	{
+		// Other threads' slots are never written from here; totals are
+		// taken relative to the current ones instead.
+		Snapshot current = snapshot();
+		Registry& reg = registry();
+		lock_guard<mutex> lock(reg.mut);
+		for (unsigned i = 0; i < counterCount; i++)
+			reg.baseline.counters[i] += current.counters[i];
+		for (unsigned h = 0; h < histogramCount; h++)
+		{
+			Snapshot::Distribution& base = reg.baseline.histograms[h];
+			const Snapshot::Distribution& total = current.histograms[h];
+			base.count += total.count;
+			base.sum += total.sum;
+			for (unsigned b = 0; b < histogramBuckets; b++)
+				base.buckets[b] += total.buckets[b];
+		}
+	}
+
+	// The largest value bucket b can hold.
+	static uint64_t bucketBound(const unsigned b)
+	{
+		return b == 0 ? 0 : b == 64 ? UINT64_MAX : (uint64_t(1) << b) - 1;
+	}
+
+	static uint64_t percentile(const Snapshot::Distribution& dist,
+			const double fraction)
+	{
+		const uint64_t rank = std::max<uint64_t>(1, fraction * dist.count);
+		uint64_t seen = 0;
+		for (unsigned b = 0; b < histogramBuckets; b++)
+			if ((seen += dist.buckets[b]) >= rank)
+				return bucketBound(b);
+		return 0;
+	}
+
+	void writeReport(ostream& out)
+	{
+		const Snapshot snap = snapshot();
+		out << "{\"counters\": {";
+		for (unsigned i = 0; i < counterCount; i++)
+			out << (i ? ", " : "") << '"' << counterNames[i] << "\": "
+					<< snap.counters[i];
+		out << "},\n \"histograms\": {";
+		for (unsigned h = 0; h < histogramCount; h++)
+		{
+			const Snapshot::Distribution& dist = snap.histograms[h];
+			out << (h ? ",\n  " : "\n  ") << '"' << histogramNames[h]
+					<< "\": {\"count\": " << dist.count << ", \"mean\": "
+					<< (dist.count ? double(dist.sum) / dist.count : 0.0)
+					<< ", \"p50\": " << percentile(dist, 0.50)
+					<< ", \"p90\": " << percentile(dist, 0.90)
+					<< ", \"p99\": " << percentile(dist, 0.99)
+					<< ", \"max\": " << percentile(dist, 1.0) << '}';
+		}
+		out << "}}\n";
+	}
+
+	void startTrace()
+	{
+		Registry& reg = registry();
+		lock_guard<mutex> lock(reg.mut);
+		reg.retiredEvents.clear();
+		for (ThreadStats* stats : reg.threads)
+		{
+			lock_guard<mutex> traceLock(stats->traceMut);
+			stats->events.clear();
+		}
+		reg.traceStart = clockNanos();
+		reg.tracing = true;
+	}
+
+	void stopTrace()
+	{
+		registry().tracing = false;
+	}
+
+	void writeTrace(ostream& out)
+	{
+		Registry& reg = registry();
+		lock_guard<mutex> lock(reg.mut);
+		vector<Event> events = reg.retiredEvents;
+		for (ThreadStats* stats : reg.threads)
+		{
+			lock_guard<mutex> traceLock(stats->traceMut);
+			events.insert(events.end(), stats->events.begin(),
+					stats->events.end());
+		}
+
+		// Timestamps are microseconds since startTrace.
+		const std::ios::fmtflags flags = out.flags();
+		const std::streamsize precision = out.precision(3);
+		out << std::fixed;
+		out << "{\"traceEvents\": [";
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			const Event& event = events[i];
+			out << (i ? ",\n  " : "\n  ") << "{\"name\": \"" << event.name
+					<< "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+					<< event.thread << ", \"ts\": "
+					<< int64_t(event.start - reg.traceStart) / 1e3
+					<< ", \"dur\": "
+					<< event.duration / 1e3 << '}';
+		}
+		out << "\n]}\n";
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+#ifdef INSTRUMENT
+
+	// Timers appear in traces under these.
+	static const char* const spanNames[histogramCount] =
+	{
+		"modExp",
+		"modExp_public",
+		"compute",
+		"decrypt",
+		"decryptShare",
+		"decryptWith",
+		"channel_wait",
+		"buffer",
+	};
+
+	static const size_t maxEventsPerThread = 1 << 20;
+
+	static ThreadStats& local()
+	{
+		thread_local ThreadStats stats;
+		return stats;
+	}
+
+	static void bump(atomic<uint64_t>& slot, const uint64_t n)
+	{
+		slot.store(slot.load(std::memory_order_relaxed) + n,
+				std::memory_order_relaxed);
+	}
+
+	void count(const Counter counter, const uint64_t n)
+	{
+		bump(local().counters[counter], n);
+	}
+
+	void record(const Histogram histogram, const uint64_t value)
+	{
+		ThreadStats::Distribution& dist = local().histograms[histogram];
+		bump(dist.count, 1);
+		bump(dist.sum, value);
+		bump(dist.buckets[value ? 64 - __builtin_clzll(value) : 0], 1);
+	}
+
+	uint64_t nanos()
+	{
+		return clockNanos();
+	}
+
+	static void trace(const char* name, const uint64_t start,
+			const uint64_t end)
+	{
+		if (!registry().tracing.load(std::memory_order_relaxed))
+			return;
+		ThreadStats& stats = local();
+		lock_guard<mutex> lock(stats.traceMut);
+		if (stats.events.size() < maxEventsPerThread)
+			stats.events.push_back({ name, start, end - start, stats.thread });
+	}
+
+	Timer::~Timer()
+	{
+		const uint64_t end = nanos();
+		record(histogram, end - start);
+		trace(spanNames[histogram], start, end);
+	}
+
+	Span::~Span()
+	{
+		trace(name, start, nanos());
+	}
+
+#endif
+
+}
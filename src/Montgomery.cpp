@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cassert>
+#include "Montgomery.h"
+#include "ScratchArena.h"
+
+namespace ElGamal {
+	
+	// Copy n into exactly `limbs` limbs, zero-padding the high end.
+	static void toLimbs(mp_limb_t* out, const mpz_class& n, mp_size_t limbs)
+	{
+		for (mp_size_t i = 0; i < limbs; i++)
+			out[i] = mpz_getlimbn(n.get_mpz_t(), i);
+	}
+	
+	// -n^-1 mod 2^GMP_NUMB_BITS for odd n.  Newton iteration doubles the
+	// correct low bits each step.
+	static mp_limb_t negatedInverse(const mp_limb_t n)
+	{
+		mp_limb_t inv = 1;
+		for (unsigned bits = 1; bits < GMP_NUMB_BITS; bits *= 2)
+			inv *= 2 - n * inv;
+		return -inv;
+	}
+	
+	MontgomeryContext::MontgomeryContext(const mpz_class& _p) : p(_p),
+			width(mpz_size(p.get_mpz_t())), mod(width), rModP(width),
+			r2ModP(width)
+	{
+		assert(mpz_odd_p(p.get_mpz_t()));
+		toLimbs(mod.data(), p, width);
+		modInv = negatedInverse(mod[0]);
+		
+		const mpz_class R = mpz_class(1) << (width * GMP_NUMB_BITS);
+		toLimbs(rModP.data(), R % p, width);
+		toLimbs(r2ModP.data(), (R * R) % p, width);
+	}
+	
+	MontgomeryContext::MontgomeryContext(const mpz_class& _p,
+			const mp_limb_t* const _rModP, const mp_limb_t* const _r2ModP) :
+			p(_p), width(mpz_size(p.get_mpz_t())), mod(width),
+			rModP(_rModP, _rModP + width), r2ModP(_r2ModP, _r2ModP + width)
+	{
+		assert(mpz_odd_p(p.get_mpz_t()));
+		toLimbs(mod.data(), p, width);
+		modInv = negatedInverse(mod[0]);
+	}
+	
+	void MontgomeryContext::redc(mp_limb_t* out, mp_limb_t* product) const
+	{
+		// Clear one low limb per pass.
+		mp_limb_t high = 0;
+		for (mp_size_t i = 0; i < width; i++)
+		{
+			const mp_limb_t carry = mpn_addmul_1(product + i, mod.data(), width,
+					product[i] * modInv);
+			high += mpn_add_1(product + i + width, product + i + width,
+					width - i, carry);
+		}
+		
+		// The result is below 2p; subtract p once if it is not below p.
+		const mp_limb_t borrow = mpn_sub_n(out, product + width, mod.data(),
+				width);
+		mpn_copyi(out, product + width, width);
+		mpn_cnd_sub_n(high | (borrow ^ 1), out, out, mod.data(), width);
+	}
+	
+	void MontgomeryContext::mul(mp_limb_t* out, const mp_limb_t* a,
+			const mp_limb_t* b, mp_limb_t* scratch) const
+	{
+		mpn_mul_n(scratch, a, b, width);
+		redc(out, scratch);
+	}
+	
+	void MontgomeryContext::sqr(mp_limb_t* out, const mp_limb_t* a,
+			mp_limb_t* scratch) const
+	{
+		mpn_sqr(scratch, a, width);
+		redc(out, scratch);
+	}
+	
+	void MontgomeryContext::toMont(mp_limb_t* out, const mpz_class& n,
+			mp_limb_t* scratch) const
+	{
+		assert(sgn(n) >= 0 && mpz_size(n.get_mpz_t()) <= size_t(width));
+		toLimbs(out, n, width);
+		mul(out, out, r2ModP.data(), scratch);
+	}
+	
+	void MontgomeryContext::toMont(mp_limb_t* out, const mp_limb_t* n,
+			mp_limb_t* scratch) const
+	{
+		mul(out, n, r2ModP.data(), scratch);
+	}
+	
+	void MontgomeryContext::fromMont(mpz_class& out, const mp_limb_t* a,
+			mp_limb_t* scratch) const
+	{
+		fromMont(mpz_limbs_write(out.get_mpz_t(), width), a, scratch);
+		mpz_limbs_finish(out.get_mpz_t(), width);
+	}
+	
+	void MontgomeryContext::fromMont(mp_limb_t* out, const mp_limb_t* a,
+			mp_limb_t* scratch) const
+	{
+		// REDC(a * 1): a in the low half, zeros above.
+		mpn_copyi(scratch, a, width);
+		std::fill(scratch + width, scratch + 2 * width, 0);
+		redc(out, scratch);
+	}
+	
+	void MontgomeryContext::pow(mp_limb_t* out, const mp_limb_t* base,
+			const mpz_class& pow, mp_limb_t* scratch) const
+	{
+		assert(sgn(pow) >= 0);
+		const unsigned windowBits = 4;
+		const size_t entries = size_t(1) << windowBits;
+		
+		// base^d for d in [0, 2^w), then fixed windows from the top.
+		mp_limb_t* const table = scratch;
+		scratch += entries * width;
+		mpn_copyi(&table[0], rModP.data(), width);
+		mpn_copyi(&table[width], base, width);
+		for (size_t d = 2; d < entries; d++)
+			mul(&table[d * width], &table[(d - 1) * width], base, scratch);
+		
+		mpn_copyi(out, rModP.data(), width);
+		const size_t bits = mpz_sizeinbase(pow.get_mpz_t(), 2);
+		for (size_t window = (bits + windowBits - 1) / windowBits;
+				window-- > 0; )
+		{
+			for (unsigned s = 0; s < windowBits; s++)
+				sqr(out, out, scratch);
+			
+			const size_t bit = window * windowBits;
+			mp_limb_t digit = mpz_getlimbn(pow.get_mpz_t(), bit / GMP_NUMB_BITS)
+					>> (bit % GMP_NUMB_BITS);
+			digit &= entries - 1; // windows never straddle limbs
+			if (digit != 0)
+				mul(out, out, &table[digit * width], scratch);
+		}
+	}
+	
+	void MontgomeryContext::secretPow(mp_limb_t* out, const mp_limb_t* base,
+			const mpz_class& pow, const size_t bits, mp_limb_t* scratch) const
+	{
+		assert(sgn(pow) >= 0 && mpz_sizeinbase(pow.get_mpz_t(), 2) <= bits);
+		const unsigned windowBits = 4;
+		const size_t entries = size_t(1) << windowBits;
+		
+		// As pow, with GMP's side-channel silent products.
+		mp_limb_t* const table = scratch;
+		mp_limb_t* const product = scratch + entries * width;
+		ScratchArena::Frame frame(width * GMP_NUMB_BITS);
+		mp_limb_t* const entry = frame.limbs(width);
+		mp_limb_t* const secScratch = frame.limbs(std::max(
+				mpn_sec_mul_itch(width, width), mpn_sec_sqr_itch(width)));
+		auto secMul = [&](mp_limb_t* a, const mp_limb_t* b)
+		{
+			mpn_sec_mul(product, a, width, b, width, secScratch);
+			redc(a, product);
+		};
+		
+		mpn_copyi(&table[0], rModP.data(), width);
+		mpn_copyi(&table[width], base, width);
+		for (size_t d = 2; d < entries; d++)
+		{
+			mpn_copyi(&table[d * width], &table[(d - 1) * width], width);
+			secMul(&table[d * width], base);
+		}
+		
+		mpn_copyi(out, rModP.data(), width);
+		for (size_t window = (bits + windowBits - 1) / windowBits;
+				window-- > 0; )
+		{
+			for (unsigned s = 0; s < windowBits; s++)
+			{
+				mpn_sec_sqr(product, out, width, secScratch);
+				redc(out, product);
+			}
+			
+			const size_t bit = window * windowBits;
+			mp_limb_t digit = mpz_getlimbn(pow.get_mpz_t(), bit / GMP_NUMB_BITS)
+					>> (bit % GMP_NUMB_BITS);
+			digit &= entries - 1; // windows never straddle limbs
+			mpn_sec_tabselect(entry, table, width, entries, digit);
+			secMul(out, entry);
+		}
+	}
+	
+}
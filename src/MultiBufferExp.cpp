@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <cassert>
+#include "MultiBufferExp.h"
+#include "ScratchArena.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace ElGamal {
+
+	const size_t MultiBufferExp::lanes;
+	const unsigned MultiBufferExp::windowBits;
+
+	static const unsigned limbBits = 52;
+	static const uint64_t limbMask = (uint64_t(1) << limbBits) - 1;
+	static const size_t lanes = MultiBufferExp::lanes;
+	static const size_t tableEntries = size_t(1) << MultiBufferExp::windowBits;
+
+	static_assert(sizeof(mp_limb_t) == sizeof(uint64_t),
+			"scratch limbs double as 64-bit lanes");
+
+	// n as width 52-bit limbs, low first.
+	static void toLimbs52(uint64_t* out, const mpz_class& n, const size_t width)
+	{
+		for (size_t j = 0; j < width; j++)
+		{
+			const size_t bit = j * limbBits;
+			const unsigned shift = bit % GMP_NUMB_BITS;
+			uint64_t word = mpz_getlimbn(n.get_mpz_t(), bit / GMP_NUMB_BITS)
+					>> shift;
+			if (shift > GMP_NUMB_BITS - limbBits)
+				word |= uint64_t(mpz_getlimbn(n.get_mpz_t(),
+						bit / GMP_NUMB_BITS + 1)) << (GMP_NUMB_BITS - shift);
+			out[j] = word & limbMask;
+		}
+	}
+
+	// The inverse of toLimbs52, for normalized limbs.
+	static void fromLimbs52(mpz_class& out, const uint64_t* in,
+			const size_t width)
+	{
+		const size_t limbs = (width * limbBits + GMP_NUMB_BITS - 1)
+				/ GMP_NUMB_BITS;
+		mp_limb_t* const words = mpz_limbs_write(out.get_mpz_t(), limbs);
+		std::fill(words, words + limbs, 0);
+		for (size_t j = 0; j < width; j++)
+		{
+			const size_t bit = j * limbBits;
+			const unsigned shift = bit % GMP_NUMB_BITS;
+			words[bit / GMP_NUMB_BITS] |= in[j] << shift;
+			if (shift > GMP_NUMB_BITS - limbBits)
+				words[bit / GMP_NUMB_BITS + 1] |= in[j] >> (GMP_NUMB_BITS - shift);
+		}
+		mpz_limbs_finish(out.get_mpz_t(), limbs);
+	}
+
+	MultiBufferExp::MultiBufferExp(const mpz_class& _p) : p(_p),
+			width((mpz_sizeinbase(p.get_mpz_t(), 2) + 2 + limbBits - 1)
+					/ limbBits),
+			mod(width), rModP(width), r2ModP(width)
+	{
+		// Accumulators must not overflow; see montMul.
+		assert(mpz_odd_p(p.get_mpz_t()) && width < 1000);
+		toLimbs52(mod.data(), p, width);
+
+		uint64_t inv = 1;
+		for (unsigned bits = 1; bits < limbBits; bits *= 2)
+			inv *= 2 - mod[0] * inv;
+		modInv = -inv & limbMask;
+
+		const mpz_class R = mpz_class(1) << (width * limbBits);
+		toLimbs52(rModP.data(), R % p, width);
+		toLimbs52(r2ModP.data(), (R * R) % p, width);
+	}
+
+#if defined(__x86_64__)
+
+#define IFMA __attribute__((target("avx512f,avx512ifma")))
+
+	// Numbers in the kernel are lane-interleaved: limb j of all eight lanes
+	// is the vector at v + 8 * j.  Every value is below 2p, with R > 4p,
+	// so products need no final subtraction until the end.
+
+	IFMA static inline __m512i load(const uint64_t* v)
+	{
+		return _mm512_loadu_si512(v);
+	}
+
+	IFMA static inline void store(uint64_t* v, const __m512i x)
+	{
+		_mm512_storeu_si512(v, x);
+	}
+
+	// x >> 52 in each lane.  The zero-masked form, since GCC 12 warns
+	// about the undefined pass-through of _mm512_srli_epi64.
+	IFMA static inline __m512i carryOf(const __m512i x)
+	{
+		return _mm512_maskz_srli_epi64(0xff, x, limbBits);
+	}
+
+	// out = a * b / R mod p, lane by lane, almost reduced: inputs and
+	// output below 2p.  Word-serial Montgomery: row i adds a * b[i] and
+	// m * p, where m clears limb i.  Accumulators take four 52-bit terms
+	// per row from at most width + 1 rows, well inside 64 bits, so carries
+	// wait until the end.  acc is 2 * width vectors; out may alias a or b.
+	IFMA static void montMul(uint64_t* out, const uint64_t* a,
+			const uint64_t* b, const uint64_t* mod, const uint64_t modInv,
+			const size_t width, uint64_t* acc)
+	{
+		const __m512i zero = _mm512_setzero_si512();
+		const __m512i k0 = _mm512_set1_epi64(modInv);
+		for (size_t k = 0; k < 2 * width; k++)
+			store(acc + lanes * k, zero);
+
+		for (size_t i = 0; i < width; i++)
+		{
+			uint64_t* const row = acc + lanes * i;
+			const __m512i bi = load(b + lanes * i);
+			__m512i a0 = load(a);
+			__m512i p0 = _mm512_set1_epi64(mod[0]);
+			__m512i cur = _mm512_madd52lo_epu64(load(row), a0, bi);
+			const __m512i m = _mm512_madd52lo_epu64(zero, cur, k0);
+			cur = _mm512_madd52lo_epu64(cur, m, p0);
+			// The low 52 bits are now zero; the rest carries up.
+			__m512i next = _mm512_add_epi64(load(row + lanes),
+					carryOf(cur));
+			next = _mm512_madd52hi_epu64(next, a0, bi);
+			next = _mm512_madd52hi_epu64(next, m, p0);
+			cur = next;
+			for (size_t j = 1; j < width; j++)
+			{
+				const __m512i aj = load(a + lanes * j);
+				const __m512i pj = _mm512_set1_epi64(mod[j]);
+				next = load(row + lanes * (j + 1));
+				cur = _mm512_madd52lo_epu64(cur, aj, bi);
+				cur = _mm512_madd52lo_epu64(cur, m, pj);
+				next = _mm512_madd52hi_epu64(next, aj, bi);
+				next = _mm512_madd52hi_epu64(next, m, pj);
+				store(row + lanes * j, cur);
+				cur = next;
+			}
+			store(row + lanes * width, cur);
+		}
+
+		const __m512i mask = _mm512_set1_epi64(limbMask);
+		__m512i carry = zero;
+		for (size_t j = 0; j < width; j++)
+		{
+			const __m512i limb = _mm512_add_epi64(load(acc + lanes * (width + j)),
+					carry);
+			store(out + lanes * j, _mm512_and_si512(limb, mask));
+			carry = carryOf(limb);
+		}
+	}
+
+	// Broadcast a width-limb constant to all lanes.
+	static void broadcast(uint64_t* out, const uint64_t* n, const size_t width)
+	{
+		for (size_t j = 0; j < width; j++)
+			std::fill(out + lanes * j, out + lanes * (j + 1), n[j]);
+	}
+
+	// out = base^pow for each lane, bases and output in plain form below p
+	// and 2p.  digits(window, out) gives each lane's digit of a window.
+	template<typename Digits>
+	IFMA static void laneExp(uint64_t* out, const uint64_t* base,
+			const size_t windows, const Digits& digits, const uint64_t* mod,
+			const uint64_t modInv, const uint64_t* one, const uint64_t* r2,
+			const size_t width, uint64_t* scratch)
+	{
+		const size_t number = lanes * width;
+		uint64_t* const table = scratch;
+		uint64_t* const acc = table + tableEntries * number;
+		uint64_t* const selected = acc + 2 * number;
+		uint64_t* const result = selected + number;
+
+		// base^d in Montgomery form for d in [0, 2^w).
+		std::copy(one, one + number, table);
+		montMul(table + number, base, r2, mod, modInv, width, acc);
+		for (size_t d = 2; d < tableEntries; d++)
+			montMul(table + d * number, table + (d - 1) * number,
+					table + number, mod, modInv, width, acc);
+
+		std::copy(one, one + number, result);
+		for (size_t window = windows; window-- > 0; )
+		{
+			for (unsigned s = 0; s < MultiBufferExp::windowBits; s++)
+				montMul(result, result, result, mod, modInv, width, acc);
+
+			// Read every entry and keep each lane's own, so the access
+			// pattern does not depend on the digits.
+			uint64_t laneDigits[lanes];
+			digits(window, laneDigits);
+			const __m512i digit = load(laneDigits);
+			__mmask8 hits[tableEntries];
+			for (size_t d = 0; d < tableEntries; d++)
+				hits[d] = _mm512_cmpeq_epi64_mask(digit, _mm512_set1_epi64(d));
+			for (size_t j = 0; j < width; j++)
+			{
+				__m512i limb = load(table + lanes * j);
+				for (size_t d = 1; d < tableEntries; d++)
+					limb = _mm512_mask_blend_epi64(hits[d], limb,
+							load(table + d * number + lanes * j));
+				store(selected + lanes * j, limb);
+			}
+			montMul(result, result, selected, mod, modInv, width, acc);
+		}
+
+		// Out of Montgomery form: multiply by plain 1.
+		std::fill(selected, selected + number, 0);
+		std::fill(selected, selected + lanes, 1);
+		montMul(out, result, selected, mod, modInv, width, acc);
+	}
+
+	static bool cpuHasIfma()
+	{
+		unsigned eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 27)))
+			return false; // no OSXSAVE
+		// The OS must save the opmask and all of the ZMM registers.
+		unsigned xcr0, xcr0High;
+		__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+		if ((xcr0 & 0xe6) != 0xe6)
+			return false;
+		if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+			return false;
+		const bool avx512f = ebx & (1u << 16), ifma = ebx & (1u << 21);
+		return avx512f && ifma;
+	}
+
+	bool MultiBufferExp::available()
+	{
+		static const bool ifma = cpuHasIfma();
+		return ifma;
+	}
+
+	void MultiBufferExp::modExp(mpz_class* const* out,
+			const mpz_class* const* bases,
+			const mpz_class* const* pows, const size_t count,
+			const size_t bits) const
+	{
+		assert(available());
+		const size_t number = lanes * width;
+		ScratchArena::Frame frame(mpz_sizeinbase(p.get_mpz_t(), 2));
+		uint64_t* const one = frame.limbs(number);
+		uint64_t* const r2 = frame.limbs(number);
+		uint64_t* const laneBases = frame.limbs(number);
+		uint64_t* const lanePowers = frame.limbs(number);
+		uint64_t* const limbs = frame.limbs(width);
+		uint64_t* const scratch = frame.limbs((tableEntries + 4) * number);
+		mpz_class& reduced = frame.mpz();
+		broadcast(one, rModP.data(), width);
+		broadcast(r2, r2ModP.data(), width);
+
+		const mpz_class zero;
+		const size_t windows = (bits + windowBits - 1) / windowBits;
+		for (size_t first = 0; first < count; first += lanes)
+		{
+			// Unused lanes compute 0^0.
+			const size_t used = std::min(lanes, count - first);
+			const mpz_class* lanePows[lanes];
+			for (size_t l = 0; l < lanes; l++)
+			{
+				const mpz_class* base = &zero;
+				lanePows[l] = &zero;
+				if (l < used)
+				{
+					base = bases[first + l];
+					lanePows[l] = pows[first + l];
+					assert(sgn(*lanePows[l]) >= 0
+							&& mpz_sizeinbase(lanePows[l]->get_mpz_t(), 2) <= bits);
+					if (sgn(*base) < 0 || *base >= p)
+					{
+						mpz_mod(reduced.get_mpz_t(), base->get_mpz_t(),
+								p.get_mpz_t());
+						base = &reduced;
+					}
+				}
+				toLimbs52(limbs, *base, width);
+				for (size_t j = 0; j < width; j++)
+					laneBases[lanes * j + l] = limbs[j];
+			}
+
+			laneExp(lanePowers, laneBases, windows,
+					[&](const size_t window, uint64_t* digits)
+					{
+						// Windows never straddle limbs.
+						const size_t bit = window * windowBits;
+						for (size_t l = 0; l < lanes; l++)
+							digits[l] = (mpz_getlimbn(lanePows[l]->get_mpz_t(),
+									bit / GMP_NUMB_BITS) >> (bit % GMP_NUMB_BITS))
+									& (tableEntries - 1);
+					},
+					mod.data(), modInv, one, r2, width, scratch);
+
+			for (size_t l = 0; l < used; l++)
+			{
+				for (size_t j = 0; j < width; j++)
+					limbs[j] = lanePowers[lanes * j + l];
+				mpz_class& power = *out[first + l];
+				fromLimbs52(power, limbs, width);
+				// Multiplying by 1 leaves at most p.
+				if (power >= p)
+					power -= p;
+			}
+		}
+	}
+
+#else
+
+	bool MultiBufferExp::available()
+	{
+		return false;
+	}
+
+	void MultiBufferExp::modExp(mpz_class* const*, const mpz_class* const*,
+			const mpz_class* const*, size_t, size_t) const
+	{
+		assert(false);
+	}
+
+#endif
+
+}
@@ -1,75 +1,188 @@
 #include <cassert>
-#include <sstream>
+#include "Bytes.h"
 #include "ObliviousTransfer.h"
+#include "Random.h"
+#include "Wire.h"
 
 using namespace std;
+using Bytes::bytes;
 
 namespace ObliviousTransfer
 {
 	
-	void Client::oblivSend1of2(const unsigned i0, const unsigned i1,
-			gmp_randclass& rand)
+	// Messages are a type byte followed by Wire-encoded values.
+	enum MessageType : uint8_t
 	{
-		string msgType;
-		Ciphertext cipherSelection;
-		{
-			const string selectionBitMsg = in->take();
-			istringstream stream(selectionBitMsg);
-			
-			stream >> msgType >> cipherSelection;
-		}
+		SelectionBit = 1, // Ciphertext
+		Selection = 2 // Ciphertext, DecryptShare
+	};
+	
+	string Client::selectionBitMessage(const bool selectionBit,
+			RandomSource& rand) const
+	{
+		const Ciphertext cipherSelection = publicKey->encrypt(*params,
+				powerOf2(selectionBit ? 0 : 1), rand);
 		
-		assert(msgType == string("SelectionBit"));
+		string selectionBitMsg(1 + Wire::ciphertextBytes(*params), '\0');
+		selectionBitMsg[0] = SelectionBit;
+		Wire::write(*params, cipherSelection, bytes(selectionBitMsg) + 1);
+		return selectionBitMsg;
+	}
+	
+	bool Client::selectionMessage(const string& selectionBitMsg,
+			const unsigned i0, const unsigned i1, RandomSource& rand,
+			string& out) const
+	{
+		Ciphertext cipherSelection;
+		const uint8_t* const end = bytes(selectionBitMsg)
+				+ selectionBitMsg.size();
+		if (selectionBitMsg.empty() || selectionBitMsg[0] != SelectionBit
+				|| Wire::read(*params, cipherSelection,
+						bytes(selectionBitMsg) + 1, end) != end)
+			return false;
 		
 		cipherSelection.pow(*params, i1 - i0);
 		cipherSelection.mult(*params, publicKey->encrypt(*params,
-				powerOfTwo(i0), rand));
+				powerOf2(i0), rand));
 		// Necessary?
 		cipherSelection.mult(*params, publicKey->compute(*params, rand));
 		
 		const DecryptShare share = keyshare.decryptShare(*params, cipherSelection);
 		
+		out.assign(1 + Wire::ciphertextBytes(*params)
+				+ Wire::shareBytes(*params), '\0');
+		out[0] = Selection;
+		Wire::write(*params, share,
+				Wire::write(*params, cipherSelection, bytes(out) + 1));
+		return true;
+	}
+	
+	bool Client::readSelection(const string& selectionMsg, unsigned& out) const
+	{
+		const uint8_t* const end = bytes(selectionMsg) + selectionMsg.size();
+		
+		Ciphertext cipherSelection;
+		DecryptShare otherShare;
+		if (selectionMsg.empty() || selectionMsg[0] != Selection)
+			return false;
+		const uint8_t* const read = Wire::read(*params, cipherSelection,
+				bytes(selectionMsg) + 1, end);
+		if (read == nullptr || Wire::read(*params, otherShare, read, end) != end)
+			return false;
+		
+		out = tryLogBase2(*params,
+			cipherSelection.decryptWith(*params,
+				vector<DecryptShare>({ otherShare,
+					keyshare.decryptShare(*params, cipherSelection) })));
+		return true;
+	}
+	
+	void Client::oblivSend1of2(const unsigned i0, const unsigned i1,
+			RandomSource& rand)
+	{
+		string selectionMsg;
+		const bool ok = selectionMessage(channel->take(), i0, i1, rand,
+				selectionMsg);
+		assert(ok);
+		(void) ok;
+		channel->offer(move(selectionMsg));
+		// Nothing comes back to flush it.
+		channel->flush();
+		
+		// TODO: Receive and confirm commitment
+	}
+	
+	unsigned Client::oblivRecv1of2(const bool selectionBit, RandomSource& rand)
+	{
+		channel->offer(selectionBitMessage(selectionBit, rand));
+		
+		unsigned value = 0;
+		const bool ok = readSelection(channel->take(), value);
+		assert(ok);
+		(void) ok;
+		return value;
+	}
+	
+	// The sending side of a session transfer: wait for the selection bit,
+	// answer, done.
+	class SendSession : public SessionHandler
+	{
+		const Client& client;
+		const unsigned i0, i1;
+		ChaCha20Random rand;
+		function<void(bool)> done;
+		
+	public:
+		SendSession(const Client& _client, unsigned _i0, unsigned _i1,
+				ChaCha20Random _rand, function<void(bool)> _done) :
+				client(_client), i0(_i0), i1(_i1), rand(move(_rand)),
+				done(move(_done)) { }
+		
+		void receive(Session& session, string& payload) override
 		{
 			string selectionMsg;
-			ostringstream stream(selectionMsg);
-			
-			stream << "Selection " << cipherSelection << ' ' << share;
-			out->offer(selectionMsg);
+			const bool ok = client.selectionMessage(payload, i0, i1, rand,
+					selectionMsg);
+			if (ok)
+				session.send(move(selectionMsg));
+			session.finish();
+			done(ok);
 		}
 		
-		// TODO: Receive and confirm commitment
-	}
+		void fail(Session&) override
+		{
+			done(false);
+		}
+	};
 	
-	unsigned Client::oblivRecv1of2(const bool selectionBit, gmp_randclass& rand)
+	// The receiving side: send the selection bit on start, then read the
+	// answer.
+	class RecvSession : public SessionHandler
 	{
+		const Client& client;
+		const bool selectionBit;
+		ChaCha20Random rand;
+		function<void(bool, unsigned)> done;
+		
+	public:
+		RecvSession(const Client& _client, bool _selectionBit,
+				ChaCha20Random _rand, function<void(bool, unsigned)> _done) :
+				client(_client), selectionBit(_selectionBit), rand(move(_rand)),
+				done(move(_done)) { }
+		
+		void start(Session& session) override
+		{
+			session.send(client.selectionBitMessage(selectionBit, rand));
+		}
+		
+		void receive(Session& session, string& payload) override
 		{
-			string selectionBitMsg;
-			ostringstream stream(selectionBitMsg);
-			
-			stream << "SelectionBit ";
-			const Ciphertext cipherSelection = publicKey->encrypt(*params,
-					powerOfTwo(selectionBit ? 0 : 1), rand);
-			stream << cipherSelection;
-			
-			out->offer(selectionBitMsg);
+			unsigned value = 0;
+			const bool ok = client.readSelection(payload, value);
+			session.finish();
+			done(ok, value);
 		}
 		
+		void fail(Session&) override
 		{
-			const string selectionMsg = in->take();
-			istringstream stream(selectionMsg);
-			
-			string msgType;
-			Ciphertext cipherSelection;
-			DecryptShare otherShare;
-			stream >> msgType >> cipherSelection >> otherShare;
-			
-			assert(msgType == string("Selection"));
-			
-			return tryLogBase2(*params,
-				cipherSelection.decryptWith(*params,
-					vector<DecryptShare>({ otherShare,
-						keyShare.decryptShare(*params, cipherSelection) })));
+			done(false, 0);
 		}
+	};
+	
+	void Client::oblivSend1of2(SessionMux& mux, const SessionId id,
+			const unsigned i0, const unsigned i1, RandomSource& rand,
+			function<void(bool)> done) const
+	{
+		mux.open(id, std::make_shared<SendSession>(*this, i0, i1,
+				ChaCha20Random::derive(rand), move(done)));
+	}
+	
+	void Client::oblivRecv1of2(SessionMux& mux, const SessionId id,
+			const bool selectionBit, RandomSource& rand,
+			function<void(bool, unsigned)> done) const
+	{
+		mux.open(id, std::make_shared<RecvSession>(*this, selectionBit,
+				ChaCha20Random::derive(rand), move(done)));
 	}
 	
-}
\ No newline at end of file
+}
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cstring>
+#include "Bytes.h"
+#include "OtExtension.h"
+
+using Bytes::bytes;
+using Bytes::getWord;
+using Bytes::putWord;
+using ElGamal::Ed25519Group;
+using ElGamal::Ed25519Point;
+using std::move;
+using std::string;
+
+namespace ObliviousTransfer
+{
+
+	// Messages are a type byte followed by fixed-width fields; words are
+	// little-endian.
+	enum OtMessageType : uint8_t
+	{
+		BaseOtSenderPoint = 16, // A
+		BaseOtReceiverPoints = 17, // B for every transfer
+		OprfColumns = 18 // codeBits columns of chunkRows bits
+	};
+
+	static const size_t chunkWords = chunkRows / 64;
+	// Each PRG block is one SHA-256 state, four words.
+	static const size_t prgBlockWords = 4;
+	static_assert(chunkWords % prgBlockWords == 0,
+			"chunks must be whole PRG blocks");
+
+	// Receive one message of the given type and payload size.
+	static bool receive(Transport& transport, string& msg,
+			const OtMessageType type, const size_t payloadBytes)
+	{
+		return transport.recv(msg) && msg.size() == 1 + payloadBytes
+				&& uint8_t(msg[0]) == type;
+	}
+
+	// H(i, A, B, P), truncated to a seed.
+	static void deriveSeed(Seed& out, const uint64_t index,
+			const uint8_t* encodedA, const uint8_t* encodedB,
+			const Ed25519Group& group, const Ed25519Point& point)
+	{
+		uint8_t input[8 + 3 * Ed25519Group::encodedBytes];
+		putWord(input, index);
+		std::memcpy(input + 8, encodedA, Ed25519Group::encodedBytes);
+		std::memcpy(input + 8 + Ed25519Group::encodedBytes, encodedB,
+				Ed25519Group::encodedBytes);
+		group.write(point, input + 8 + 2 * Ed25519Group::encodedBytes);
+		Digest digest;
+		Sha256::hash(input, sizeof input, digest.data());
+		std::copy(digest.begin(), digest.begin() + out.size(), out.begin());
+	}
+
+	bool baseOtSend(Transport& transport, const Ed25519Group& group,
+			const size_t count, vector<array<Seed, 2>>& seeds,
+			RandomSource& rand)
+	{
+		const size_t pointBytes = group.elementBytes();
+		mpz_class a;
+		group.randomExponent(a, rand);
+		Ed25519Point A, negAa, B, P;
+		group.expG(A, a);
+		group.exp(negAa, A, a);
+		group.inverse(negAa, negAa);
+
+		string msg(1 + pointBytes, '\0');
+		msg[0] = BaseOtSenderPoint;
+		group.write(A, bytes(msg) + 1);
+		uint8_t encodedA[Ed25519Group::encodedBytes];
+		std::memcpy(encodedA, bytes(msg) + 1, pointBytes);
+		if (!transport.send(move(msg)))
+			return false;
+
+		string reply;
+		if (!receive(transport, reply, BaseOtReceiverPoints, count * pointBytes))
+			return false;
+		seeds.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			// k0 = H(B^a), k1 = H((B / A)^a) = H(B^a / A^a).
+			const uint8_t* const encodedB = bytes(reply) + 1 + i * pointBytes;
+			if (!group.read(B, encodedB, encodedB + pointBytes))
+				return false;
+			group.exp(P, B, a);
+			deriveSeed(seeds[i][0], i, encodedA, encodedB, group, P);
+			group.mul(P, P, negAa);
+			deriveSeed(seeds[i][1], i, encodedA, encodedB, group, P);
+		}
+		return true;
+	}
+
+	bool baseOtReceive(Transport& transport, const Ed25519Group& group,
+			const vector<bool>& choices, vector<Seed>& seeds,
+			RandomSource& rand)
+	{
+		const size_t pointBytes = group.elementBytes();
+		string msg;
+		Ed25519Point A;
+		if (!receive(transport, msg, BaseOtSenderPoint, pointBytes)
+				|| !group.read(A, bytes(msg) + 1, bytes(msg) + msg.size()))
+			return false;
+		const uint8_t* const encodedA = bytes(msg) + 1;
+
+		string reply(1 + choices.size() * pointBytes, '\0');
+		reply[0] = BaseOtReceiverPoints;
+		seeds.resize(choices.size());
+		mpz_class b;
+		Ed25519Point options[2], B, P;
+		for (size_t i = 0; i < choices.size(); i++)
+		{
+			// B = g^b, or A g^b for choice 1, picked without branching.
+			group.randomExponent(b, rand);
+			group.expG(options[0], b);
+			group.mul(options[1], A, options[0]);
+			mpn_sec_tabselect(reinterpret_cast<mp_limb_t*>(&B),
+					reinterpret_cast<const mp_limb_t*>(options),
+					sizeof B / sizeof(mp_limb_t), 2, choices[i]);
+			uint8_t* const encodedB = bytes(reply) + 1 + i * pointBytes;
+			group.write(B, encodedB);
+			group.exp(P, A, b);
+			deriveSeed(seeds[i], i, encodedA, encodedB, group, P);
+		}
+		return transport.send(move(reply));
+	}
+
+	// Counter-mode SHA-256: PRG block i of seed is the SHA-256 state after
+	// hashing seed || i, as four words.
+	static void prg(const Seed& seed, const uint64_t firstBlock,
+			const size_t blocks, uint64_t* out)
+	{
+		const size_t messageBytes = 16 + 8;
+		uint8_t block[Sha256::blockBytes] = { };
+		std::copy(seed.begin(), seed.end(), block);
+		block[messageBytes] = 0x80;
+		block[Sha256::blockBytes - 1] = uint8_t(messageBytes * 8);
+		for (size_t i = 0; i < blocks; i++)
+		{
+			putWord(block + 16, firstBlock + i);
+			uint32_t state[8];
+			Sha256::initialize(state);
+			Sha256::compress(state, block, 1);
+			for (size_t w = 0; w < prgBlockWords; w++)
+				out[i * prgBlockWords + w] = uint64_t(state[2 * w]) << 32
+						| state[2 * w + 1];
+		}
+	}
+
+	// Transpose a 64x64 bit matrix in place: bit b of word k moves to bit
+	// k of word b.
+	static void transpose64(uint64_t* a)
+	{
+		uint64_t mask = 0x00000000ffffffffull;
+		for (unsigned j = 32; j != 0; j >>= 1, mask ^= mask << j)
+			for (unsigned k = 0; k < 64; k = ((k | j) + 1) & ~j)
+			{
+				const uint64_t t = ((a[k] >> j) ^ a[k | j]) & mask;
+				a[k] ^= t << j;
+				a[k | j] ^= t;
+			}
+	}
+
+	// Between chunkRows rows of codeWords words and codeBits columns of
+	// chunkWords words, 64x64 blocks at a time.
+	static void columnsToRows(const uint64_t* columns, uint64_t* rows)
+	{
+		uint64_t block[64];
+		for (size_t v = 0; v < codeWords; v++)
+			for (size_t w = 0; w < chunkWords; w++)
+			{
+				for (size_t k = 0; k < 64; k++)
+					block[k] = columns[(v * 64 + k) * chunkWords + w];
+				transpose64(block);
+				for (size_t b = 0; b < 64; b++)
+					rows[(w * 64 + b) * codeWords + v] = block[b];
+			}
+	}
+
+	static void rowsToColumns(const uint64_t* rows, uint64_t* columns)
+	{
+		uint64_t block[64];
+		for (size_t v = 0; v < codeWords; v++)
+			for (size_t w = 0; w < chunkWords; w++)
+			{
+				for (size_t b = 0; b < 64; b++)
+					block[b] = rows[(w * 64 + b) * codeWords + v];
+				transpose64(block);
+				for (size_t k = 0; k < 64; k++)
+					columns[(v * 64 + k) * chunkWords + w] = block[k];
+			}
+	}
+
+	// The pseudo-random code word C(input): SHA-256(input || i) for i = 0, 1.
+	static void code(const Digest& input, uint64_t* out)
+	{
+		uint8_t message[Sha256::digestBytes + 1];
+		std::copy(input.begin(), input.end(), message);
+		for (uint8_t half = 0; half < 2; half++)
+		{
+			message[Sha256::digestBytes] = half;
+			uint8_t digest[Sha256::digestBytes];
+			Sha256::hash(message, sizeof message, digest);
+			for (size_t w = 0; w < codeWords / 2; w++)
+				out[half * codeWords / 2 + w] = getWord(digest + 8 * w);
+		}
+	}
+
+	// The OPRF output H(row, q_row + (C(x) & s)).
+	static void output(const uint64_t row, const uint64_t* words, Digest& out)
+	{
+		uint8_t message[8 + 8 * codeWords];
+		putWord(message, row);
+		for (size_t w = 0; w < codeWords; w++)
+			putWord(message + 8 + 8 * w, words[w]);
+		Sha256::hash(message, sizeof message, out.data());
+	}
+
+	bool oprfReceive(Transport& transport, const Ed25519Group& group,
+			const vector<Digest>& inputs, vector<Digest>& outputs,
+			RandomSource& rand)
+	{
+		// The receiver here is the sender of the base OTs.
+		vector<array<Seed, 2>> seeds;
+		if (!baseOtSend(transport, group, codeBits, seeds, rand))
+			return false;
+
+		const size_t rows = inputs.size();
+		outputs.resize(rows);
+		vector<uint64_t> codeRows(chunkRows * codeWords);
+		vector<uint64_t> codeColumns(codeBits * chunkWords);
+		vector<uint64_t> t0(codeBits * chunkWords), t1(chunkWords);
+		vector<uint64_t> t0Rows(chunkRows * codeWords);
+		for (size_t first = 0; first < rows; first += chunkRows)
+		{
+			const size_t n = std::min(chunkRows, rows - first);
+			std::fill(codeRows.begin() + n * codeWords, codeRows.end(), 0);
+			for (size_t r = 0; r < n; r++)
+				code(inputs[first + r], &codeRows[r * codeWords]);
+			rowsToColumns(codeRows.data(), codeColumns.data());
+
+			// u^i = G(k0_i) + G(k1_i) + c^i, so that the sender's
+			// q^i = G(k_si_i) + s_i u^i = t0^i + s_i c^i.
+			string msg(1 + codeBits * chunkWords * 8, '\0');
+			msg[0] = OprfColumns;
+			uint8_t* out = bytes(msg) + 1;
+			const uint64_t firstBlock = first / 64 / prgBlockWords;
+			for (size_t i = 0; i < codeBits; i++)
+			{
+				uint64_t* const column = &t0[i * chunkWords];
+				prg(seeds[i][0], firstBlock, chunkWords / prgBlockWords, column);
+				prg(seeds[i][1], firstBlock, chunkWords / prgBlockWords,
+						t1.data());
+				for (size_t w = 0; w < chunkWords; w++, out += 8)
+					putWord(out, column[w] ^ t1[w]
+							^ codeColumns[i * chunkWords + w]);
+			}
+			if (!transport.send(move(msg)))
+				return false;
+
+			columnsToRows(t0.data(), t0Rows.data());
+			for (size_t r = 0; r < n; r++)
+				output(first + r, &t0Rows[r * codeWords], outputs[first + r]);
+		}
+		return transport.flush();
+	}
+
+	bool OprfSender::run(Transport& transport, const Ed25519Group& group,
+			const size_t rows, RandomSource& rand)
+	{
+		vector<bool> choiceBits(codeBits);
+		for (size_t w = 0; w < codeWords; w++)
+		{
+			choices[w] = rand.word();
+			for (size_t b = 0; b < 64; b++)
+				choiceBits[w * 64 + b] = (choices[w] >> b) & 1;
+		}
+		vector<Seed> seeds;
+		if (!baseOtReceive(transport, group, choiceBits, seeds, rand))
+			return false;
+
+		q.resize(rows * codeWords);
+		vector<uint64_t> columns(codeBits * chunkWords);
+		vector<uint64_t> chunk(chunkRows * codeWords);
+		string msg;
+		for (size_t first = 0; first < rows; first += chunkRows)
+		{
+			if (!receive(transport, msg, OprfColumns,
+					codeBits * chunkWords * 8))
+				return false;
+			const uint8_t* in = bytes(msg) + 1;
+			const uint64_t firstBlock = first / 64 / prgBlockWords;
+			for (size_t i = 0; i < codeBits; i++)
+			{
+				uint64_t* const column = &columns[i * chunkWords];
+				prg(seeds[i], firstBlock, chunkWords / prgBlockWords, column);
+				const uint64_t mask = -((choices[i / 64] >> (i % 64)) & 1);
+				for (size_t w = 0; w < chunkWords; w++, in += 8)
+					column[w] ^= getWord(in) & mask;
+			}
+			columnsToRows(columns.data(), chunk.data());
+			const size_t n = std::min(chunkRows, rows - first);
+			std::copy(chunk.begin(), chunk.begin() + n * codeWords,
+					q.begin() + first * codeWords);
+		}
+		return true;
+	}
+
+	void OprfSender::evaluate(const size_t row, const Digest& input,
+			Digest& out) const
+	{
+		uint64_t words[codeWords];
+		code(input, words);
+		for (size_t w = 0; w < codeWords; w++)
+			words[w] = q[row * codeWords + w] ^ (words[w] & choices[w]);
+		output(row, words, out);
+	}
+
+}
@@ -0,0 +1,328 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "PrecomputeCache.h"
+#include "Sha256.h"
+
+namespace ElGamal {
+
+	static const char magic[8] = { 'E', 'G', 'C', 'A', 'C', 'H', 'E', '1' };
+	static const uint32_t byteOrderMark = 0x01020304;
+	// Payload alignment, so tables start on cache lines.
+	static const size_t payloadAlign = 64;
+
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t limbBits;
+		uint32_t byteOrder;
+		uint32_t reserved;
+		uint64_t entries;
+		uint64_t fileBytes;
+		uint8_t checksum[Sha256::digestBytes]; // of the directory
+	};
+
+	static void hashInteger(Sha256& hash, const mpz_class& n)
+	{
+		const uint64_t bytes = (mpz_sizeinbase(n.get_mpz_t(), 2) + 7) / 8;
+		vector<uint8_t> out(bytes);
+		mpz_export(out.data(), nullptr, 1, 1, 1, 0, n.get_mpz_t());
+		hash.update(&bytes, sizeof bytes);
+		hash.update(out.data(), out.size());
+	}
+
+	static void entryKey(uint8_t* key, const mpz_class& p,
+			const mpz_class& base)
+	{
+		Sha256 hash;
+		hashInteger(hash, p);
+		hashInteger(hash, base);
+		hash.final(key);
+	}
+
+	static string limbBytes(const mp_limb_t* limbs, const size_t count)
+	{
+		return string(reinterpret_cast<const char*>(limbs),
+				count * sizeof(mp_limb_t));
+	}
+
+	// Tables are stored and looked up by their rounded-up exponent length.
+	static unsigned tableExpBits(const unsigned expBits,
+			const unsigned windowBits)
+	{
+		return (expBits + windowBits - 1) / windowBits * windowBits;
+	}
+
+	void PrecomputeCache::Builder::add(const Kind kind, const mpz_class& p,
+			const mpz_class& base, const uint64_t shape0, const uint64_t shape1,
+			string payload)
+	{
+		Pending next;
+		std::memset(&next.entry, 0, sizeof next.entry);
+		next.entry.kind = kind;
+		next.entry.shape[0] = shape0;
+		next.entry.shape[1] = shape1;
+		entryKey(next.entry.key, p, base);
+		// Several Params may share p, and so the same constants.
+		for (const Pending& other : pending)
+			if (other.entry.kind == kind && other.entry.shape[0] == shape0
+					&& other.entry.shape[1] == shape1
+					&& std::equal(next.entry.key,
+							next.entry.key + sizeof next.entry.key,
+							other.entry.key))
+				return;
+		next.entry.bytes = payload.size();
+		Sha256::hash(payload.data(), payload.size(), next.entry.checksum);
+		next.payload = move(payload);
+		pending.push_back(move(next));
+	}
+
+	void PrecomputeCache::Builder::add(const Params& params)
+	{
+		const MontgomeryContext& mont = *params.mont;
+		add(Montgomery, params.p, 0, mont.limbs(), 0,
+				limbBytes(mont.one(), mont.limbs())
+				+ limbBytes(mont.rSquared(), mont.limbs()));
+		if (params.gTable)
+		{
+			const FixedBaseTable& table = *params.gTable;
+			add(Table, params.p, params.g, table.expBits(), table.windowWidth(),
+					string(reinterpret_cast<const char*>(table.data()),
+							table.tableBytes()));
+		}
+	}
+
+	void PrecomputeCache::Builder::add(const Params& params,
+			const PublicKey& key)
+	{
+		const shared_ptr<const FixedBaseTable> table = key.aTable
+				? key.aTable : params.makeTable(key.A);
+		if (!table)
+			return;
+		add(Table, params.p, key.A, table->expBits(), table->windowWidth(),
+				string(reinterpret_cast<const char*>(table->data()),
+						table->tableBytes()));
+	}
+
+	void PrecomputeCache::Builder::add(const DiscreteLog& log)
+	{
+		add(Log, log.p, log.base, log.bound, log.babySteps,
+				string(reinterpret_cast<const char*>(log.keys),
+						log.capacity * sizeof(uint64_t))
+				+ string(reinterpret_cast<const char*>(log.values),
+						log.capacity * sizeof(uint32_t)));
+	}
+
+	static size_t alignUp(const size_t n)
+	{
+		return (n + payloadAlign - 1) / payloadAlign * payloadAlign;
+	}
+
+	bool PrecomputeCache::Builder::write(const string& path) const
+	{
+		// Lay out the whole image, then checksum the directory.
+		size_t end = alignUp(sizeof(FileHeader) + pending.size() * sizeof(Entry));
+		vector<Entry> directory;
+		for (const Pending& next : pending)
+		{
+			directory.push_back(next.entry);
+			directory.back().offset = end;
+			end = alignUp(end + next.payload.size());
+		}
+
+		string image(end, '\0');
+		std::memcpy(&image[sizeof(FileHeader)], directory.data(),
+				directory.size() * sizeof(Entry));
+		for (size_t i = 0; i < pending.size(); i++)
+			std::memcpy(&image[directory[i].offset], pending[i].payload.data(),
+					pending[i].payload.size());
+
+		FileHeader header;
+		std::memset(&header, 0, sizeof header);
+		std::memcpy(header.magic, magic, sizeof magic);
+		header.version = version;
+		header.limbBits = GMP_NUMB_BITS;
+		header.byteOrder = byteOrderMark;
+		header.entries = pending.size();
+		header.fileBytes = image.size();
+		Sha256::hash(directory.data(), directory.size() * sizeof(Entry),
+				header.checksum);
+		std::memcpy(&image[0], &header, sizeof header);
+
+		const string temp = path + ".tmp" + std::to_string(getpid());
+		{
+			std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+			if (!out.write(image.data(), image.size()) || !out.flush())
+			{
+				std::remove(temp.c_str());
+				return false;
+			}
+		}
+		if (std::rename(temp.c_str(), path.c_str()) != 0)
+		{
+			std::remove(temp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	PrecomputeCache::PrecomputeCache(shared_ptr<const void> _mapping,
+			const uint8_t* const _data, const Entry* const _entries,
+			const size_t _count) : mapping(move(_mapping)), data(_data),
+			entries(_entries), count(_count),
+			checks(new std::atomic<uint8_t>[_count]()) { }
+
+	shared_ptr<const PrecomputeCache> PrecomputeCache::open(const string& path)
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return nullptr;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(FileHeader))
+		{
+			::close(fd);
+			return nullptr;
+		}
+		const size_t bytes = info.st_size;
+		void* const addr = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (addr == MAP_FAILED)
+			return nullptr;
+		const shared_ptr<const void> mapping(addr,
+				[bytes](const void* p) { munmap(const_cast<void*>(p), bytes); });
+
+		const uint8_t* const data = static_cast<const uint8_t*>(addr);
+		FileHeader header;
+		std::memcpy(&header, data, sizeof header);
+		if (!std::equal(magic, magic + sizeof magic, header.magic)
+				|| header.version != version || header.limbBits != GMP_NUMB_BITS
+				|| header.byteOrder != byteOrderMark
+				|| header.fileBytes != bytes
+				|| header.entries > (bytes - sizeof header) / sizeof(Entry))
+			return nullptr;
+
+		const Entry* const entries
+				= reinterpret_cast<const Entry*>(data + sizeof header);
+		for (size_t i = 0; i < header.entries; i++)
+		{
+			const Entry& entry = entries[i];
+			if (entry.offset % payloadAlign != 0 || entry.offset > bytes
+					|| entry.bytes > bytes - entry.offset)
+				return nullptr;
+		}
+
+		uint8_t checksum[Sha256::digestBytes];
+		Sha256::hash(entries, header.entries * sizeof(Entry), checksum);
+		if (!std::equal(checksum, checksum + sizeof checksum, header.checksum))
+			return nullptr;
+
+		return shared_ptr<const PrecomputeCache>(new PrecomputeCache(mapping,
+				data, entries, header.entries));
+	}
+
+	bool PrecomputeCache::intact(const size_t i) const
+	{
+		uint8_t check = checks[i].load(std::memory_order_acquire);
+		if (check == Unchecked)
+		{
+			const Entry& entry = entries[i];
+			uint8_t checksum[Sha256::digestBytes];
+			Sha256::hash(data + entry.offset, entry.bytes, checksum);
+			check = std::equal(checksum, checksum + sizeof checksum,
+					entry.checksum) ? Intact : Corrupt;
+			checks[i].store(check, std::memory_order_release);
+		}
+		return check == Intact;
+	}
+
+	bool PrecomputeCache::verify() const
+	{
+		bool ok = true;
+		for (size_t i = 0; i < count; i++)
+			ok = intact(i) && ok;
+		return ok;
+	}
+
+	const PrecomputeCache::Entry* PrecomputeCache::find(const Kind kind,
+			const mpz_class& p, const mpz_class& base, const uint64_t shape0,
+			const uint64_t shape1) const
+	{
+		uint8_t key[sizeof(Entry::key)];
+		entryKey(key, p, base);
+		for (size_t i = 0; i < count; i++)
+		{
+			const Entry& entry = entries[i];
+			if (entry.kind == kind && entry.shape[0] == shape0
+					&& entry.shape[1] == shape1
+					&& std::equal(key, key + sizeof key, entry.key))
+				return intact(i) ? &entry : nullptr;
+		}
+		return nullptr;
+	}
+
+	shared_ptr<const MontgomeryContext> PrecomputeCache::montgomery(
+			const mpz_class& p) const
+	{
+		const mp_size_t limbs = mpz_size(p.get_mpz_t());
+		const Entry* const entry = find(Montgomery, p, 0, limbs, 0);
+		if (!entry || entry->bytes != 2 * limbs * sizeof(mp_limb_t))
+			return nullptr;
+		const mp_limb_t* const constants
+				= reinterpret_cast<const mp_limb_t*>(data + entry->offset);
+		return std::make_shared<const MontgomeryContext>(p, constants,
+				constants + limbs);
+	}
+
+	shared_ptr<const FixedBaseTable> PrecomputeCache::table(
+			shared_ptr<const MontgomeryContext> mont, const mpz_class& base,
+			const unsigned expBits, const unsigned windowBits) const
+	{
+		if (windowBits == 0 || windowBits >= 16)
+			return nullptr;
+		const Entry* const entry = find(Table, mont->modulus(), base,
+				tableExpBits(expBits, windowBits), windowBits);
+		if (!entry || entry->bytes != FixedBaseTable::tableLimbs(*mont,
+				expBits, windowBits) * sizeof(mp_limb_t))
+			return nullptr;
+		return std::make_shared<const FixedBaseTable>(move(mont), expBits,
+				windowBits,
+				reinterpret_cast<const mp_limb_t*>(data + entry->offset),
+				mapping);
+	}
+
+	shared_ptr<const DiscreteLog> PrecomputeCache::discreteLog(
+			const mpz_class& p, const mpz_class& base, const unsigned long bound,
+			unsigned long babySteps) const
+	{
+		if (babySteps == 0)
+			babySteps = DiscreteLog::defaultBabySteps(bound);
+		const mpz_class reduced = base % p;
+		const Entry* const entry = find(Log, p, reduced, bound, babySteps);
+		const size_t slotBytes = sizeof(uint64_t) + sizeof(uint32_t);
+		if (!entry || entry->bytes % slotBytes != 0)
+			return nullptr;
+		const size_t capacity = entry->bytes / slotBytes;
+		if (capacity < 2 * babySteps || (capacity & (capacity - 1)))
+			return nullptr;
+
+		auto log = std::make_shared<DiscreteLog>();
+		log->p = p;
+		log->base = reduced;
+		log->bound = bound;
+		log->babySteps = babySteps;
+		log->capacity = capacity;
+		log->keys = reinterpret_cast<const uint64_t*>(data + entry->offset);
+		log->values = reinterpret_cast<const uint32_t*>(
+				data + entry->offset + capacity * sizeof(uint64_t));
+		log->storage = mapping;
+		log->prepareGiantStep();
+		return log;
+	}
+
+}
@@ -0,0 +1,79 @@
+#include "PrecomputePool.h"
+#include "Random.h"
+
+using std::lock_guard;
+using std::unique_lock;
+
+namespace ElGamal {
+	
+	PrecomputePool::PrecomputePool(const Params& _params,
+			const PublicKey& _publicKey, const size_t _capacity,
+			const unsigned threads, RandomSource& rand) :
+			params(_params), publicKey(_publicKey), capacity(_capacity),
+			hitCount(0), missCount(0)
+	{
+		workers.reserve(threads);
+		for (unsigned i = 0; i < threads; i++)
+		{
+			// Each worker gets its own stream; a RandomSource is not
+			// safe to share between threads.
+			workers.emplace_back(&PrecomputePool::work, this,
+					ChaCha20Random::derive(rand));
+		}
+	}
+	
+	PrecomputePool::~PrecomputePool()
+	{
+		{
+			lock_guard<mutex> lock(mut);
+			stopping = true;
+		}
+		notFull.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+	
+	void PrecomputePool::work(ChaCha20Random rand)
+	{
+		unique_lock<mutex> lock(mut);
+		while (true)
+		{
+			while (!stopping && ready.size() + pending >= capacity)
+				notFull.wait(lock);
+			if (stopping)
+				return;
+			
+			pending++;
+			lock.unlock();
+			Ciphertext pair = publicKey.compute(params, rand);
+			lock.lock();
+			pending--;
+			ready.push_back(move(pair));
+		}
+	}
+	
+	Ciphertext PrecomputePool::take(RandomSource& rand)
+	{
+		{
+			lock_guard<mutex> lock(mut);
+			if (!ready.empty())
+			{
+				Ciphertext pair = move(ready.front());
+				ready.pop_front();
+				notFull.notify_one();
+				hitCount++;
+				return pair;
+			}
+		}
+		
+		missCount++;
+		return publicKey.compute(params, rand);
+	}
+	
+	size_t PrecomputePool::available()
+	{
+		lock_guard<mutex> lock(mut);
+		return ready.size();
+	}
+	
+}
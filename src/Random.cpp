@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sys/random.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "Bytes.h"
+#include "Random.h"
+
+uint64_t RandomSource::word()
+{
+	uint64_t out;
+	fill(&out, sizeof out);
+	return out;
+}
+
+// Mask for the top limb of a value below a bound whose top limb is top.
+static mp_limb_t topMask(const mp_limb_t top)
+{
+	return ~mp_limb_t(0) >> __builtin_clzll(top);
+}
+
+uint64_t RandomSource::below(const uint64_t bound)
+{
+	const uint64_t mask = topMask(bound);
+	uint64_t out;
+	do
+		out = word() & mask;
+	while (out >= bound);
+	return out;
+}
+
+void RandomSource::bits(mpz_class& out, const mp_bitcnt_t bits)
+{
+	const mp_size_t n = (bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+	if (n == 0)
+	{
+		out = 0;
+		return;
+	}
+	mp_limb_t* const limbs = mpz_limbs_write(out.get_mpz_t(), n);
+	fill(limbs, n * sizeof(mp_limb_t));
+	if (bits % GMP_NUMB_BITS != 0)
+		limbs[n - 1] &= (mp_limb_t(1) << (bits % GMP_NUMB_BITS)) - 1;
+	mpz_limbs_finish(out.get_mpz_t(), n);
+}
+
+mpz_class RandomSource::bits(const mp_bitcnt_t count)
+{
+	mpz_class out;
+	bits(out, count);
+	return out;
+}
+
+void RandomSource::uniform(mpz_class& out, const mpz_class& bound)
+{
+	uniform(&out, 1, bound);
+}
+
+mpz_class RandomSource::uniform(const mpz_class& bound)
+{
+	mpz_class out;
+	uniform(&out, 1, bound);
+	return out;
+}
+
+void RandomSource::uniform(mpz_class* out, const size_t count,
+		const mpz_class& bound)
+{
+	const mp_size_t n = mpz_size(bound.get_mpz_t());
+	const mp_limb_t* const boundLimbs = mpz_limbs_read(bound.get_mpz_t());
+	const mp_limb_t mask = topMask(boundLimbs[n - 1]);
+	for (size_t i = 0; i < count; i++)
+	{
+		mp_limb_t* const limbs = mpz_limbs_write(out[i].get_mpz_t(), n);
+		do
+		{
+			fill(limbs, n * sizeof(mp_limb_t));
+			limbs[n - 1] &= mask;
+		}
+		while (mpn_cmp(limbs, boundLimbs, n) >= 0);
+		mpz_limbs_finish(out[i].get_mpz_t(), n);
+	}
+}
+
+static uint32_t rotate(const uint32_t x, const unsigned bits)
+{
+	return (x << bits) | (x >> (32 - bits));
+}
+
+static void quarterRound(uint32_t* x, const unsigned a, const unsigned b,
+		const unsigned c, const unsigned d)
+{
+	x[a] += x[b];
+	x[d] = rotate(x[d] ^ x[a], 16);
+	x[c] += x[d];
+	x[b] = rotate(x[b] ^ x[c], 12);
+	x[a] += x[b];
+	x[d] = rotate(x[d] ^ x[a], 8);
+	x[c] += x[d];
+	x[b] = rotate(x[b] ^ x[c], 7);
+}
+
+// Fill key from the kernel's generator.
+static void systemRandom(uint8_t* out, size_t bytes)
+{
+	while (bytes > 0)
+	{
+		const ssize_t got = getrandom(out, bytes, 0);
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			// Nothing safe to fall back on.
+			std::cerr << "getrandom failed: " << std::strerror(errno) << '\n';
+			std::abort();
+		}
+		out += got;
+		bytes -= got;
+	}
+}
+
+ChaCha20Random::ChaCha20Random()
+{
+	uint8_t seed[keyBytes];
+	systemRandom(seed, sizeof seed);
+	rekey(seed);
+}
+
+ChaCha20Random::ChaCha20Random(const uint8_t* _key, const uint64_t _nonce)
+{
+	rekey(_key, _nonce);
+}
+
+ChaCha20Random ChaCha20Random::derive(RandomSource& parent)
+{
+	uint8_t seed[keyBytes];
+	parent.fill(seed, sizeof seed);
+	ChaCha20Random out(seed);
+	std::memset(seed, 0, sizeof seed);
+	return out;
+}
+
+void ChaCha20Random::rekey(const uint8_t* _key, const uint64_t _nonce)
+{
+	for (unsigned i = 0; i < 8; i++)
+		key[i] = Bytes::getWord32(_key + 4 * i);
+	nonce = _nonce;
+	counter = 0;
+	bufferPos = sizeof buffer;
+}
+
+static void doubleRounds(uint32_t* x)
+{
+	for (unsigned round = 0; round < 20; round += 2)
+	{
+		quarterRound(x, 0, 4, 8, 12);
+		quarterRound(x, 1, 5, 9, 13);
+		quarterRound(x, 2, 6, 10, 14);
+		quarterRound(x, 3, 7, 11, 15);
+		quarterRound(x, 0, 5, 10, 15);
+		quarterRound(x, 1, 6, 11, 12);
+		quarterRound(x, 2, 7, 8, 13);
+		quarterRound(x, 3, 4, 9, 14);
+	}
+}
+
+#if defined(__x86_64__)
+
+// Four blocks at once, one per SSE2 lane: x[i] holds word i of each.
+static __m128i rotateLanes(const __m128i x, const int bits)
+{
+	return _mm_or_si128(_mm_slli_epi32(x, bits), _mm_srli_epi32(x, 32 - bits));
+}
+
+static void quarterRound4(__m128i* x, const unsigned a, const unsigned b,
+		const unsigned c, const unsigned d)
+{
+	x[a] = _mm_add_epi32(x[a], x[b]);
+	x[d] = rotateLanes(_mm_xor_si128(x[d], x[a]), 16);
+	x[c] = _mm_add_epi32(x[c], x[d]);
+	x[b] = rotateLanes(_mm_xor_si128(x[b], x[c]), 12);
+	x[a] = _mm_add_epi32(x[a], x[b]);
+	x[d] = rotateLanes(_mm_xor_si128(x[d], x[a]), 8);
+	x[c] = _mm_add_epi32(x[c], x[d]);
+	x[b] = rotateLanes(_mm_xor_si128(x[b], x[c]), 7);
+}
+
+// state's counter words are those of the first block.
+static void fourBlocks(const uint32_t* state, uint8_t* out)
+{
+	const uint64_t counter = uint64_t(state[13]) << 32 | state[12];
+	__m128i start[16], x[16];
+	for (unsigned i = 0; i < 16; i++)
+		start[i] = _mm_set1_epi32(state[i]);
+	start[12] = _mm_setr_epi32(uint32_t(counter), uint32_t(counter + 1),
+			uint32_t(counter + 2), uint32_t(counter + 3));
+	start[13] = _mm_setr_epi32(uint32_t(counter >> 32),
+			uint32_t((counter + 1) >> 32), uint32_t((counter + 2) >> 32),
+			uint32_t((counter + 3) >> 32));
+	for (unsigned i = 0; i < 16; i++)
+		x[i] = start[i];
+	for (unsigned round = 0; round < 20; round += 2)
+	{
+		quarterRound4(x, 0, 4, 8, 12);
+		quarterRound4(x, 1, 5, 9, 13);
+		quarterRound4(x, 2, 6, 10, 14);
+		quarterRound4(x, 3, 7, 11, 15);
+		quarterRound4(x, 0, 5, 10, 15);
+		quarterRound4(x, 1, 6, 11, 12);
+		quarterRound4(x, 2, 7, 8, 13);
+		quarterRound4(x, 3, 4, 9, 14);
+	}
+
+	// Transpose each group of four words back into the four blocks.
+	for (unsigned i = 0; i < 16; i += 4)
+	{
+		const __m128i a = _mm_add_epi32(x[i], start[i]);
+		const __m128i b = _mm_add_epi32(x[i + 1], start[i + 1]);
+		const __m128i c = _mm_add_epi32(x[i + 2], start[i + 2]);
+		const __m128i d = _mm_add_epi32(x[i + 3], start[i + 3]);
+		const __m128i ab0 = _mm_unpacklo_epi32(a, b);
+		const __m128i ab1 = _mm_unpackhi_epi32(a, b);
+		const __m128i cd0 = _mm_unpacklo_epi32(c, d);
+		const __m128i cd1 = _mm_unpackhi_epi32(c, d);
+		uint8_t* const at = out + 4 * i;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(at),
+				_mm_unpacklo_epi64(ab0, cd0));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(at + 64),
+				_mm_unpackhi_epi64(ab0, cd0));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(at + 128),
+				_mm_unpacklo_epi64(ab1, cd1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(at + 192),
+				_mm_unpackhi_epi64(ab1, cd1));
+	}
+}
+
+#endif
+
+void ChaCha20Random::blocks(uint8_t* out, size_t count)
+{
+	uint32_t state[16] = {
+		0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+		key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+		0, 0, uint32_t(nonce), uint32_t(nonce >> 32)
+	};
+#if defined(__x86_64__)
+	// Little-endian, so the lanes store as the stream's bytes.
+	for (; count >= 4; count -= 4, counter += 4, out += 4 * blockBytes)
+	{
+		state[12] = uint32_t(counter);
+		state[13] = uint32_t(counter >> 32);
+		fourBlocks(state, out);
+	}
+#endif
+	for (; count > 0; count--, counter++, out += blockBytes)
+	{
+		state[12] = uint32_t(counter);
+		state[13] = uint32_t(counter >> 32);
+		uint32_t x[16];
+		std::memcpy(x, state, sizeof x);
+		doubleRounds(x);
+		for (unsigned i = 0; i < 16; i++)
+			Bytes::putWord32(out + 4 * i, x[i] + state[i]);
+	}
+}
+
+void ChaCha20Random::fill(void* data, size_t bytes)
+{
+	uint8_t* out = static_cast<uint8_t*>(data);
+	while (bytes > 0)
+	{
+		if (bufferPos == sizeof buffer)
+		{
+			// Whole blocks go straight to the output.
+			const size_t direct = bytes / blockBytes;
+			if (direct > 0)
+			{
+				blocks(out, direct);
+				out += direct * blockBytes;
+				bytes -= direct * blockBytes;
+				continue;
+			}
+			blocks(buffer, bufferBlocks);
+			bufferPos = 0;
+		}
+		const size_t take = std::min(bytes, sizeof buffer - bufferPos);
+		std::memcpy(out, buffer + bufferPos, take);
+		// Used bytes are not kept around.
+		std::memset(buffer + bufferPos, 0, take);
+		bufferPos += take;
+		out += take;
+		bytes -= take;
+	}
+}
+
+// Bumped in the child of every fork, so that a thread's stream can tell
+// it is a copy of the parent's.
+static std::atomic<unsigned> forkGeneration(0);
+
+static void forked()
+{
+	forkGeneration++;
+}
+
+ChaCha20Random& ChaCha20Random::forThread()
+{
+	static const int registered = pthread_atfork(nullptr, nullptr, forked);
+	(void) registered;
+	static thread_local ChaCha20Random stream;
+	static thread_local unsigned generation = forkGeneration;
+	// A forked child would otherwise replay the parent's output.
+	if (generation != forkGeneration)
+	{
+		stream = ChaCha20Random();
+		generation = forkGeneration;
+	}
+	return stream;
+}
+
+void ThreadRandom::fill(void* out, const size_t bytes)
+{
+	ChaCha20Random::forThread().fill(out, bytes);
+}
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include "ScratchArena.h"
+
+namespace ElGamal {
+	
+	// Limb blocks are at least this large, so a frame's buffers usually
+	// share one.
+	static const size_t minBlockLimbs = 4096;
+	
+	ScratchArena& ScratchArena::local()
+	{
+		static thread_local ScratchArena arena;
+		return arena;
+	}
+	
+	ScratchArena::Frame::Frame(const unsigned keyBits) :
+			arena(local()), slotBits(2 * (keyBits + GMP_NUMB_BITS)),
+			slotMark(arena.slotsUsed), blockMark(arena.block),
+			offsetMark(arena.offset) { }
+	
+	ScratchArena::Frame::~Frame()
+	{
+		arena.slotsUsed = slotMark;
+		arena.block = blockMark;
+		arena.offset = offsetMark;
+	}
+	
+	mpz_class& ScratchArena::Frame::mpz()
+	{
+		if (arena.slotsUsed == arena.slots.size())
+			arena.slots.emplace_back(new mpz_class);
+		mpz_class& slot = *arena.slots[arena.slotsUsed++];
+		if (mp_bitcnt_t(slot.get_mpz_t()->_mp_alloc) * GMP_NUMB_BITS < slotBits)
+			mpz_realloc2(slot.get_mpz_t(), slotBits);
+		return slot;
+	}
+	
+	mp_limb_t* ScratchArena::Frame::limbs(const size_t n)
+	{
+		auto& blocks = arena.blocks;
+		while (arena.block < blocks.size()
+				&& arena.offset + n > blocks[arena.block].size)
+		{
+			arena.block++;
+			arena.offset = 0;
+		}
+		if (arena.block == blocks.size())
+		{
+			const size_t size = std::max(n, minBlockLimbs);
+			blocks.push_back(Block{ unique_ptr<mp_limb_t[]>(
+					new mp_limb_t[size]), size });
+		}
+		mp_limb_t* out = blocks[arena.block].limbs.get() + arena.offset;
+		arena.offset += n;
+		return out;
+	}
+	
+}
@@ -0,0 +1,241 @@
+#include <cassert>
+#include <cstring>
+#include "Bytes.h"
+#include "Session.h"
+
+using Bytes::bytes;
+using Bytes::getWord32;
+using Bytes::putWord32;
+using std::lock_guard;
+using std::move;
+using std::unique_lock;
+
+namespace ObliviousTransfer
+{
+
+	// Messages taken from the transport, or handed to it, at a time.
+	static const size_t ioBatch = 64;
+
+	void Session::send(string&& payload)
+	{
+		string msg(SessionMux::headerBytes + payload.size(), '\0');
+		uint8_t* const header = bytes(msg);
+		putWord32(header, sessionId);
+		putWord32(header + 4, sendSequence++);
+		std::memcpy(header + SessionMux::headerBytes, payload.data(),
+				payload.size());
+		mux.outbox.offer(move(msg));
+	}
+
+	void Session::finish()
+	{
+		mux.finish(*this, false);
+	}
+
+	SessionMux::SessionMux(shared_ptr<Transport> _transport,
+			WorkStealingPool& _pool) : transport(move(_transport)), pool(_pool),
+			reader(&SessionMux::read, this), writer(&SessionMux::write, this) { }
+
+	SessionMux::~SessionMux()
+	{
+		close();
+		reader.join();
+	}
+
+	shared_ptr<Session> SessionMux::find(const SessionId id)
+	{
+		shared_ptr<Session>& session = sessions[id];
+		if (!session)
+			session.reset(new Session(*this, id));
+		return session;
+	}
+
+	void SessionMux::open(const SessionId id, shared_ptr<SessionHandler> handler)
+	{
+		shared_ptr<Session> session;
+		bool down;
+		{
+			lock_guard<std::mutex> lock(mut);
+			session = find(id);
+			openCount++;
+			down = linkDown;
+		}
+		{
+			lock_guard<std::mutex> lock(session->mut);
+			assert(!session->handler && !session->finished);
+			session->handler = move(handler);
+		}
+		// Ahead of any messages that arrived before the open.
+		push(session, { Session::Event::Start, string() }, true);
+		if (down)
+			push(session, { Session::Event::Fail, string() });
+	}
+
+	void SessionMux::push(const shared_ptr<Session>& session,
+			Session::Event&& event, const bool first)
+	{
+		bool schedule;
+		{
+			lock_guard<std::mutex> lock(session->mut);
+			if (session->finished)
+				return;
+			if (first)
+				session->events.push_front(move(event));
+			else
+				session->events.push_back(move(event));
+			schedule = session->handler && !session->scheduled;
+			if (schedule)
+				session->scheduled = true;
+		}
+		if (schedule)
+			pool.post([this, session] { run(session); });
+	}
+
+	void SessionMux::run(const shared_ptr<Session>& session)
+	{
+		while (true)
+		{
+			Session::Event event;
+			{
+				lock_guard<std::mutex> lock(session->mut);
+				if (session->events.empty())
+				{
+					session->scheduled = false;
+					return;
+				}
+				event = move(session->events.front());
+				session->events.pop_front();
+			}
+			switch (event.kind)
+			{
+			case Session::Event::Start:
+				session->handler->start(*session);
+				break;
+			case Session::Event::Message:
+				session->handler->receive(*session, event.payload);
+				break;
+			case Session::Event::Fail:
+				session->handler->fail(*session);
+				finish(*session, true);
+				break;
+			}
+			if (retire(*session))
+				return;
+		}
+	}
+
+	void SessionMux::finish(Session& session, const bool failed)
+	{
+		lock_guard<std::mutex> lock(session.mut);
+		if (session.finished)
+			return;
+		session.finished = true;
+		session.failed = failed;
+	}
+
+	bool SessionMux::retire(Session& session)
+	{
+		bool failed;
+		{
+			lock_guard<std::mutex> lock(session.mut);
+			if (!session.finished)
+				return false;
+			// Free the handler's state; nothing will call it.
+			session.scheduled = false;
+			session.events.clear();
+			session.handler.reset();
+			failed = session.failed;
+		}
+		// Counted only now, so that wait() returns after everything the
+		// handler did, its completion callbacks included.
+		lock_guard<std::mutex> lock(mut);
+		openCount--;
+		if (failed)
+			failures++;
+		if (openCount == 0)
+			idle.notify_all();
+		return true;
+	}
+
+	void SessionMux::read()
+	{
+		string msgs[ioBatch];
+		for (size_t got; (got = transport->recvN(msgs, ioBatch)) > 0; )
+			for (size_t i = 0; i < got; i++)
+			{
+				string& msg = msgs[i];
+				if (msg.size() < headerBytes)
+					continue;
+				const uint8_t* const header = bytes(msg);
+				const SessionId id = getWord32(header);
+				const uint32_t sequence = getWord32(header + 4);
+				shared_ptr<Session> session;
+				{
+					lock_guard<std::mutex> lock(mut);
+					session = find(id);
+				}
+
+				Session::Event event = { Session::Event::Fail, string() };
+				{
+					lock_guard<std::mutex> lock(session->mut);
+					if (session->finished)
+						continue;
+					if (sequence == session->recvSequence)
+					{
+						session->recvSequence++;
+						event.kind = Session::Event::Message;
+						msg.erase(0, headerBytes);
+						event.payload = move(msg);
+					}
+				}
+				push(session, move(event));
+			}
+
+		// The peer is gone: every session still running fails.
+		vector<shared_ptr<Session>> running;
+		{
+			lock_guard<std::mutex> lock(mut);
+			linkDown = true;
+			for (const auto& entry : sessions)
+				running.push_back(entry.second);
+		}
+		for (const auto& session : running)
+			push(session, { Session::Event::Fail, string() });
+	}
+
+	void SessionMux::write()
+	{
+		// Everything queued while the last batch was written goes out in the
+		// next one, in as few writes as the transport allows.
+		string msgs[ioBatch];
+		for (size_t got; (got = outbox.takeN(msgs, ioBatch)) > 0; )
+			if (!transport->sendN(msgs, got)
+					|| (outbox.size() == 0 && !transport->flush()))
+			{
+				outbox.close();
+				break;
+			}
+		transport->close();
+	}
+
+	bool SessionMux::wait()
+	{
+		unique_lock<std::mutex> lock(mut);
+		while (openCount > 0)
+			idle.wait(lock);
+		return failures == 0;
+	}
+
+	void SessionMux::close()
+	{
+		{
+			lock_guard<std::mutex> lock(mut);
+			if (closed)
+				return;
+			closed = true;
+		}
+		outbox.close();
+		writer.join();
+	}
+
+}
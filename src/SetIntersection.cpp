@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include "Bytes.h"
+#include "Hashing.h"
+#include "OtExtension.h"
+#include "SetIntersection.h"
+
+using Bytes::bytes;
+using Bytes::getWord;
+using Bytes::putWord;
+using ElGamal::Ed25519Group;
+using ObliviousTransfer::Digest;
+using ObliviousTransfer::OprfSender;
+using std::array;
+using std::function;
+using std::move;
+
+namespace SetIntersection
+{
+
+	enum PsiMessageType : uint8_t
+	{
+		PsiHello = 32, // sender's set size, element bytes
+		PsiParams = 33, // receiver's set size, hash layout
+		PsiTags = 34 // list index, then sorted tags
+	};
+
+	// A failed cuckoo build is retried under a fresh key.
+	static const unsigned maxAttempts = 16;
+	static const size_t tagsPerMessage = 1 << 16;
+	// False positives across all comparisons stay below 2^-statisticalBits.
+	static const unsigned statisticalBits = 40;
+	// The hash index given to the OPRF inputs of stash rows.
+	static const unsigned stashTag = maxHashCount;
+
+	typedef array<uint8_t, 16> Tag;
+
+	// SHA-256 of every element.
+	static void digestAll(const vector<string>& set, vector<Digest>& digests,
+			ThreadPool* pool)
+	{
+		digests.resize(set.size());
+		ThreadPool::parallelFor(pool, set.size(), [&](const size_t begin,
+					const size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				Sha256::hash(set[i].data(), set[i].size(), digests[i].data());
+		});
+	}
+
+	// The OPRF input for an element placed by hash h, or stashTag.
+	// Tagging the input with h keeps an element whose hashes share a bin
+	// from producing equal values in two of the sender's lists.
+	static void oprfInput(Digest& out, const Digest& digest, const unsigned h)
+	{
+		out = digest;
+		out[0] = h;
+	}
+
+	static size_t bitLength(size_t n)
+	{
+		size_t bits = 0;
+		for ( ; n > 0; n >>= 1)
+			bits++;
+		return bits;
+	}
+
+	// Tags long enough for each receiver element to meet senderTags tags.
+	static size_t tagBytes(const size_t senderTags, const size_t receiverSize)
+	{
+		return std::min<size_t>(sizeof(Tag), (statisticalBits
+				+ bitLength(senderTags) + bitLength(receiverSize) + 7) / 8);
+	}
+
+	static void randomDigest(Digest& out, RandomSource& rand)
+	{
+		rand.fill(out.data(), out.size());
+	}
+
+	static size_t elementBytes(const vector<string>& set)
+	{
+		const size_t width = set.empty() ? 0 : set[0].size();
+		for (const auto& element : set)
+		{
+			assert(element.size() == width);
+			(void) element;
+		}
+		return width;
+	}
+
+	bool otReceive(Transport& transport, const vector<string>& set,
+			vector<string>& intersection, RandomSource& rand,
+			ThreadPool* pool, const HashOptions& options)
+	{
+		intersection.clear();
+		const size_t width = elementBytes(set);
+		string msg;
+		if (!transport.recv(msg) || msg.size() != 1 + 8 + 4
+				|| uint8_t(msg[0]) != PsiHello)
+			return false;
+		const size_t senderSize = getWord(bytes(msg) + 1);
+		const size_t senderWidth = getWord(bytes(msg) + 9, 4);
+		if (!set.empty() && senderSize > 0 && senderWidth != width)
+			return false;
+
+		HashLayout layout(set.size(), options, rand);
+		vector<ElementHash> hashes;
+		BinLists lists;
+		bool built = false;
+		for (unsigned attempt = 0; attempt < maxAttempts && !built; attempt++)
+		{
+			if (attempt > 0)
+				layout.rekey(rand);
+			layout.hash(set, hashes, pool);
+			built = cuckooBins(layout, hashes, lists, pool);
+		}
+		if (!built)
+			return false;
+
+		string params(1 + 8 + HashLayout::encodedBytes, '\0');
+		params[0] = PsiParams;
+		putWord(bytes(params) + 1, set.size());
+		layout.write(bytes(params) + 9);
+		if (!transport.send(move(params)))
+			return false;
+
+		// A row per bin, then one per stash slot.  Empty ones get an input
+		// nobody will match.
+		vector<Digest> digests;
+		digestAll(set, digests, pool);
+		const size_t bins = layout.bins;
+		vector<Digest> inputs(bins + layout.stashSize), outputs;
+		for (size_t bin = 0; bin < bins; bin++)
+			if (lists.size(bin) != 0)
+				oprfInput(inputs[bin], digests[lists.begin(bin)->element],
+						lists.begin(bin)->h);
+			else
+				randomDigest(inputs[bin], rand);
+		for (size_t j = 0; j < layout.stashSize; j++)
+			if (j < lists.stash.size())
+				oprfInput(inputs[bins + j], digests[lists.stash[j]], stashTag);
+			else
+				randomDigest(inputs[bins + j], rand);
+		const Ed25519Group group;
+		if (!ObliviousTransfer::oprfReceive(transport, group, inputs, outputs,
+				rand))
+			return false;
+
+		// The sender's tags, one sorted list per hash function and one per
+		// stash row.
+		const size_t listCount = layout.hashCount + layout.stashSize;
+		const size_t tagWidth = tagBytes(listCount * senderSize, set.size());
+		vector<vector<Tag>> tags(listCount);
+		for (size_t received = 0; received < listCount * senderSize; )
+		{
+			if (!transport.recv(msg) || msg.size() < 2
+					|| uint8_t(msg[0]) != PsiTags
+					|| uint8_t(msg[1]) >= listCount
+					|| (msg.size() - 2) % tagWidth != 0)
+				return false;
+			vector<Tag>& list = tags[uint8_t(msg[1])];
+			const size_t count = (msg.size() - 2) / tagWidth;
+			for (size_t i = 0; i < count; i++)
+			{
+				Tag tag = { };
+				std::memcpy(tag.data(), bytes(msg) + 2 + i * tagWidth, tagWidth);
+				list.push_back(tag);
+			}
+			received += count;
+		}
+		for (auto& list : tags)
+			if (!std::is_sorted(list.begin(), list.end()))
+				std::sort(list.begin(), list.end());
+
+		auto matches = [&](const size_t row, const size_t list)
+		{
+			Tag tag = { };
+			std::copy(outputs[row].begin(), outputs[row].begin() + tagWidth,
+					tag.begin());
+			return std::binary_search(tags[list].begin(), tags[list].end(),
+					tag);
+		};
+		vector<size_t> found;
+		for (size_t bin = 0; bin < bins; bin++)
+			if (lists.size(bin) != 0 && matches(bin, lists.begin(bin)->h))
+				found.push_back(lists.begin(bin)->element);
+		for (size_t j = 0; j < lists.stash.size(); j++)
+			if (matches(bins + j, layout.hashCount + j))
+				found.push_back(lists.stash[j]);
+		std::sort(found.begin(), found.end());
+		for (const size_t element : found)
+			intersection.push_back(set[element]);
+		return true;
+	}
+
+	// Send one list of tags, sorted so that the order says nothing about
+	// the set's.
+	static bool sendTags(Transport& transport, const unsigned list,
+			vector<Tag>& tags, const size_t tagWidth)
+	{
+		std::sort(tags.begin(), tags.end());
+		for (size_t first = 0; first < tags.size(); first += tagsPerMessage)
+		{
+			const size_t count = std::min(tagsPerMessage, tags.size() - first);
+			string msg(2 + count * tagWidth, '\0');
+			msg[0] = PsiTags;
+			msg[1] = list;
+			for (size_t i = 0; i < count; i++)
+				std::memcpy(bytes(msg) + 2 + i * tagWidth, tags[first + i].data(),
+						tagWidth);
+			if (!transport.send(move(msg)))
+				return false;
+		}
+		return true;
+	}
+
+	bool otSend(Transport& transport, const vector<string>& set,
+			RandomSource& rand, ThreadPool* pool)
+	{
+		string msg(1 + 8 + 4, '\0');
+		msg[0] = PsiHello;
+		putWord(bytes(msg) + 1, set.size());
+		putWord(bytes(msg) + 9, elementBytes(set), 4);
+		if (!transport.send(move(msg)))
+			return false;
+
+		HashLayout layout;
+		if (!transport.recv(msg) || msg.size() != 1 + 8 + HashLayout::encodedBytes
+				|| uint8_t(msg[0]) != PsiParams
+				|| !layout.read(bytes(msg) + 9))
+			return false;
+		const size_t receiverSize = getWord(bytes(msg) + 1);
+		const size_t bins = layout.bins;
+		if (bins + layout.stashSize < receiverSize)
+			return false;
+
+		const Ed25519Group group;
+		OprfSender oprf;
+		if (!oprf.run(transport, group, bins + layout.stashSize, rand))
+			return false;
+
+		vector<Digest> digests;
+		digestAll(set, digests, pool);
+		vector<ElementHash> hashes;
+		layout.hash(set, hashes, pool);
+		BinLists lists;
+		simpleBins(layout, hashes, lists, pool);
+
+		// Bin by bin, so the OPRF rows are read in order.
+		const size_t listCount = layout.hashCount + layout.stashSize;
+		const size_t tagWidth = tagBytes(listCount * set.size(), receiverSize);
+		vector<vector<Tag>> tags(layout.hashCount, vector<Tag>(set.size()));
+		ThreadPool::parallelFor(pool, bins, [&](const size_t begin,
+					const size_t end)
+		{
+			Digest input, value;
+			for (size_t bin = begin; bin < end; bin++)
+				for (const BinEntry* entry = lists.begin(bin);
+						entry != lists.end(bin); entry++)
+				{
+					oprfInput(input, digests[entry->element], entry->h);
+					oprf.evaluate(bin, input, value);
+					Tag& tag = tags[entry->h][entry->element];
+					tag = Tag();
+					std::copy(value.begin(), value.begin() + tagWidth,
+							tag.begin());
+				}
+		});
+		for (unsigned h = 0; h < layout.hashCount; h++)
+			if (!sendTags(transport, h, tags[h], tagWidth))
+				return false;
+
+		// Every element against every stash row.
+		tags.resize(1);
+		for (size_t j = 0; j < layout.stashSize; j++)
+		{
+			ThreadPool::parallelFor(pool, set.size(), [&](const size_t begin,
+					const size_t end)
+			{
+				Digest input, value;
+				for (size_t i = begin; i < end; i++)
+				{
+					oprfInput(input, digests[i], stashTag);
+					oprf.evaluate(bins + j, input, value);
+					tags[0][i] = Tag();
+					std::copy(value.begin(), value.begin() + tagWidth,
+							tags[0][i].begin());
+				}
+			});
+			if (!sendTags(transport, layout.hashCount + j, tags[0], tagWidth))
+				return false;
+		}
+		return transport.flush();
+	}
+
+}
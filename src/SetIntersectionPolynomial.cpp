@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include "Bytes.h"
+#include "Random.h"
+#include "Sha256.h"
+#include "SetIntersection.h"
+#include "Wire.h"
+
+using Bytes::bytes;
+using Bytes::getWord;
+using Bytes::putWord;
+using ElGamal::Ciphertext;
+using ElGamal::KeyPair;
+using ElGamal::MontgomeryCiphertext;
+using ElGamal::Params;
+using ElGamal::PublicKey;
+using std::function;
+using std::move;
+using std::pair;
+
+namespace SetIntersection
+{
+
+	enum PolynomialMessageType : uint8_t
+	{
+		PolyHello = 40, // sender's set size
+		PolyParams = 41, // public key, degree, hash layout
+		PolyCoefficients = 42, // a frame of coefficients, bucket by bucket
+		PolyResults = 43 // a frame of evaluations
+	};
+
+	// The degree is set so that some bucket overflows it on fewer than 1
+	// in 2^overflowBits attempts, and an overflowing hash key is replaced.
+	static const unsigned overflowBits = 10;
+	static const unsigned maxAttempts = 16;
+	static const size_t maxDegree = 64;
+	static const size_t ciphertextsPerMessage = 1024;
+
+	// body(begin, end, rand) over [0, count), split across pool.  Each task
+	// draws from its own ChaCha20 stream, keyed from rand up front.
+	static void parallelRandom(ThreadPool* pool, const size_t count,
+			RandomSource& rand,
+			const function<void(size_t, size_t, RandomSource&)>& body)
+	{
+		if (pool == nullptr)
+		{
+			body(0, count, rand);
+			return;
+		}
+		const size_t tasks = pool->tasksFor(count);
+		vector<ChaCha20Random> streams;
+		streams.reserve(tasks);
+		for (size_t i = 0; i < tasks; i++)
+			streams.push_back(ChaCha20Random::derive(rand));
+		pool->run(tasks, [&](const size_t task)
+		{
+			body(ThreadPool::taskBegin(task, tasks, count),
+					ThreadPool::taskBegin(task + 1, tasks, count),
+					streams[task]);
+		});
+	}
+
+	// Each element's SHA-256, as an exponent.
+	static void exponentsOf(const Params& params, const vector<string>& set,
+			vector<mpz_class>& exponents, ThreadPool* pool)
+	{
+		exponents.resize(set.size());
+		ThreadPool::parallelFor(pool, set.size(), [&](const size_t begin,
+					const size_t end)
+		{
+			uint8_t digest[Sha256::digestBytes];
+			for (size_t i = begin; i < end; i++)
+			{
+				Sha256::hash(set[i].data(), set[i].size(), digest);
+				mpz_import(exponents[i].get_mpz_t(), sizeof digest, 1, 1, 0, 0,
+						digest);
+				exponents[i] %= params.order;
+			}
+		});
+	}
+
+	// The degree that count elements in buckets buckets rarely exceed,
+	// taking bucket loads as Poisson.
+	static size_t bucketDegree(const size_t count, const size_t buckets)
+	{
+		const double mean = double(count) / buckets;
+		const double bound = std::ldexp(1.0, -int(overflowBits));
+		double term = std::exp(-mean), below = term;
+		size_t degree = 0;
+		while (buckets * (1 - below) > bound && degree < maxDegree)
+		{
+			degree++;
+			term *= mean / degree;
+			below += term;
+		}
+		return std::max<size_t>(degree, 1);
+	}
+
+	// Coefficients of prod (z - root), low first, mod order.
+	static void polynomialFromRoots(const Params& params,
+			const vector<mpz_class>& roots, mpz_class* coeffs)
+	{
+		const size_t degree = roots.size();
+		coeffs[0] = 1;
+		for (size_t k = 1; k <= degree; k++)
+			coeffs[k] = 0;
+		for (size_t k = 0; k < degree; k++)
+		{
+			// Multiply the degree-k product by (z - roots[k]).
+			for (size_t i = k + 1; i > 0; i--)
+			{
+				coeffs[i] = coeffs[i - 1] - coeffs[i] * roots[k];
+				coeffs[i] %= params.order;
+			}
+			coeffs[0] *= -roots[k];
+			coeffs[0] %= params.order;
+		}
+		for (size_t k = 0; k <= degree; k++)
+			if (coeffs[k] < 0)
+				coeffs[k] += params.order;
+	}
+
+	// Send ciphers as frames of at most ciphertextsPerMessage.
+	static bool sendFrames(Transport& transport, const Params& params,
+			const uint8_t type, const vector<Ciphertext>& ciphers)
+	{
+		vector<Ciphertext> frame;
+		for (size_t first = 0; first < ciphers.size();
+				first += ciphertextsPerMessage)
+		{
+			const size_t count = std::min(ciphertextsPerMessage,
+					ciphers.size() - first);
+			frame.assign(ciphers.begin() + first,
+					ciphers.begin() + first + count);
+			string msg(1 + ElGamal::Wire::frameBytes(params, count), '\0');
+			msg[0] = type;
+			ElGamal::Wire::writeFrame(params, frame, bytes(msg) + 1);
+			if (!transport.send(move(msg)))
+				return false;
+		}
+		return true;
+	}
+
+	// Receive frames until count ciphertexts have arrived.
+	static bool recvFrames(Transport& transport, const Params& params,
+			const uint8_t type, const size_t count, vector<Ciphertext>& ciphers)
+	{
+		ciphers.clear();
+		string msg;
+		vector<Ciphertext> frame;
+		while (ciphers.size() < count)
+		{
+			if (!transport.recv(msg) || msg.size() < 1
+					|| uint8_t(msg[0]) != type
+					|| ElGamal::Wire::readFrame(params, frame, bytes(msg) + 1,
+							bytes(msg) + msg.size()) != bytes(msg) + msg.size()
+					|| frame.empty() || frame.size() > count - ciphers.size())
+				return false;
+			for (auto& cipher : frame)
+				ciphers.push_back(move(cipher));
+		}
+		return true;
+	}
+
+	bool polynomialReceive(Transport& transport, const Params& params,
+			const vector<string>& set, vector<string>& intersection,
+			RandomSource& rand, ThreadPool* pool, const HashOptions& options)
+	{
+		intersection.clear();
+		string msg;
+		if (!transport.recv(msg) || msg.size() != 1 + 8
+				|| uint8_t(msg[0]) != PolyHello)
+			return false;
+		const size_t senderSize = getWord(bytes(msg) + 1);
+
+		HashLayout layout(set.size(), options, rand);
+		const size_t buckets = layout.bins;
+		const size_t degree = bucketDegree(layout.hashCount * set.size(),
+				buckets);
+		vector<ElementHash> hashes;
+		BinLists lists;
+		bool fits = false;
+		for (unsigned attempt = 0; attempt < maxAttempts && !fits; attempt++)
+		{
+			if (attempt > 0)
+				layout.rekey(rand);
+			layout.hash(set, hashes, pool);
+			simpleBins(layout, hashes, lists, pool);
+			fits = lists.maxLoad() <= degree;
+		}
+		if (!fits)
+			return false;
+
+		const KeyPair keys = params.makeKeys(rand);
+		const PublicKey& pub = keys.second;
+		const size_t elementBytes = ElGamal::Wire::elementBytes(params);
+		string header(1 + elementBytes + 4 + HashLayout::encodedBytes, '\0');
+		header[0] = PolyParams;
+		ElGamal::Wire::writeElement(params, pub.A, bytes(header) + 1);
+		putWord(bytes(header) + 1 + elementBytes, degree, 4);
+		layout.write(bytes(header) + 1 + elementBytes + 4);
+		if (!transport.send(move(header)))
+			return false;
+
+		// Each bucket's coefficients, as Enc(g^coefficient).  Unused roots
+		// are random, so no two buckets differ in form.
+		vector<mpz_class> exponents;
+		exponentsOf(params, set, exponents, pool);
+		const size_t coeffsPerBucket = degree + 1;
+		vector<Ciphertext> coeffs(buckets * coeffsPerBucket);
+		parallelRandom(pool, buckets, rand, [&](const size_t begin,
+				const size_t end, RandomSource& taskRand)
+		{
+			vector<mpz_class> roots(degree), plain(coeffsPerBucket);
+			mpz_class power;
+			for (size_t b = begin; b < end; b++)
+			{
+				for (size_t k = 0; k < degree; k++)
+					if (k < lists.size(b))
+						roots[k] = exponents[lists.begin(b)[k].element];
+					else
+						params.randomExponent(roots[k], taskRand);
+				polynomialFromRoots(params, roots, plain.data());
+				for (size_t k = 0; k < coeffsPerBucket; k++)
+				{
+					params.modExpG(power, plain[k]);
+					pub.encrypt(coeffs[b * coeffsPerBucket + k], params, power,
+							taskRand);
+				}
+			}
+		});
+		if (!sendFrames(transport, params, PolyCoefficients, coeffs))
+			return false;
+		coeffs.clear();
+
+		// g^x for each element, sorted, to look up decryptions in.
+		vector<pair<mpz_class, size_t>> powers(set.size());
+		ThreadPool::parallelFor(pool, set.size(), [&](const size_t begin,
+					const size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				params.modExpG(powers[i].first, exponents[i]);
+				powers[i].second = i;
+			}
+		});
+		std::sort(powers.begin(), powers.end());
+
+		vector<Ciphertext> results;
+		if (!recvFrames(transport, params, PolyResults,
+				layout.hashCount * senderSize, results))
+			return false;
+		vector<mpz_class> values(results.size());
+		ThreadPool::parallelFor(pool, results.size(), [&](const size_t begin,
+				const size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				keys.first.decrypt(values[i], params, results[i]);
+		});
+
+		vector<size_t> found;
+		for (const auto& value : values)
+		{
+			const auto match = std::lower_bound(powers.begin(), powers.end(),
+					value, [](const pair<mpz_class, size_t>& power,
+							const mpz_class& v)
+					{
+						return power.first < v;
+					});
+			if (match != powers.end() && match->first == value)
+				found.push_back(match->second);
+		}
+		std::sort(found.begin(), found.end());
+		found.erase(std::unique(found.begin(), found.end()), found.end());
+		for (const size_t element : found)
+			intersection.push_back(set[element]);
+		return true;
+	}
+
+	bool polynomialSend(Transport& transport, const Params& params,
+			const vector<string>& set, RandomSource& rand, ThreadPool* pool)
+	{
+		string msg(1 + 8, '\0');
+		msg[0] = PolyHello;
+		putWord(bytes(msg) + 1, set.size());
+		if (!transport.send(move(msg)))
+			return false;
+
+		const size_t elementBytes = ElGamal::Wire::elementBytes(params);
+		mpz_class A;
+		HashLayout layout;
+		if (!transport.recv(msg)
+				|| msg.size() != 1 + elementBytes + 4 + HashLayout::encodedBytes
+				|| uint8_t(msg[0]) != PolyParams
+				|| ElGamal::Wire::readElement(params, A, bytes(msg) + 1,
+						bytes(msg) + msg.size()) == nullptr
+				|| !layout.read(bytes(msg) + 1 + elementBytes + 4))
+			return false;
+		const size_t buckets = layout.bins;
+		const size_t degree = getWord(bytes(msg) + 1 + elementBytes, 4);
+		if (degree == 0 || degree > maxDegree)
+			return false;
+		const PublicKey pub(params, A);
+
+		const size_t coeffsPerBucket = degree + 1;
+		vector<Ciphertext> coeffs;
+		if (!recvFrames(transport, params, PolyCoefficients,
+				buckets * coeffsPerBucket, coeffs))
+			return false;
+
+		vector<ElementHash> hashes;
+		layout.hash(set, hashes, pool);
+		BinLists lists;
+		simpleBins(layout, hashes, lists, pool);
+		vector<mpz_class> exponents;
+		exponentsOf(params, set, exponents, pool);
+
+		// A result per bin entry, in a random order, so that positions say
+		// nothing about which bucket, or which element, each came from.
+		vector<size_t> slot(lists.entries.size());
+		for (size_t i = 0; i < slot.size(); i++)
+			slot[i] = i;
+		for (size_t i = slot.size(); i > 1; i--)
+			std::swap(slot[i - 1], slot[rand.below(i)]);
+
+		vector<Ciphertext> results(slot.size());
+		parallelRandom(pool, buckets, rand, [&](const size_t begin,
+				const size_t end, RandomSource& taskRand)
+		{
+			vector<MontgomeryCiphertext> bucketCoeffs;
+			mpz_class r, gy;
+			for (size_t b = begin; b < end; b++)
+			{
+				if (lists.size(b) == 0)
+					continue;
+				bucketCoeffs.clear();
+				for (size_t k = 0; k < coeffsPerBucket; k++)
+					bucketCoeffs.emplace_back(params,
+							coeffs[b * coeffsPerBucket + k]);
+				for (size_t j = lists.first[b]; j < lists.first[b + 1]; j++)
+				{
+					// Enc(g^P(y)) by Horner's rule, then Enc(g^(r P(y) + y)).
+					const mpz_class& y = exponents[lists.entries[j].element];
+					MontgomeryCiphertext value = bucketCoeffs[degree];
+					for (size_t k = degree; k > 0; k--)
+					{
+						value.pow(params, y);
+						value.mult(params, bucketCoeffs[k - 1]);
+					}
+					do
+						params.randomExponent(r, taskRand);
+					while (r == 0);
+					value.pow(params, r);
+					params.modExpG(gy, y);
+					value.mult(params, gy);
+					value.rerandomize(params, pub, taskRand);
+					results[slot[j]] = value.toCiphertext(params);
+				}
+			}
+		});
+		coeffs.clear();
+
+		return sendFrames(transport, params, PolyResults, results)
+				&& transport.flush();
+	}
+
+}
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cstring>
+#include "Sha256.h"
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t roundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t initialState[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+	0x1f83d9ab, 0x5be0cd19
+};
+
+static uint32_t rotr(uint32_t x, unsigned n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void compressPortable(uint32_t* state, const uint8_t* data,
+		size_t blocks)
+{
+	for ( ; blocks > 0; blocks--, data += Sha256::blockBytes)
+	{
+		uint32_t w[64];
+		for (unsigned i = 0; i < 16; i++)
+			w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16
+					| uint32_t(data[4 * i + 2]) << 8 | data[4 * i + 3];
+		for (unsigned i = 16; i < 64; i++)
+		{
+			const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18)
+					^ (w[i - 15] >> 3);
+			const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19)
+					^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+				e = state[4], f = state[5], g = state[6], h = state[7];
+		for (unsigned i = 0; i < 64; i++)
+		{
+			const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25))
+					+ ((e & f) ^ (~e & g)) + roundConstants[i] + w[i];
+			const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22))
+					+ ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#if defined(__x86_64__)
+
+// Four rounds per group of message words; the SHA extensions keep the
+// state as ABEF and CDGH halves.
+__attribute__((target("sha,sse4.1")))
+static void compressSha(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+	const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bull,
+			0x0405060700010203ull);
+	__m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+	__m128i state1 = _mm_loadu_si128(
+			reinterpret_cast<const __m128i*>(state + 4));
+	tmp = _mm_shuffle_epi32(tmp, 0xb1); // CDAB
+	state1 = _mm_shuffle_epi32(state1, 0x1b); // EFGH
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0); // CDGH
+
+	for ( ; blocks > 0; blocks--, data += Sha256::blockBytes)
+	{
+		const __m128i saved0 = state0, saved1 = state1;
+		__m128i w[4];
+#pragma GCC unroll 16
+		for (unsigned group = 0; group < 16; group++)
+		{
+			__m128i& next = w[group % 4];
+			if (group < 4)
+				next = _mm_shuffle_epi8(_mm_loadu_si128(
+						reinterpret_cast<const __m128i*>(data + 16 * group)),
+						byteSwap);
+			else
+			{
+				const __m128i& prev = w[(group + 3) % 4];
+				next = _mm_sha256msg2_epu32(_mm_add_epi32(
+						_mm_sha256msg1_epu32(next, w[(group + 1) % 4]),
+						_mm_alignr_epi8(prev, w[(group + 2) % 4], 4)), prev);
+			}
+			__m128i msg = _mm_add_epi32(next, _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(roundConstants + 4 * group)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+		state0 = _mm_add_epi32(state0, saved0);
+		state1 = _mm_add_epi32(state1, saved1);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b); // FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xb1); // DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0); // DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8); // HGFE
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+static bool cpuHasSha()
+{
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	const bool sha = ebx & (1u << 29);
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	const bool sse41 = ecx & (1u << 19), ssse3 = ecx & (1u << 9);
+	return sha && sse41 && ssse3;
+}
+
+static void (* const compressBest)(uint32_t*, const uint8_t*, size_t) =
+		cpuHasSha() ? compressSha : compressPortable;
+
+#else
+
+static void (* const compressBest)(uint32_t*, const uint8_t*, size_t) =
+		compressPortable;
+
+#endif
+
+Sha256::Sha256()
+{
+	std::memcpy(state, initialState, sizeof state);
+}
+
+void Sha256::initialize(uint32_t* state)
+{
+	std::memcpy(state, initialState, sizeof initialState);
+}
+
+void Sha256::compress(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+	compressBest(state, data, blocks);
+}
+
+bool Sha256::accelerated()
+{
+	return compressBest != compressPortable;
+}
+
+void Sha256::update(const void* data, size_t bytes)
+{
+	const uint8_t* in = static_cast<const uint8_t*>(data);
+	length += bytes;
+	if (buffered > 0)
+	{
+		const size_t take = std::min(bytes, blockBytes - buffered);
+		std::memcpy(buffer + buffered, in, take);
+		buffered += take;
+		in += take;
+		bytes -= take;
+		if (buffered < blockBytes)
+			return;
+		compress(state, buffer, 1);
+		buffered = 0;
+	}
+	compress(state, in, bytes / blockBytes);
+	in += bytes / blockBytes * blockBytes;
+	buffered = bytes % blockBytes;
+	std::memcpy(buffer, in, buffered);
+}
+
+void Sha256::final(uint8_t* digest)
+{
+	// 0x80, zeros, then the bit length big-endian in the last 8 bytes.
+	const uint64_t bits = length * 8;
+	buffer[buffered++] = 0x80;
+	if (buffered > blockBytes - 8)
+	{
+		std::memset(buffer + buffered, 0, blockBytes - buffered);
+		compress(state, buffer, 1);
+		buffered = 0;
+	}
+	std::memset(buffer + buffered, 0, blockBytes - 8 - buffered);
+	for (unsigned i = 0; i < 8; i++)
+		buffer[blockBytes - 1 - i] = bits >> (8 * i);
+	compress(state, buffer, 1);
+
+	for (unsigned i = 0; i < 8; i++)
+		for (unsigned j = 0; j < 4; j++)
+			digest[4 * i + j] = state[i] >> (24 - 8 * j);
+
+	std::memcpy(state, initialState, sizeof state);
+	buffered = 0;
+	length = 0;
+}
+
+void Sha256::hash(const void* data, size_t bytes, uint8_t* digest)
+{
+	Sha256 sha;
+	sha.update(data, bytes);
+	sha.final(digest);
+}
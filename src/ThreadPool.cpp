@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "ThreadPool.h"
+
+using std::atomic;
+using std::lock_guard;
+using std::unique_lock;
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, thread::hardware_concurrency());
+	workers.reserve(threads);
+	for (unsigned i = 0; i < threads; i++)
+		workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(mut);
+		stopping = true;
+	}
+	cv.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::work()
+{
+	unique_lock<mutex> lock(mut);
+	while (true)
+	{
+		while (!stopping && jobs.empty())
+			cv.wait(lock);
+		if (jobs.empty())
+			return;
+		
+		function<void()> job = std::move(jobs.front());
+		jobs.pop();
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+}
+
+size_t ThreadPool::tasksFor(const size_t count) const
+{
+	return std::max<size_t>(1, std::min<size_t>(count, 4 * (size() + 1)));
+}
+
+void ThreadPool::run(const size_t tasks, const function<void(size_t)>& task)
+{
+	if (tasks == 0)
+		return;
+	
+	// Helpers and the caller claim task indices from a shared counter; a
+	// helper that starts after every index is claimed simply returns.
+	struct Batch
+	{
+		atomic<size_t> next{0};
+		size_t done = 0;
+		mutex mut;
+		condition_variable cv;
+	};
+	auto batch = std::make_shared<Batch>();
+	auto drain = [batch, tasks, &task]
+	{
+		size_t ran = 0;
+		for (size_t i; (i = batch->next++) < tasks; ran++)
+			task(i);
+		if (ran == 0)
+			return;
+		lock_guard<mutex> lock(batch->mut);
+		batch->done += ran;
+		if (batch->done == tasks)
+			batch->cv.notify_all();
+	};
+	
+	{
+		lock_guard<mutex> lock(mut);
+		const size_t helpers = std::min<size_t>(size(), tasks - 1);
+		for (size_t i = 0; i < helpers; i++)
+			jobs.push(drain);
+	}
+	cv.notify_all();
+	
+	drain();
+	unique_lock<mutex> lock(batch->mut);
+	while (batch->done < tasks)
+		batch->cv.wait(lock);
+}
+
+void ThreadPool::parallelFor(const size_t count,
+		const function<void(size_t, size_t)>& body)
+{
+	const size_t tasks = tasksFor(count);
+	run(tasks, [&](const size_t i)
+	{
+		body(taskBegin(i, tasks, count), taskBegin(i + 1, tasks, count));
+	});
+}
+
+void ThreadPool::parallelFor(ThreadPool* const pool, const size_t count,
+		const function<void(size_t, size_t)>& body)
+{
+	if (pool == nullptr)
+		body(0, count);
+	else
+		pool->parallelFor(count, body);
+}
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Instrument.h"
+#include "Transport.h"
+
+using std::lock_guard;
+using std::make_shared;
+using std::move;
+
+namespace ObliviousTransfer
+{
+
+	static void countMessages(const Instrument::Counter messages,
+			const Instrument::Counter bytes, const string* msgs, const size_t n)
+	{
+		if (!Instrument::enabled)
+			return;
+		size_t total = 0;
+		for (size_t i = 0; i < n; i++)
+			total += msgs[i].size();
+		Instrument::count(messages, n);
+		Instrument::count(bytes, total);
+	}
+
+	// One direction of an in-process link is a ring buffer; each end sends
+	// into one and receives from the other.  One thread may send and one
+	// may receive on each end.
+	class MemoryTransport : public Transport
+	{
+		shared_ptr<SpscBuffer<string>> inbox, outbox;
+		size_t sendWindow;
+		std::mutex sendMut; // pending, against a receive's flush
+		vector<string> pending;
+		std::thread::id sender; // of the last sendN
+
+		bool flushPending()
+		{
+			const size_t sent = outbox->offerN(pending.data(), pending.size());
+			const bool ok = sent == pending.size();
+			pending.clear();
+			return ok;
+		}
+
+	public:
+		MemoryTransport(shared_ptr<SpscBuffer<string>> _inbox,
+				shared_ptr<SpscBuffer<string>> _outbox, size_t _sendWindow) :
+				inbox(move(_inbox)), outbox(move(_outbox)),
+				sendWindow(std::max<size_t>(1, _sendWindow)) { }
+
+		~MemoryTransport() override
+		{
+			close();
+		}
+
+		bool sendN(string* msgs, size_t n) override
+		{
+			countMessages(Instrument::ChannelMessagesSent,
+					Instrument::ChannelBytesSent, msgs, n);
+			lock_guard<std::mutex> lock(sendMut);
+			sender = std::this_thread::get_id();
+			for (size_t i = 0; i < n; i++)
+			{
+				pending.push_back(move(msgs[i]));
+				if (pending.size() >= sendWindow && !flushPending())
+					return false;
+			}
+			return true;
+		}
+
+		bool flush() override
+		{
+			lock_guard<std::mutex> lock(sendMut);
+			return flushPending();
+		}
+
+		size_t recvN(string* out, size_t max) override
+		{
+			// As SocketTransport::recvN.
+			if (inbox->size() == 0)
+			{
+				std::unique_lock<std::mutex> lock(sendMut, std::try_to_lock);
+				if (lock.owns_lock() && sender == std::this_thread::get_id())
+					flushPending();
+			}
+			size_t got;
+			{
+				Instrument::Timer timer(Instrument::ChannelWaitNanos);
+				got = inbox->takeN(out, max);
+			}
+			countMessages(Instrument::ChannelMessagesReceived,
+					Instrument::ChannelBytesReceived, out, got);
+			return got;
+		}
+
+		void close() override
+		{
+			flush();
+			outbox->close();
+		}
+	};
+
+	pair<shared_ptr<Transport>, shared_ptr<Transport>> memoryPair(
+			const size_t sendWindow, const size_t capacity)
+	{
+		auto aToB = make_shared<SpscBuffer<string>>(capacity);
+		auto bToA = make_shared<SpscBuffer<string>>(capacity);
+		return std::make_pair(
+				make_shared<MemoryTransport>(bToA, aToB, sendWindow),
+				make_shared<MemoryTransport>(aToB, bToA, sendWindow));
+	}
+
+	// Reads at least this large bypass the read buffer.
+	static const size_t readBufBytes = 64 * 1024;
+
+	SocketTransport::SocketTransport(const int _fd, const size_t _sendWindow,
+			const size_t _maxFrame) : fd(_fd),
+			sendWindow(std::max<size_t>(1, _sendWindow)), maxFrame(_maxFrame),
+			readBuf(readBufBytes) { }
+
+	SocketTransport::~SocketTransport()
+	{
+		if (!sendClosed)
+			flushPending();
+		::close(fd);
+	}
+
+	bool SocketTransport::sendN(string* msgs, const size_t n)
+	{
+		countMessages(Instrument::ChannelMessagesSent,
+				Instrument::ChannelBytesSent, msgs, n);
+		lock_guard<std::mutex> lock(sendMut);
+		if (sendClosed)
+			return false;
+		sender = std::this_thread::get_id();
+		for (size_t i = 0; i < n; i++)
+		{
+			if (msgs[i].size() > UINT32_MAX)
+				return false;
+			pendingHeaders.push_back(htonl(msgs[i].size()));
+			pending.push_back(move(msgs[i]));
+			if (pending.size() >= sendWindow && !flushPending())
+				return false;
+		}
+		return true;
+	}
+
+	bool SocketTransport::flush()
+	{
+		lock_guard<std::mutex> lock(sendMut);
+		return flushPending();
+	}
+
+	bool SocketTransport::flushPending()
+	{
+		// Gather headers and payloads in place, at most IOV_MAX at a time.
+		vector<iovec> iov;
+		iov.reserve(std::min<size_t>(2 * pending.size(), IOV_MAX));
+		bool ok = true;
+		for (size_t next = 0; ok && next < pending.size(); )
+		{
+			iov.clear();
+			for ( ; next < pending.size() && iov.size() + 2 <= IOV_MAX; next++)
+			{
+				iov.push_back({ &pendingHeaders[next], sizeof(uint32_t) });
+				if (!pending[next].empty())
+					iov.push_back({ &pending[next][0], pending[next].size() });
+			}
+
+			iovec* cur = iov.data();
+			size_t left = iov.size();
+			while (left > 0)
+			{
+				msghdr msg = {};
+				msg.msg_iov = cur;
+				msg.msg_iovlen = left;
+				// MSG_NOSIGNAL: a closed peer is an error, not SIGPIPE.
+				ssize_t written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+				if (written < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					ok = false;
+					break;
+				}
+				// Skip what was written, splitting a partial iovec.
+				while (left > 0 && static_cast<size_t>(written) >= cur->iov_len)
+				{
+					written -= cur->iov_len;
+					cur++;
+					left--;
+				}
+				if (left > 0)
+				{
+					cur->iov_base = static_cast<char*>(cur->iov_base) + written;
+					cur->iov_len -= written;
+				}
+			}
+		}
+		pending.clear();
+		pendingHeaders.clear();
+		return ok;
+	}
+
+	bool SocketTransport::fill()
+	{
+		if (readBegin > 0)
+		{
+			std::memmove(readBuf.data(), readBuf.data() + readBegin,
+					readEnd - readBegin);
+			readEnd -= readBegin;
+			readBegin = 0;
+		}
+		while (true)
+		{
+			const ssize_t got = ::read(fd, readBuf.data() + readEnd,
+					readBuf.size() - readEnd);
+			if (got > 0)
+			{
+				readEnd += got;
+				return true;
+			}
+			if (got < 0 && errno == EINTR)
+				continue;
+			return false;
+		}
+	}
+
+	bool SocketTransport::recvOne(string& out)
+	{
+		while (readEnd - readBegin < sizeof(uint32_t))
+			if (!fill())
+				return false;
+		uint32_t header;
+		std::memcpy(&header, &readBuf[readBegin], sizeof header);
+		readBegin += sizeof header;
+		const size_t length = ntohl(header);
+		if (length > maxFrame)
+		{
+			// The stream can't be resynchronized, so give it up.
+			recvFailed = true;
+			readBegin = readEnd = 0;
+			shutdown(fd, SHUT_RDWR);
+			return false;
+		}
+
+		out.resize(length);
+		size_t have = std::min(length, readEnd - readBegin);
+		std::memcpy(&out[0], &readBuf[readBegin], have);
+		readBegin += have;
+
+		// Read the rest of a large payload directly into out, with any
+		// bytes past it landing in the (now empty) read buffer.
+		if (length - have >= readBufBytes / 2)
+		{
+			readBegin = readEnd = 0;
+			while (have < length)
+			{
+				iovec iov[2] = {
+					{ &out[have], length - have },
+					{ readBuf.data(), readBuf.size() }
+				};
+				const ssize_t got = readv(fd, iov, 2);
+				if (got < 0 && errno == EINTR)
+					continue;
+				if (got <= 0)
+					return false;
+				const size_t payload = std::min<size_t>(got, length - have);
+				have += payload;
+				readEnd = got - payload;
+			}
+			return true;
+		}
+
+		while (have < length)
+		{
+			if (!fill())
+				return false;
+			const size_t more = std::min(length - have, readEnd - readBegin);
+			std::memcpy(&out[have], &readBuf[readBegin], more);
+			readBegin += more;
+			have += more;
+		}
+		return true;
+	}
+
+	bool SocketTransport::frameBuffered() const
+	{
+		uint32_t header;
+		if (readEnd - readBegin < sizeof header)
+			return false;
+		std::memcpy(&header, &readBuf[readBegin], sizeof header);
+		return readEnd - readBegin - sizeof header >= ntohl(header);
+	}
+
+	size_t SocketTransport::recvN(string* out, const size_t max)
+	{
+		if (max == 0 || recvFailed)
+			return 0;
+
+		// A reply may depend on what this thread has queued, so never block
+		// with it unsent.  What another thread queued is its own to flush:
+		// writing it here, or waiting on that thread's write, could leave
+		// both ends blocked in writes that neither end reads.
+		if (!frameBuffered())
+		{
+			std::unique_lock<std::mutex> lock(sendMut, std::try_to_lock);
+			if (lock.owns_lock() && sender == std::this_thread::get_id())
+				flushPending();
+		}
+
+		{
+			Instrument::Timer timer(Instrument::ChannelWaitNanos);
+			if (!recvOne(out[0]))
+				return 0;
+		}
+
+		// Then take whatever further frames are already complete.
+		size_t got = 1;
+		while (got < max && frameBuffered() && recvOne(out[got]))
+			got++;
+		countMessages(Instrument::ChannelMessagesReceived,
+				Instrument::ChannelBytesReceived, out, got);
+		return got;
+	}
+
+	void SocketTransport::close()
+	{
+		lock_guard<std::mutex> lock(sendMut);
+		if (sendClosed)
+			return;
+		flushPending();
+		shutdown(fd, SHUT_WR);
+		sendClosed = true;
+	}
+
+	static void setNoDelay(const int fd)
+	{
+		// Frames are already coalesced; Nagle would only add latency.
+		const int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	}
+
+	shared_ptr<Listener> Listener::tcp(const uint16_t port, const string& host)
+	{
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+			return nullptr;
+
+		const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return nullptr;
+		const int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0
+				|| listen(fd, SOMAXCONN) != 0)
+		{
+			::close(fd);
+			return nullptr;
+		}
+		return shared_ptr<Listener>(new Listener(fd, ""));
+	}
+
+	static bool unixAddress(const string& path, sockaddr_un& addr)
+	{
+		addr = {};
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof addr.sun_path)
+			return false;
+		std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+		return true;
+	}
+
+	shared_ptr<Listener> Listener::unixDomain(const string& path)
+	{
+		sockaddr_un addr;
+		if (!unixAddress(path, addr))
+			return nullptr;
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return nullptr;
+		unlink(path.c_str());
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0
+				|| listen(fd, SOMAXCONN) != 0)
+		{
+			::close(fd);
+			return nullptr;
+		}
+		return shared_ptr<Listener>(new Listener(fd, path));
+	}
+
+	Listener::~Listener()
+	{
+		::close(fd);
+		if (!unixPath.empty())
+			unlink(unixPath.c_str());
+	}
+
+	uint16_t Listener::port() const
+	{
+		sockaddr_in addr = {};
+		socklen_t len = sizeof addr;
+		if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0
+				|| addr.sin_family != AF_INET)
+			return 0;
+		return ntohs(addr.sin_port);
+	}
+
+	shared_ptr<Transport> Listener::accept(const size_t sendWindow,
+			const size_t maxFrame)
+	{
+		int conn;
+		do
+			conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+		while (conn < 0 && errno == EINTR);
+		if (conn < 0)
+			return nullptr;
+		if (unixPath.empty())
+			setNoDelay(conn);
+		return make_shared<SocketTransport>(conn, sendWindow, maxFrame);
+	}
+
+	shared_ptr<Transport> connectTcp(const string& host, const uint16_t port,
+			const size_t sendWindow, const size_t maxFrame)
+	{
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* addrs;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+				&addrs) != 0)
+			return nullptr;
+
+		int fd = -1;
+		for (addrinfo* a = addrs; a != nullptr && fd < 0; a = a->ai_next)
+		{
+			fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC,
+					a->ai_protocol);
+			if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+			{
+				::close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(addrs);
+		if (fd < 0)
+			return nullptr;
+		setNoDelay(fd);
+		return make_shared<SocketTransport>(fd, sendWindow, maxFrame);
+	}
+
+	shared_ptr<Transport> connectUnix(const string& path,
+			const size_t sendWindow, const size_t maxFrame)
+	{
+		sockaddr_un addr;
+		if (!unixAddress(path, addr))
+			return nullptr;
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return nullptr;
+		if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0)
+		{
+			::close(fd);
+			return nullptr;
+		}
+		return make_shared<SocketTransport>(fd, sendWindow, maxFrame);
+	}
+
+	pair<shared_ptr<Transport>, shared_ptr<Transport>> socketPair(
+			const size_t sendWindow, const size_t maxFrame)
+	{
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+			return std::make_pair(nullptr, nullptr);
+		return std::make_pair(
+				make_shared<SocketTransport>(fds[0], sendWindow, maxFrame),
+				make_shared<SocketTransport>(fds[1], sendWindow, maxFrame));
+	}
+
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "Wire.h"
+
+namespace ElGamal {
+namespace Wire {
+	
+	static uint8_t* writeU32(uint32_t n, uint8_t* out)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+			*out++ = n >> shift;
+		return out;
+	}
+	
+	static const uint8_t* readU32(uint32_t& n, const uint8_t* in)
+	{
+		n = 0;
+		for (int i = 0; i < 4; i++)
+			n = n << 8 | *in++;
+		return in;
+	}
+	
+	size_t elementBytes(const Params& params)
+	{
+		return params.keyBytes();
+	}
+	
+	size_t ciphertextBytes(const Params& params)
+	{
+		return 2 * elementBytes(params);
+	}
+	
+	size_t shareBytes(const Params& params)
+	{
+		return 4 + elementBytes(params);
+	}
+	
+	size_t frameBytes(const Params& params, const size_t count)
+	{
+		return 6 + count * ciphertextBytes(params);
+	}
+	
+	uint8_t* writeElement(const Params& params, const mpz_class& n,
+			uint8_t* out)
+	{
+		assert(sgn(n) >= 0 && n < params.p);
+		const size_t width = elementBytes(params);
+		const size_t used = sgn(n) == 0 ? 0
+				: (mpz_sizeinbase(n.get_mpz_t(), 2) + 7) / 8;
+		std::memset(out, 0, width - used);
+		mpz_export(out + width - used, nullptr, 1, 1, 1, 0, n.get_mpz_t());
+		return out + width;
+	}
+	
+	const uint8_t* readElement(const Params& params, mpz_class& n,
+			const uint8_t* in, const uint8_t* end)
+	{
+		const size_t width = elementBytes(params);
+		if (in == nullptr || static_cast<size_t>(end - in) < width)
+			return nullptr;
+		mpz_import(n.get_mpz_t(), width, 1, 1, 1, 0, in);
+		return n < params.p ? in + width : nullptr;
+	}
+	
+	uint8_t* write(const Params& params, const Ciphertext& cipher,
+			uint8_t* out)
+	{
+		return writeElement(params, cipher.c,
+				writeElement(params, cipher.B, out));
+	}
+	
+	const uint8_t* read(const Params& params, Ciphertext& cipher,
+			const uint8_t* in, const uint8_t* end)
+	{
+		return readElement(params, cipher.c,
+				readElement(params, cipher.B, in, end), end);
+	}
+	
+	uint8_t* write(const Params& params, const DecryptShare& share,
+			uint8_t* out)
+	{
+		return writeElement(params, share.share, writeU32(share.x, out));
+	}
+	
+	const uint8_t* read(const Params& params, DecryptShare& share,
+			const uint8_t* in, const uint8_t* end)
+	{
+		if (in == nullptr || end - in < 4)
+			return nullptr;
+		uint32_t x;
+		in = readU32(x, in);
+		share.x = x;
+		return readElement(params, share.share, in, end);
+	}
+	
+	static uint8_t* writeFrameHeader(const Params& params, const size_t count,
+			uint8_t* out)
+	{
+		const size_t width = elementBytes(params);
+		assert(count <= UINT32_MAX && width <= UINT16_MAX);
+		out = writeU32(count, out);
+		*out++ = width >> 8;
+		*out++ = width;
+		return out;
+	}
+	
+	// The element count, or -1 if the header is short, for another width,
+	// or promises more than the input holds.
+	static long readFrameHeader(const Params& params, const uint8_t*& in,
+			const uint8_t* end)
+	{
+		if (in == nullptr || end - in < 6)
+			return -1;
+		uint32_t count;
+		in = readU32(count, in);
+		const size_t width = size_t(in[0]) << 8 | in[1];
+		in += 2;
+		if (width != elementBytes(params)
+				|| static_cast<size_t>(end - in) / ciphertextBytes(params) < count)
+			return -1;
+		return count;
+	}
+	
+	uint8_t* writeFrame(const Params& params,
+			const vector<Ciphertext>& ciphers, uint8_t* out)
+	{
+		out = writeFrameHeader(params, ciphers.size(), out);
+		for (const auto& cipher : ciphers)
+			out = write(params, cipher, out);
+		return out;
+	}
+	
+	const uint8_t* readFrame(const Params& params, vector<Ciphertext>& ciphers,
+			const uint8_t* in, const uint8_t* end)
+	{
+		const long count = readFrameHeader(params, in, end);
+		if (count < 0)
+			return nullptr;
+		
+		ciphers.resize(count);
+		for (auto& cipher : ciphers)
+			in = read(params, cipher, in, end);
+		return in;
+	}
+	
+	// Limbs to and from big-endian bytes, without going through mpz_t.
+	static uint8_t* writeLimbs(const mp_limb_t* limbs, const size_t width,
+			uint8_t* out)
+	{
+		for (size_t i = width; i-- > 0; )
+			*out++ = limbs[i / sizeof(mp_limb_t)] >> (8 * (i % sizeof(mp_limb_t)));
+		return out;
+	}
+	
+	static const uint8_t* readLimbs(mp_limb_t* limbs, const mp_size_t count,
+			const size_t width, const uint8_t* in)
+	{
+		std::fill(limbs, limbs + count, 0);
+		for (size_t i = width; i-- > 0; )
+			limbs[i / sizeof(mp_limb_t)] |=
+					mp_limb_t(*in++) << (8 * (i % sizeof(mp_limb_t)));
+		return in;
+	}
+	
+	uint8_t* writeFrame(const Params& params, const CiphertextBatch& batch,
+			uint8_t* out)
+	{
+		const MontgomeryContext& m = *params.mont;
+		const size_t width = elementBytes(params);
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(m.scratchLimbs());
+		mp_limb_t* value = frame.limbs(m.limbs());
+		
+		out = writeFrameHeader(params, batch.size(), out);
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			const CiphertextBatch::ConstElementView element = batch[i];
+			m.fromMont(value, element.B, scratch);
+			out = writeLimbs(value, width, out);
+			m.fromMont(value, element.c, scratch);
+			out = writeLimbs(value, width, out);
+		}
+		return out;
+	}
+	
+	const uint8_t* readFrame(const Params& params, CiphertextBatch& batch,
+			const uint8_t* in, const uint8_t* end)
+	{
+		const long count = readFrameHeader(params, in, end);
+		if (count < 0)
+			return nullptr;
+		
+		const MontgomeryContext& m = *params.mont;
+		const size_t width = elementBytes(params);
+		ScratchArena::Frame frame(params.keyBits);
+		mp_limb_t* scratch = frame.limbs(m.scratchLimbs());
+		mp_limb_t* value = frame.limbs(m.limbs());
+		
+		batch.resize(params, count);
+		for (long i = 0; i < count; i++)
+		{
+			const CiphertextBatch::ElementView element = batch[i];
+			for (mp_limb_t* component : { element.B, element.c })
+			{
+				in = readLimbs(value, m.limbs(), width, in);
+				if (mpn_cmp(value, m.modulusLimbs(), m.limbs()) >= 0)
+					return nullptr;
+				m.toMont(component, value, scratch);
+			}
+		}
+		return in;
+	}
+	
+}
+}
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include "WorkStealingPool.h"
+
+using std::lock_guard;
+using std::unique_lock;
+
+// The pool and queue of the worker running on this thread, if any.
+static thread_local const WorkStealingPool* currentPool = nullptr;
+static thread_local size_t currentQueue = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, thread::hardware_concurrency());
+	queues.reserve(threads);
+	for (unsigned i = 0; i < threads; i++)
+		queues.emplace_back(new Queue);
+	workers.reserve(threads);
+	for (unsigned i = 0; i < threads; i++)
+		workers.emplace_back(&WorkStealingPool::work, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		lock_guard<mutex> lock(idleMut);
+		stopping = true;
+	}
+	idleCv.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void WorkStealingPool::post(function<void()> task)
+{
+	const size_t q = currentPool == this ? currentQueue
+			: nextQueue++ % queues.size();
+	// Counted before it is visible, so the count never goes below the
+	// tasks queued.  Pairs with the sleeper's count-then-check: one of the
+	// two sees the other.
+	queued.fetch_add(1);
+	{
+		lock_guard<mutex> lock(queues[q]->mut);
+		queues[q]->tasks.push_back(std::move(task));
+	}
+	if (sleeping.load() > 0)
+	{
+		lock_guard<mutex> lock(idleMut);
+		idleCv.notify_one();
+	}
+}
+
+bool WorkStealingPool::runOne(const size_t self)
+{
+	function<void()> task;
+	for (size_t i = 0; i < queues.size() && !task; i++)
+	{
+		Queue& queue = *queues[(self + i) % queues.size()];
+		lock_guard<mutex> lock(queue.mut);
+		if (queue.tasks.empty())
+			continue;
+		if (i == 0)
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+	}
+	if (!task)
+		return false;
+	queued.fetch_sub(1);
+	task();
+	return true;
+}
+
+void WorkStealingPool::work(const size_t self)
+{
+	currentPool = this;
+	currentQueue = self;
+	while (true)
+	{
+		if (runOne(self))
+			continue;
+
+		unique_lock<mutex> lock(idleMut);
+		sleeping.fetch_add(1);
+		while (!stopping && queued.load() == 0)
+			idleCv.wait(lock);
+		sleeping.fetch_sub(1);
+		if (stopping && queued.load() == 0)
+			return;
+	}
+}
@@ -1,34 +1,18 @@
 #include <iostream>
+#include "Bytes.h"
+#include "DiscreteLog.h"
+#include "Ed25519.h"
 #include "ElGamal.h"
+#include "Hashing.h"
+#include "Instrument.h"
+#include "PrecomputeCache.h"
+#include "Random.h"
+#include "Sha256.h"
 
 using namespace std;
 using namespace ElGamal;
 
-// WolframAlpha: NextPrime[RandomInteger[{2^2047, 2^2048 - 1}]]
-const mpz_class examplePrime2048("232694713771420053057630659213799416664731018"
-		"9359913423003833628344403322850843540167605845929639947507378497669310"
-		"2762094021960948437186598373448972361943112395383369839334032056711919"
-		"9920031245087329849131698258142680893603082257798623479652433420482940"
-		"3617547495329660017332424979362164574574781241001013805001492416897769"
-		"6064860217934423820631768414917668025181498424391491613419411424646499"
-		"8299225473626180129133915073742515526257311774033375074610794958570909"
-		"7600402059690183762551033097266501366844931910700964368934454192256450"
-		"1337067551530076879504006300195645658951599597753082457935644344685069"
-		"504949373939");
-
-// WolframAlpha: NextPrime[RandomInteger[{2^511, 2^512 - 1}]]
-const mpz_class examplePrime512("1188079157195371837740287837372032314777428766"
-		"8030217970706261563262339372869147702623362771035225481725961888214611"
-		"801269114442842045500352749369483590123");
-
-// WolframAlpha: NextPrime[RandomInteger[{2^15, 2^16 - 1}]]
-const mpz_class examplePrime16(64151);
-
-// WolframAlpha: NextPrime[RandomInteger[{2^7, 2^8 - 1}]]
-const mpz_class examplePrime8(149);
-
-
-void testBasicElGamal(const Params& params, gmp_randclass& rand)
+void testBasicElGamal(const Params& params, RandomSource& rand)
 {
 	const KeyPair keyPair = params.makeKeys(rand);
 	const PrivateKey priv = get<PrivateKey>(keyPair);
@@ -50,7 +34,7 @@ void testBasicElGamal(const Params& params, gmp_randclass& rand)
 	cout << "recoveredMsg=" << recoveredMsg.get_mpz_t() << endl;
 }
 
-void testExpElGamal(const Params& params, gmp_randclass& rand)
+void testExpElGamal(const Params& params, RandomSource& rand)
 {
 	const KeyPair keyPair = params.makeKeys(rand);
 	const PrivateKey priv = get<PrivateKey>(keyPair);
@@ -75,7 +59,7 @@ void testExpElGamal(const Params& params, gmp_randclass& rand)
 			<< ", recoveredMsg=" << recoveredMsg << endl;
 }
 
-void testHomomorphicExpElGamal(const Params& params, gmp_randclass& rand)
+void testHomomorphicExpElGamal(const Params& params, RandomSource& rand)
 {
 	const KeyPair keyPair = params.makeKeys(rand);
 	const PrivateKey priv = get<PrivateKey>(keyPair);
@@ -83,17 +67,22 @@ void testHomomorphicExpElGamal(const Params& params, gmp_randclass& rand)
 	cout << "PrivateKey: a=" << priv.a.get_mpz_t() << "\n\n";
 	cout << "PublicKey: A=" << pub.A.get_mpz_t() << "\n\n";
 	
-	unsigned addend1, addend2;
-	cout << "Enter first addend (number in range [0, " << params.keyBits
+	// Sums can leave [0, keyBits), where 2^sum is no longer a power of 2
+	// mod p, so decode them with a discrete log table instead.
+	const DiscreteLog dlog(params, 2, 1ul << 20);
+	const unsigned long maxAddend = dlog.maxValue() / 2;
+	
+	unsigned long addend1, addend2;
+	cout << "Enter first addend (number in range [0, " << maxAddend
 			<< ")): " << flush;
 	cin >> addend1;
-	mpz_class expAddend1 = powerOf2(addend1);
+	mpz_class expAddend1 = params.modExp(2, mpz_class(addend1), publicExponent);
 	cout << "addend1=" << addend1
 			<< ", expAddend1=" << expAddend1.get_mpz_t() << "\n\n";
-	cout << "Enter second addend (number in range [0, " << params.keyBits
+	cout << "Enter second addend (number in range [0, " << maxAddend
 			<< ")): " << flush;
 	cin >> addend2;
-	mpz_class expAddend2 = powerOf2(addend2);
+	mpz_class expAddend2 = params.modExp(2, mpz_class(addend2), publicExponent);
 	cout << "addend2=" << addend2
 			<< ", expAddend2=" << expAddend2.get_mpz_t() << "\n\n";
 	
@@ -110,12 +99,12 @@ void testHomomorphicExpElGamal(const Params& params, gmp_randclass& rand)
 			<< ", c=" << cipherExpSum.c.get_mpz_t() << "\n\n";
 	
 	const mpz_class recoveredExpSum = priv.decrypt(params, cipherExpSum);
-	const int recoveredSum = tryLogBase2(params, recoveredExpSum);
+	const long recoveredSum = dlog.decode(recoveredExpSum);
 	cout << "recoveredExpSum=" << recoveredExpSum.get_mpz_t()
 			<< ", recoveredSum=" << recoveredSum << endl;
 }
 
-void testThresholdElGamal(const Params& params, gmp_randclass& rand)
+void testThresholdElGamal(const Params& params, RandomSource& rand)
 {
 	const KeyPair keyPair = params.makeKeys(rand);
 	const PrivateKey priv = get<PrivateKey>(keyPair);
@@ -130,7 +119,7 @@ void testThresholdElGamal(const Params& params, gmp_randclass& rand)
 	
 	const vector<Keyshare> keyshares = priv.generateShares(params,
 			numKeyshares, numKeyshares, rand);
-	for (auto share : keyshares)
+	for (const auto& share : keyshares)
 		cout << "Keyshare: x=" << share.x
 				<< ", y=" << share.y.get_mpz_t() << '\n';
 	cout << '\n';
@@ -145,16 +134,23 @@ void testThresholdElGamal(const Params& params, gmp_randclass& rand)
 	cout << "Ciphertext: B=" << cipher.B.get_mpz_t()
 			<< ", c=" << cipher.c.get_mpz_t() << "\n\n";
 	
-	vector<DecryptShare> decryptionShares;
-	decryptionShares.reserve(keyshares.size());
-	for (auto keyshare : keyshares)
+	vector<DecryptShare> decryptionShares(keyshares.size());
+	vector<ShareProof> proofs(keyshares.size());
+	vector<mpz_class> keys;
+	vector<ShareClaim> claims;
+	keys.reserve(keyshares.size());
+	for (size_t i = 0; i < keyshares.size(); i++)
 	{
-		const DecryptShare decryptShare = keyshare.decryptShare(params, cipher);
+		const DecryptShare& decryptShare = decryptionShares[i];
+		keyshares[i].decryptShare(decryptionShares[i], proofs[i], params,
+				cipher, rand);
+		keys.push_back(keyshares[i].verificationKey(params));
+		claims.push_back({ &keys[i], &cipher, &decryptShare, &proofs[i] });
 		cout << "DecryptShare: x=" << decryptShare.x
 				<< ", share=" << decryptShare.share.get_mpz_t() << '\n';
-		decryptionShares.push_back(decryptShare);
 	}
-	cout << '\n';
+	cout << "DecryptShares verified="
+			<< verifyShareProofs(params, claims, rand) << "\n\n";
 	
 	const mpz_class recoveredMsgWithPrivKey = priv.decrypt(params, cipher);
 	cout << "recoveredMsg (with private key)="
@@ -163,7 +159,7 @@ void testThresholdElGamal(const Params& params, gmp_randclass& rand)
 	cout << "recoveredMsg=" << recoveredMsg.get_mpz_t() << endl;
 }
 
-int testThresholdElGamalErrorIter(const Params& params, gmp_randclass& rand)
+int testThresholdElGamalErrorIter(const Params& params, RandomSource& rand)
 {
 	const KeyPair keyPair = params.makeKeys(rand);
 	const PrivateKey priv = get<PrivateKey>(keyPair);
@@ -179,7 +175,7 @@ int testThresholdElGamalErrorIter(const Params& params, gmp_randclass& rand)
 	
 	const vector<Keyshare> keyshares = priv.generateShares(params,
 			numKeyshares, numKeyshares, rand);
-//	for (auto share : keyshares)
+//	for (const auto& share : keyshares)
 //		cout << "Keyshare: x=" << share.x
 //				<< ", y=" << share.y.get_mpz_t() << '\n';
 //	cout << '\n';
@@ -197,7 +193,7 @@ int testThresholdElGamalErrorIter(const Params& params, gmp_randclass& rand)
 	
 	vector<DecryptShare> decryptionShares;
 	decryptionShares.reserve(keyshares.size());
-	for (auto keyshare : keyshares)
+	for (const auto& keyshare : keyshares)
 	{
 		const DecryptShare decryptShare = keyshare.decryptShare(params, cipher);
 //		cout << "DecryptShare: x=" << decryptShare.x
@@ -212,14 +208,14 @@ int testThresholdElGamalErrorIter(const Params& params, gmp_randclass& rand)
 	if (recoveredMsg == 1)
 		return 0;
 	for (int i = 1; ; i++) {
-		if (recoveredMsg == params.modExp(cipher.B, i))
+		if (recoveredMsg == params.modExp(cipher.B, i, publicExponent))
 			return i;
-		if (recoveredMsg == params.modExp(cipher.B, mpz_class(-i)))
+		if (recoveredMsg == params.modExp(cipher.B, mpz_class(-i), publicExponent))
 			return -i;
 	}
 }
 
-void testThresholdElGamalError(const Params& params, gmp_randclass& rand)
+void testThresholdElGamalError(const Params& params, RandomSource& rand)
 {
 	unsigned hist[7] = {};
 	for (unsigned i = 0; i < 10000; i++)
@@ -240,17 +236,160 @@ void testThresholdElGamalError(const Params& params, gmp_randclass& rand)
 	cout << endl;
 }
 
+// Compare bytes with a published test vector, given in hex.
+bool knownAnswer(const char* name, const uint8_t* bytes, const size_t n,
+		const string& hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	string got;
+	for (size_t i = 0; i < n; i++)
+	{
+		got += digits[bytes[i] >> 4];
+		got += digits[bytes[i] & 0xf];
+	}
+	const bool ok = got == hex;
+	cout << name << " known answer ok=" << ok << '\n';
+	return ok;
+}
+
+// RFC 8032's base point, y = 4/5: 0x58, then 31 bytes of 0x66.
+bool testEd25519Encoding()
+{
+	const Ed25519Group group;
+	uint8_t encoded[Ed25519Group::encodedBytes];
+	group.write(group.generator(), encoded);
+	return knownAnswer("Ed25519 base point", encoded, sizeof encoded,
+			"58" + string(62, '6'));
+}
+
+// FIPS 180-2's one-block example.
+bool testSha256()
+{
+	uint8_t digest[Sha256::digestBytes];
+	Sha256::hash("abc", 3, digest);
+	return knownAnswer("SHA-256", digest, sizeof digest,
+			"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+// The reference implementation's vectors: key 00..0f, message 00..n-1,
+// for the empty message, a partial word, a whole one and several.
+bool testSipHash128()
+{
+	const SetIntersection::HashKey key = {
+			{ 0x0706050403020100ull, 0x0f0e0d0c0b0a0908ull } };
+	const pair<size_t, const char*> vectors[] = {
+		{ 0, "a3817f04ba25a8e66df67214c7550293" },
+		{ 1, "da87c1d86b99af44347659119b22fc45" },
+		{ 8, "3b62a9ba6258f5610f83e264f31497b4" },
+		{ 15, "5493e99933b0a8117e08ec0f97cfc3d9" },
+		{ 63, "5150d1772f50834a503e069a973fbd7c" }
+	};
+	uint8_t msg[63];
+	for (size_t i = 0; i < sizeof msg; i++)
+		msg[i] = i;
+	bool ok = true;
+	for (const auto& vector : vectors)
+	{
+		uint64_t out[2];
+		SetIntersection::sipHash128(key, msg, vector.first, out);
+		uint8_t bytes[16];
+		Bytes::putWord(bytes, out[0]);
+		Bytes::putWord(bytes + 8, out[1]);
+		const string name = "SipHash-128 of " + to_string(vector.first)
+				+ " bytes";
+		ok = knownAnswer(name.c_str(), bytes, sizeof bytes, vector.second)
+				&& ok;
+	}
+	return ok;
+}
+
+// The all-zero key and nonce, first two blocks, as in RFC 7539's test
+// vectors.
+bool testChaCha20()
+{
+	const uint8_t key[ChaCha20Random::keyBytes] = {};
+	ChaCha20Random stream(key);
+	uint8_t bytes[128];
+	stream.fill(bytes, sizeof bytes);
+	return knownAnswer("ChaCha20 keystream", bytes, sizeof bytes,
+			"76b8e0ada0f13d90405d6ae55386bd28bdd219b8a08ded1aa836efcc8b770dc7"
+			"da41597c5157488d7724e03fb8d84a376a43b8f41518a11cc387b669b2ee6586"
+			"9f07e7be5551387a98ba977c732d080dcb0f29a048e3656912c6533e32ee7aed"
+			"29b721769ce64e43d57133b074d839d531ed1f28510afb45ace10a1f4b794d6f");
+}
+
+// modExpBatch against mpz_powm, secret and public, over counts that run
+// on the multi-buffer kernel where there is one (8, 16), leave it a short
+// tail for GMP (11), run a partial batch on it (13) or skip it (3), with
+// zero, short and full-length exponents.
+bool testModExpBatch(const Params& params, RandomSource& rand)
+{
+	bool ok = true;
+	for (const size_t count : { 3, 8, 11, 13, 16 })
+		for (const bool shortOnly : { false, true })
+		{
+			vector<mpz_class> bases, pows, outs(count);
+			vector<mpz_class*> outPtrs;
+			vector<const mpz_class*> basePtrs, powPtrs;
+			for (size_t i = 0; i < count; i++)
+			{
+				bases.push_back(rand.uniform(params.p));
+				if (i % 3 == 0)
+					pows.push_back(0);
+				else if (i % 3 == 1 || shortOnly)
+					pows.push_back(rand.bits(params.exponentBits));
+				else
+					pows.push_back(rand.uniform(params.order));
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				outPtrs.push_back(&outs[i]);
+				basePtrs.push_back(&bases[i]);
+				powPtrs.push_back(&pows[i]);
+			}
+			
+			for (const bool secret : { true, false })
+			{
+				if (secret)
+					params.modExpBatch(outPtrs.data(), basePtrs.data(),
+							powPtrs.data(), count, secretExponent);
+				else
+					params.modExpBatch(outPtrs.data(), basePtrs.data(),
+							powPtrs.data(), count, publicExponent);
+				for (size_t i = 0; i < count; i++)
+				{
+					mpz_class expected;
+					mpz_powm(expected.get_mpz_t(), bases[i].get_mpz_t(),
+							pows[i].get_mpz_t(), params.p.get_mpz_t());
+					ok = ok && outs[i] == expected;
+				}
+			}
+		}
+	cout << "modExpBatch matches GMP=" << ok << "\n\n";
+	return ok;
+}
+
 int main() {
-	gmp_randclass rand(gmp_randinit_default);
-	rand.seed(time(nullptr));
+	// Keyed from the kernel; safe to share between threads.
+	ThreadRandom rand;
 	
-	const mpz_class p = examplePrime16;
-	const mpz_class g = rand.get_z_range(p - 3) + 2;
-	const Params params(p, g);
+	// g = 2 generates the prime-order subgroup of the RFC 3526 group.  Its
+	// tables are mapped from make cache's output when there is one.
+	const Params params = Params::primeOrderSubgroup(prime2048rfc3526, 2,
+			defaultSubgroupExponentBits, defaultTableWindowBits,
+			PrecomputeCache::open("precompute.cache"));
 	cout << "Params: g=" << params.g.get_mpz_t()
 			<< ", p=" << params.p.get_mpz_t() << "\n\n";
 	
+	testEd25519Encoding();
+	testSha256();
+	testSipHash128();
+	testChaCha20();
+	cout << '\n';
+	testModExpBatch(params, rand);
 	testThresholdElGamal(params, rand);
 	
+	if (Instrument::enabled)
+		Instrument::writeReport(cerr);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+// Writes a PrecomputeCache for the RFC 3526 group, in each form the
+// programs use, and for any long-lived public keys given:
+//
+//   bin/buildcache FILE [A ...]
+//
+// Keys are integers in any base mpz_class accepts (0x for hex).
+
+#include <iostream>
+#include "DiscreteLog.h"
+#include "ElGamal.h"
+#include "PrecomputeCache.h"
+
+using namespace std;
+using namespace ElGamal;
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		cerr << "usage: " << argv[0] << " FILE [A ...]\n";
+		return 2;
+	}
+	
+	PrecomputeCache::Builder builder;
+	builder.add(Params(prime2048rfc3526, 2));
+	for (const unsigned exponentBits : { defaultSubgroupExponentBits, 320u })
+	{
+		const Params params = Params::primeOrderSubgroup(prime2048rfc3526, 2,
+				exponentBits);
+		builder.add(params);
+		for (int i = 2; i < argc; i++)
+		{
+			mpz_class A;
+			if (A.set_str(argv[i], 0) != 0 || A <= 1 || A >= params.p)
+			{
+				cerr << "not a public key: " << argv[i] << '\n';
+				return 2;
+			}
+			builder.add(params, PublicKey(A));
+		}
+		if (exponentBits == defaultSubgroupExponentBits)
+			builder.add(DiscreteLog(params, 2, 1ul << 20));
+	}
+	
+	if (!builder.write(argv[1]))
+	{
+		cerr << "cannot write " << argv[1] << '\n';
+		return 1;
+	}
+	// Opening checks only the directory; check every payload once here.
+	const auto cache = PrecomputeCache::open(argv[1]);
+	if (!cache || !cache->verify())
+	{
+		cerr << "cannot verify " << argv[1] << '\n';
+		return 1;
+	}
+	return 0;
+}